@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cart.h>
+#include <emu.h>
+
+#include <string>
+
+#ifndef GABOEM_ROMS_DIR
+#define GABOEM_ROMS_DIR "roms"
+#endif
+
+namespace gaboem::bench
+{
+    // loads roms/<name> once, later calls with the same name are free.
+    inline bool LoadRom(const std::string &name)
+    {
+        static std::string loaded;
+
+        if (loaded == name)
+            return true;
+
+        std::string path = std::string(GABOEM_ROMS_DIR) + "/" + name;
+        if (!cart_load(path.c_str()))
+            return false;
+
+        loaded = name;
+        return true;
+    }
+
+    inline void Reset(void)
+    {
+        emu_init();
+        EMU->idle_skip = true;
+    }
+}
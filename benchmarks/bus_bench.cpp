@@ -0,0 +1,61 @@
+#include "bench.h"
+
+#include <bus.h>
+
+#include <benchmark/benchmark.h>
+
+namespace gaboem::bench
+{
+    static void bus_read_region(benchmark::State &state, u16 address)
+    {
+        if (!LoadRom("cpu_instrs.gb"))
+            return state.SkipWithError("cpu_instrs.gb not found");
+
+        Reset();
+
+        u8 sum = 0;
+        for (auto _ : state)
+        {
+            for (u16 i = 0; i < 64; i++)
+                sum += bus_read(address + (i & 0x07));
+        }
+
+        benchmark::DoNotOptimize(sum);
+        state.SetItemsProcessed(state.iterations() * 64);
+    }
+
+    static void bus_write_region(benchmark::State &state, u16 address)
+    {
+        if (!LoadRom("cpu_instrs.gb"))
+            return state.SkipWithError("cpu_instrs.gb not found");
+
+        Reset();
+
+        for (auto _ : state)
+        {
+            for (u16 i = 0; i < 64; i++)
+                bus_write(address + (i & 0x07), i);
+        }
+
+        state.SetItemsProcessed(state.iterations() * 64);
+    }
+
+    // clang-format off
+    BENCHMARK_CAPTURE(bus_read_region, rom0, 0x0100);
+    BENCHMARK_CAPTURE(bus_read_region, romx, 0x4100);
+    BENCHMARK_CAPTURE(bus_read_region, vram, 0x8000);
+    BENCHMARK_CAPTURE(bus_read_region, eram, 0xA000);
+    BENCHMARK_CAPTURE(bus_read_region, wram, 0xC000);
+    BENCHMARK_CAPTURE(bus_read_region, echo, 0xE000);
+    BENCHMARK_CAPTURE(bus_read_region, oam,  0xFE00);
+    BENCHMARK_CAPTURE(bus_read_region, io,   0xFF40);
+    BENCHMARK_CAPTURE(bus_read_region, hram, 0xFF80);
+
+    BENCHMARK_CAPTURE(bus_write_region, mbc,  0x2000);
+    BENCHMARK_CAPTURE(bus_write_region, vram, 0x8000);
+    BENCHMARK_CAPTURE(bus_write_region, wram, 0xC000);
+    BENCHMARK_CAPTURE(bus_write_region, oam,  0xFE00);
+    BENCHMARK_CAPTURE(bus_write_region, io,   0xFF10);
+    BENCHMARK_CAPTURE(bus_write_region, hram, 0xFF80);
+    // clang-format on
+}
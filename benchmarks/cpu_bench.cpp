@@ -0,0 +1,125 @@
+#include "bench.h"
+
+#include <bus.h>
+#include <cpu.h>
+
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <vector>
+
+extern cpu_context ctx;
+
+namespace gaboem::bench
+{
+    // clang-format off
+    // register arithmetic: ADD A,B; INC C; XOR D; LD E,A; SUB E; LD B,C; AND L; JR -9
+    static const std::vector<u8> ALU_MIX = {0x80, 0x0C, 0xAA, 0x5F, 0x93, 0x41, 0xA5, 0x18, 0xF7};
+
+    // memory: LD HL,$C100; LD (HL),A; LD A,(HL); INC (HL); LD B,(HL); LDH A,($80); JR -8
+    static const std::vector<u8> MEM_MIX = {0x21, 0x00, 0xC1, 0x77, 0x7E, 0x34, 0x46, 0xF0, 0x80, 0x18, 0xF8};
+
+    // control flow: CALL $C008; JR -5; NOP; NOP; NOP; RET
+    static const std::vector<u8> BRANCH_MIX = {0xCD, 0x08, 0xC0, 0x18, 0xFB, 0x00, 0x00, 0x00, 0xC9};
+
+    // 16-bit and CB prefix: INC HL; ADD HL,DE; SWAP A; BIT 3,B; RL C; PUSH BC; POP DE; JR -12
+    static const std::vector<u8> WIDE_MIX = {0x23, 0x19, 0xCB, 0x37, 0xCB, 0x58, 0xCB, 0x11, 0xC5, 0xD1, 0x18, 0xF4};
+    // clang-format on
+
+    static void cpu_step_mix(benchmark::State &state, const std::vector<u8> &program, bool jit)
+    {
+        if (!LoadRom("cpu_instrs.gb"))
+            return state.SkipWithError("cpu_instrs.gb not found");
+
+        Reset();
+        EMU->jit = jit;
+
+        for (size_t i = 0; i < program.size(); i++)
+            bus_write(0xC000 + i, program[i]);
+
+        ctx.regs.pc = 0xC000;
+        ctx.regs.sp = 0xDFF0;
+
+        u64 ticks = EMU->ticks;
+
+        for (auto _ : state)
+        {
+            for (u32 i = 0; i < 256; i++)
+                cpu_step();
+        }
+
+        state.SetItemsProcessed(state.iterations() * 256);
+        state.counters["MHz"] = benchmark::Counter((EMU->ticks - ticks) / 1e6, benchmark::Counter::kIsRate);
+    }
+
+    BENCHMARK_CAPTURE(cpu_step_mix, alu, ALU_MIX, false);
+    BENCHMARK_CAPTURE(cpu_step_mix, mem, MEM_MIX, false);
+    BENCHMARK_CAPTURE(cpu_step_mix, branch, BRANCH_MIX, false);
+    BENCHMARK_CAPTURE(cpu_step_mix, wide, WIDE_MIX, false);
+
+#ifdef USE_JIT
+    BENCHMARK_CAPTURE(cpu_step_mix, alu_jit, ALU_MIX, true);
+    BENCHMARK_CAPTURE(cpu_step_mix, mem_jit, MEM_MIX, true);
+    BENCHMARK_CAPTURE(cpu_step_mix, branch_jit, BRANCH_MIX, true);
+    BENCHMARK_CAPTURE(cpu_step_mix, wide_jit, WIDE_MIX, true);
+#endif
+
+    // the CPU alone: flat memory, nothing else ticks
+    static void cpu_flat_mix(benchmark::State &state, const std::vector<u8> &program)
+    {
+        static std::array<u8, 0x10000> memory;
+
+        Reset();
+        std::copy(program.begin(), program.end(), memory.begin() + 0xC000);
+        bus_flat(memory.data(), nullptr, 0);
+
+        ctx.regs.pc = 0xC000;
+        ctx.regs.sp = 0xDFF0;
+
+        for (auto _ : state)
+        {
+            for (u32 i = 0; i < 256; i++)
+                cpu_step();
+        }
+
+        bus_flat_end();
+        state.SetItemsProcessed(state.iterations() * 256);
+    }
+
+    BENCHMARK_CAPTURE(cpu_flat_mix, alu, ALU_MIX);
+    BENCHMARK_CAPTURE(cpu_flat_mix, mem, MEM_MIX);
+    BENCHMARK_CAPTURE(cpu_flat_mix, branch, BRANCH_MIX);
+    BENCHMARK_CAPTURE(cpu_flat_mix, wide, WIDE_MIX);
+
+    // single step test vectors: set the registers and a few bytes, run one
+    // instruction and keep its access log
+    static void cpu_flat_vector(benchmark::State &state)
+    {
+        static std::array<u8, 0x10000> memory;
+        bus_access log[8];
+
+        Reset();
+        bus_flat(memory.data(), log, 8);
+
+        cpu_registers regs = {.a = 0x12, .f = 0xB0, .b = 0x34, .c = 0x56, .h = 0xC1, .l = 0x00, .pc = 0x0100, .sp = 0xFFFE};
+        u8 opcode = 0;
+
+        for (auto _ : state)
+        {
+            // LD r,r and the ALU ops on registers and (HL), HALT included
+            ctx.regs = regs;
+            ctx.flags.op = LF_NONE;
+            ctx.halted = false;
+            memory[0x0100] = 0x40 + (opcode++ & 0x7F);
+            bus_flat_clear();
+
+            cpu_step();
+            benchmark::DoNotOptimize(log[0]);
+        }
+
+        bus_flat_end();
+        state.SetItemsProcessed(state.iterations());
+    }
+
+    BENCHMARK(cpu_flat_vector);
+}
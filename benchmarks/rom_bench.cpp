@@ -0,0 +1,38 @@
+#include "bench.h"
+
+#include <cpu.h>
+#include <ppu.h>
+
+#include <benchmark/benchmark.h>
+
+namespace gaboem::bench
+{
+    // whole system on a real ROM for a fixed number of T-cycles
+    static void rom_run(benchmark::State &state, const char *rom)
+    {
+        if (!LoadRom(rom))
+            return state.SkipWithError("ROM not found");
+
+        const u64 ticks = state.range(0);
+        u64 frames = 0;
+
+        for (auto _ : state)
+        {
+            state.PauseTiming();
+            Reset();
+            state.ResumeTiming();
+
+            while (EMU->ticks < ticks)
+                cpu_step();
+
+            frames += PPU->current_frame;
+        }
+
+        state.counters["MHz"] = benchmark::Counter(state.iterations() * ticks / 1e6, benchmark::Counter::kIsRate);
+        state.counters["fps"] = benchmark::Counter(frames, benchmark::Counter::kIsRate);
+    }
+
+    BENCHMARK_CAPTURE(rom_run, cpu_instrs, "cpu_instrs.gb")->Arg(1 << 24)->Unit(benchmark::kMillisecond);
+    BENCHMARK_CAPTURE(rom_run, mem_timing, "mem_timing.gb")->Arg(1 << 24)->Unit(benchmark::kMillisecond);
+    BENCHMARK_CAPTURE(rom_run, dmg_acid2, "dmg-acid2.gb")->Arg(1 << 24)->Unit(benchmark::kMillisecond);
+}
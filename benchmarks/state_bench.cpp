@@ -0,0 +1,139 @@
+#include "bench.h"
+
+#include <cpu.h>
+#include <link.h>
+#include <ppu.h>
+#include <state.h>
+
+#include <benchmark/benchmark.h>
+
+namespace gaboem::bench
+{
+    // a machine a few frames into the ROM, with its snapshot buffer
+    static state_snapshot *SetupMachine(benchmark::State &state, const char *rom)
+    {
+        if (!LoadRom(rom))
+        {
+            state.SkipWithError("ROM not found");
+            return nullptr;
+        }
+
+        Reset();
+
+        while (PPU->current_frame < 10)
+            cpu_step();
+
+        state_snapshot *snapshot = state_create();
+        state_save(snapshot);
+        return snapshot;
+    }
+
+    static void state_save_rom(benchmark::State &state, const char *rom)
+    {
+        state_snapshot *snapshot = SetupMachine(state, rom);
+        if (!snapshot)
+            return;
+
+        for (auto _ : state)
+            state_save(snapshot);
+
+        state.SetBytesProcessed(state.iterations() * state_size(snapshot));
+        state_destroy(snapshot);
+    }
+
+    static void state_load_rom(benchmark::State &state, const char *rom)
+    {
+        state_snapshot *snapshot = SetupMachine(state, rom);
+        if (!snapshot)
+            return;
+
+        for (auto _ : state)
+            state_load(snapshot);
+
+        state.SetBytesProcessed(state.iterations() * state_size(snapshot));
+        state_destroy(snapshot);
+    }
+
+    // what run-ahead pays every frame on top of emulating it
+    static void state_round_trip(benchmark::State &state, const char *rom)
+    {
+        state_snapshot *snapshot = SetupMachine(state, rom);
+        if (!snapshot)
+            return;
+
+        for (auto _ : state)
+        {
+            state_save(snapshot);
+            state_load(snapshot);
+        }
+
+        state.counters["bytes"] = state_size(snapshot);
+        state_destroy(snapshot);
+    }
+
+    BENCHMARK_CAPTURE(state_save_rom, dmg_acid2, "dmg-acid2.gb");
+    BENCHMARK_CAPTURE(state_load_rom, dmg_acid2, "dmg-acid2.gb");
+    BENCHMARK_CAPTURE(state_round_trip, dmg_acid2, "dmg-acid2.gb");
+    BENCHMARK_CAPTURE(state_round_trip, cpu_instrs, "cpu_instrs.gb");
+    BENCHMARK_CAPTURE(state_round_trip, battery_ram, "05.gb");
+
+    // one displayed frame: the machine frame plus `range(0)` frames ahead
+    static void run_ahead_frame(benchmark::State &state)
+    {
+        state_snapshot *snapshot = SetupMachine(state, "dmg-acid2.gb");
+        if (!snapshot)
+            return;
+
+        state_destroy(snapshot);
+
+        EMU->run_ahead = state.range(0);
+        PFC->timing_only = EMU->run_ahead > 0;
+
+        for (auto _ : state)
+        {
+            u32 frame = PPU->current_frame;
+
+            while (PPU->current_frame == frame)
+                cpu_step();
+
+            if (EMU->run_ahead)
+                emu_run_ahead();
+        }
+
+        EMU->run_ahead = 0;
+        PFC->timing_only = false;
+
+        state.SetItemsProcessed(state.iterations());
+    }
+
+    BENCHMARK(run_ahead_frame)->Arg(0)->Arg(1)->Arg(2)->Arg(4)->Unit(benchmark::kMillisecond);
+
+    // one frame of the local machine with a peer plugged, swapped every
+    // `range(0)` ticks
+    static void linked_frame(benchmark::State &state)
+    {
+        state_snapshot *snapshot = SetupMachine(state, "dmg-acid2.gb");
+        if (!snapshot)
+            return;
+
+        state_destroy(snapshot);
+        link_init(state.range(0));
+
+        for (auto _ : state)
+        {
+            u32 frame = link_frame();
+
+            while (link_frame() == frame)
+            {
+                cpu_step();
+                link_update();
+            }
+        }
+
+        link_stop();
+
+        state.SetItemsProcessed(state.iterations());
+    }
+
+    BENCHMARK(linked_frame)->Arg(64)->Arg(512)->Arg(4096)->Unit(benchmark::kMillisecond);
+}
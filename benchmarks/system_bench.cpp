@@ -0,0 +1,98 @@
+#include "bench.h"
+
+#include <bus.h>
+#include <dma.h>
+#include <lcd.h>
+#include <ppu.h>
+#include <timer.h>
+
+#include <benchmark/benchmark.h>
+
+namespace gaboem::bench
+{
+    // a busy line: background on, 10 sprites on line 10
+    static void SetupScene(void)
+    {
+        Reset();
+
+        for (u16 i = 0; i < 0x2000; i++)
+            bus_write(ADDR_VRAM_START + i, i * 37);
+
+        for (u8 i = 0; i < 10; i++)
+        {
+            bus_write(ADDR_OAM_START + i * 4 + 0, 10 + 16);
+            bus_write(ADDR_OAM_START + i * 4 + 1, 8 + i * 16);
+            bus_write(ADDR_OAM_START + i * 4 + 2, i);
+            bus_write(ADDR_OAM_START + i * 4 + 3, 0);
+        }
+
+        LCDC = 0x93;
+    }
+
+    static void ppu_tick_mode(benchmark::State &state, lcd_mode mode)
+    {
+        SetupScene();
+
+        u64 ticks = 0;
+
+        for (auto _ : state)
+        {
+            state.PauseTiming();
+            lcd_mode first = mode == MODE_VBLANK ? MODE_VBLANK : MODE_OAM;
+            LCD->ly = mode == MODE_VBLANK ? 145 : 10;
+            LCDS_MODE_SET(first);
+            PPU->line_ticks = 0;
+
+            while (LCDS_MODE != mode)
+                ppu_tick();
+            state.ResumeTiming();
+
+            // the line ends when line_ticks wraps, the mode may not change
+            do
+            {
+                ppu_tick();
+                ticks++;
+            } while (LCDS_MODE == mode && PPU->line_ticks != 0);
+        }
+
+        state.SetItemsProcessed(ticks);
+    }
+
+    BENCHMARK_CAPTURE(ppu_tick_mode, oam, MODE_OAM);
+    BENCHMARK_CAPTURE(ppu_tick_mode, xfer, MODE_XFER);
+    BENCHMARK_CAPTURE(ppu_tick_mode, hblank, MODE_HBLANK);
+    BENCHMARK_CAPTURE(ppu_tick_mode, vblank, MODE_VBLANK);
+
+    static void timer_tick_enabled(benchmark::State &state)
+    {
+        Reset();
+        timer_write(TIMER_CONTROL, 0x05); // 262144 Hz
+
+        for (auto _ : state)
+        {
+            for (u32 i = 0; i < 1024; i++)
+                timer_tick();
+        }
+
+        state.SetItemsProcessed(state.iterations() * 1024);
+    }
+
+    BENCHMARK(timer_tick_enabled);
+
+    static void dma_tick_transfer(benchmark::State &state)
+    {
+        Reset();
+
+        for (auto _ : state)
+        {
+            dma_start(0xC0);
+
+            while (dma_transfering())
+                dma_tick();
+        }
+
+        state.SetItemsProcessed(state.iterations() * 0xA0);
+    }
+
+    BENCHMARK(dma_tick_transfer);
+}
@@ -0,0 +1,57 @@
+#include <bus.h>
+#include <cart.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// The input is a whole ROM image: the header is parsed, the banks are set up
+// for it and then driven through the bus. Loading the cartridge is the thing
+// under test, so it is redone every run, the rest of the machine is not
+// involved and is only set up once.
+//
+// The first 0x100 bytes are the restart and interrupt vectors, nothing in the
+// header looks at them. They double as (register, value) pairs written to the
+// mapper, each write followed by reads across the switchable ROM bank and the
+// external RAM.
+
+namespace gaboem::fuzz
+{
+    static constexpr u32 WRITE_COUNT = 0x80;
+
+    static void Drive(const uint8_t *data, size_t size)
+    {
+        for (size_t i = 0; i + 1 < size && i < WRITE_COUNT * 2; i += 2)
+        {
+            // $0000-$7FFF registers or $A000-$BFFF external RAM
+            u16 address = data[i] & 0x80 ? 0xA000 | (data[i] & 0x1F) << 8 : data[i] << 8;
+
+            bus_write(address, data[i + 1]);
+
+            for (u32 offset = 0; offset < 0x2000; offset += 0x3FF)
+            {
+                bus_read(0x4000 + offset * 2);
+                bus_read(0xA000 + offset);
+            }
+        }
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    using namespace gaboem::fuzz;
+
+    static bool setup = false;
+    if (!setup)
+    {
+        bus_init();
+        setup = true;
+    }
+
+    if (!cart_load_data("cart_fuzz", data, size))
+        return 0;
+
+    cart_map();
+    Drive(data, size);
+
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include <bus.h>
+#include <cart.h>
+#include <cpu.h>
+#include <emu.h>
+#include <state.h>
+
+#include <cstddef>
+#include <cstdint>
+
+extern cpu_context ctx;
+
+// The input is a program run from WRAM on a freshly reset machine. Resetting
+// through emu_init() would redo the whole boot state every run, instead both
+// a DMG and a CGB machine are set up once and snapshotted, each run restores
+// one of them: a few memcpy instead of a reset.
+//
+// byte 0   : bit 0 picks the CGB machine, bit 1 turns idle skipping on
+// bytes 1+ : code and data at $C000, up to 1 KiB
+
+namespace gaboem::fuzz
+{
+    static constexpr u32 PROGRAM_SIZE = 0x400;
+    static constexpr u32 RUN_TICKS = 1024; // a bit over two scanlines, a few hundred instructions
+
+    static state_snapshot *machines[2];
+
+    static void Setup(void)
+    {
+        // an empty ROM: NOPs up to the end of the header, then RST $38
+        static u8 rom[0x150] = {};
+        rom[0x143] = 0x80;
+
+        cart_load_data("cpu_fuzz", rom, sizeof(rom));
+
+        for (u8 cgb = 0; cgb < 2; cgb++)
+        {
+            EMU->force_dmg = !cgb;
+            emu_init();
+
+            ctx.regs.pc = 0xC000;
+            ctx.regs.sp = 0xDFF0;
+
+            machines[cgb] = state_create();
+            state_save(machines[cgb]);
+        }
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    using namespace gaboem::fuzz;
+
+    if (!machines[0])
+        Setup();
+
+    if (size == 0)
+        return 0;
+
+    state_load(machines[data[0] & 1]);
+    EMU->idle_skip = data[0] & 2;
+
+    size = size - 1 < PROGRAM_SIZE ? size - 1 : PROGRAM_SIZE;
+
+    // through the bus so the decoded blocks of the last run are dropped
+    for (size_t i = 0; i < size; i++)
+        bus_write(0xC000 + i, data[1 + i]);
+
+    u64 end = EMU->ticks + RUN_TICKS;
+
+    while (EMU->ticks < end && cpu_step())
+        ;
+
+    return 0;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <common.h>
+#include <state.h>
+
+#define APU_CLOCK 4194304
+#define APU_SAMPLE_RATE 48000
+
+#define APU_START 0xFF10
+#define APU_END 0xFF3F
+
+#define NR10 0xFF10
+#define NR11 0xFF11
+#define NR12 0xFF12
+#define NR13 0xFF13
+#define NR14 0xFF14
+#define NR21 0xFF16
+#define NR22 0xFF17
+#define NR23 0xFF18
+#define NR24 0xFF19
+#define NR30 0xFF1A
+#define NR31 0xFF1B
+#define NR32 0xFF1C
+#define NR33 0xFF1D
+#define NR34 0xFF1E
+#define NR41 0xFF20
+#define NR42 0xFF21
+#define NR43 0xFF22
+#define NR44 0xFF23
+#define NR50 0xFF24
+#define NR51 0xFF25
+#define NR52 0xFF26
+#define WAVE_RAM 0xFF30
+
+// receives interleaved stereo samples at APU_SAMPLE_RATE
+typedef void (*apu_sink)(const int16_t *samples, u32 frames, void *user);
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    void apu_init(void);
+
+    u8 apu_read(u16 address);
+    void apu_write(u16 address, u8 value);
+
+    void apu_end_frame(void);
+    void apu_set_sink(apu_sink sink, void *user);
+    void apu_set_resample_ratio(double ratio);
+
+    void apu_state_save(state_stream *stream);
+    void apu_state_load(state_stream *stream);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <common.h>
+
+// bigger than any cartridge, what a corrupt or hostile archive inflates to
+#define ARCHIVE_MAX_SIZE 0x1000000
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // the rom in a plain, gzip or zip file, told apart by their magic. The
+    // buffer is sized to the next power of two of `*size`, 32 KB or more, so
+    // the cartridge keeps it as is. NULL when the file can't be read.
+    u8 *archive_read(const char *path, u32 *size);
+
+    // the buffer size archive_read allocates for `size` bytes
+    u32 archive_capacity(u32 size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <common.h>
+
+typedef enum
+{
+    AUDIO_NULL,
+    AUDIO_SDL,
+    AUDIO_WAV,
+} audio_sink_type;
+
+// single-producer/single-consumer queue of interleaved stereo frames
+typedef struct audio_ring audio_ring;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    audio_ring *audio_ring_create(u32 frames);
+    void audio_ring_destroy(audio_ring *ring);
+
+    u32 audio_ring_write(audio_ring *ring, const int16_t *samples, u32 frames);
+    u32 audio_ring_read(audio_ring *ring, int16_t *samples, u32 frames);
+    u32 audio_ring_fill(const audio_ring *ring);
+
+    // spec is "sdl", "null" or "wav:<path>"
+    bool audio_init(const char *spec);
+    void audio_close(void);
+
+    audio_sink_type audio_sink_get(void);
+
+    // frames queued for the audio device, 0 unless the sink is sdl.
+    u32 audio_buffered(void);
+
+    // called from the audio device thread, pads underruns with the last frame.
+    void audio_pull(int16_t *samples, u32 frames);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <common.h>
+
+#define BATTERY_BANK_SIZE 0x2000
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    void battery_start(const char *path, u8 *const *banks, u8 bank_count);
+    bool battery_submit(u8 *const *banks, u16 dirty);
+    void battery_stop(u8 *const *banks, u16 dirty);
+
+#ifdef __cplusplus
+}
+#endif
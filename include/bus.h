@@ -2,17 +2,61 @@
 
 #include <common.h>
 
+#define BUS_WATCH_READ 0x01
+#define BUS_WATCH_WRITE 0x02
+
+typedef struct
+{
+    u16 pc; // instruction (or recompiled block) doing the access
+    u16 address;
+    u8 value;
+    bool write;
+    u64 ticks;
+} bus_access;
+
+typedef void (*bus_watch_fn)(const bus_access *access, void *user);
+
+// set while the CPU runs alone against a flat memory (see bus_flat)
+extern bool bus_flat_active;
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
+    void bus_init(void);
+
+    // reads of [start, end] come from `data` directly, NULL restores the handler.
+    void bus_map(u16 start, u16 end, const u8 *data);
+
+    // host memory behind the page holding `address`, NULL if it has a handler
+    const u8 *bus_page(u16 address);
+
+    // read without side effects on watchpoints (instruction decoding, debugger)
+    u8 bus_peek(u16 address);
+
+    // returns the watchpoint id, or -1 when all are in use
+    int bus_watch(u16 start, u16 end, u8 flags, bus_watch_fn callback, void *user);
+    void bus_unwatch(int id);
+
     u8 bus_read(u16 address);
     void bus_write(u16 address, u8 value);
 
     u16 bus_read16(u16 address);
     void bus_write16(u16 address, u16 value);
 
+    // Every address reads and writes `memory` (64 KiB): no I/O, cartridge or
+    // video, an M-cycle only moves the tick count, nothing else runs. With a
+    // `log`, the CPU's accesses are appended to it, up to `capacity`, with
+    // the ticks they happened on. The block cache, the JIT and idle skipping
+    // are off until bus_flat_end() puts the machine's mapping back.
+    void bus_flat(u8 *memory, bus_access *log, u32 capacity);
+    void bus_flat_end(void);
+
+    // accesses since bus_flat() or the last clear, can exceed the capacity
+    u32 bus_flat_count(void);
+    void bus_flat_clear(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <common.h>
+#include <state.h>
 
 typedef struct
 {
@@ -34,13 +35,25 @@ extern "C"
 #endif
 
     bool cart_load(const char *path);
+    // the rom image is copied, `name` is only shown and used for the battery file
+    bool cart_load_data(const char *name, const u8 *data, u32 size);
 
     u8 cart_read(u16 address);
     void cart_write(u16 address, u8 value);
 
+    void cart_map(void);
+    u8 cart_rom_bank(void);
+    const rom_header *cart_header(void);
+    bool cart_cgb(void);
+    bool cart_cgb_only(void);
+
     bool cart_need_save(void);
     void cart_battery_load(void);
     void cart_battery_save(void);
+    void cart_battery_flush(void);
+
+    void cart_state_save(state_stream *stream);
+    void cart_state_load(state_stream *stream);
 
 #ifdef __cplusplus
 }
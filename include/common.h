@@ -45,6 +45,15 @@
 #define ADDR_LCD_START 0xFF40
 #define ADDR_LCD_END 0xFF4B
 
+// CGB only
+#define SPEED_SWITCH 0xFF4D
+#define VRAM_BANK 0xFF4F
+#define HDMA_START 0xFF51
+#define HDMA_END 0xFF55
+#define ADDR_CRAM_START 0xFF68
+#define ADDR_CRAM_END 0xFF6B
+#define WRAM_BANK 0xFF70
+
 #define COLOR0 0xFF9BBC0F
 #define COLOR1 0xFF8BAC0F
 #define COLOR2 0xFF306230
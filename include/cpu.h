@@ -1,6 +1,7 @@
 #pragma once
 
 #include <common.h>
+#include <state.h>
 #include <instruction.h>
 
 #define REGS (cpu_get_registers())
@@ -11,17 +12,41 @@ typedef struct
     u16 pc, sp;
 } cpu_registers;
 
+// Flags left by the last 8-bit ALU op, resolved into regs.f only when read.
+typedef enum
+{
+    LF_NONE, // regs.f is up to date
+    LF_ADD,  // ADD/ADC: lhs + rhs + carry
+    LF_SUB,  // SUB/SBC/CP: lhs - rhs - carry
+    LF_AND,
+    LF_OR, // OR/XOR
+    LF_INC,
+    LF_DEC,
+} lazy_flags_op;
+
+typedef struct
+{
+    u8 op;
+    u8 lhs;
+    u8 rhs;
+    u8 carry;
+    u8 res;
+} cpu_lazy_flags;
+
 typedef struct
 {
     cpu_registers regs;
+    cpu_lazy_flags flags;
 
     u16 fetched_data;
     u16 mem_dest;
     bool dest_is_mem;
     u8 current_opcode;
     instruction *current_instruction;
+    u16 inst_pc; // address of the running instruction, or block under the JIT
 
     bool halted;
+    bool locked; // ran an illegal opcode, only a reset gets it going again
     bool stepping;
 
     bool int_master_enabled;
@@ -32,6 +57,18 @@ typedef struct
 } cpu_context;
 
 typedef void (*IN_PROC)(cpu_context *);
+typedef void (*FETCH_PROC)(u16 imm);
+
+// instruction decoded ahead of time by the block cache (see cpu_cache.c)
+typedef struct
+{
+    u8 opcode;
+    u8 cycles; // opcode and immediate fetch cycles
+    u16 imm;
+    instruction *inst;
+    FETCH_PROC fetch;
+    IN_PROC proc;
+} cpu_decoded;
 
 #ifdef __cplusplus
 extern "C"
@@ -50,6 +87,7 @@ extern "C"
     void cpu_fetch_data(void);
 
     void cpu_set_flags(u8 z, u8 n, u8 h, u8 c);
+    u8 cpu_resolve_flags(cpu_context *ctx);
 
     u8 cpu_get_ie_register(void);
     void cpu_set_ie_register(u8 n);
@@ -58,16 +96,34 @@ extern "C"
     void cpu_set_int_flags(u8 value);
 
     IN_PROC inst_get_processor(in_type type);
+    FETCH_PROC inst_get_fetcher(addr_mode mode);
+    u8 inst_length(instruction *inst);
+
+    const cpu_decoded *cpu_cache_lookup(u16 pc);
+    void cpu_cache_write(u16 address);
+    void cpu_cache_invalidate(void);
+    void cpu_cache_flush(void);
+
+    void cpu_idle_update(cpu_context *ctx, u16 branch);
 
     cpu_registers *cpu_get_registers(void);
+    u16 cpu_inst_pc(void);
 
     const char *instr_to_str(cpu_context *ctx);
 
+    void cpu_state_save(state_stream *stream);
+    void cpu_state_load(state_stream *stream);
+
+    void cpu_idle_state_save(state_stream *stream);
+    void cpu_idle_state_load(state_stream *stream);
+
 #ifdef __cplusplus
 }
 #endif
 
-#define CPU_FLAG_Z(ctx) BIT(ctx->regs.f, 7)
-#define CPU_FLAG_N(ctx) BIT(ctx->regs.f, 6)
-#define CPU_FLAG_H(ctx) BIT(ctx->regs.f, 5)
-#define CPU_FLAG_C(ctx) BIT(ctx->regs.f, 4)
+#define CPU_FLAGS(ctx) ((ctx)->flags.op == LF_NONE ? (ctx)->regs.f : cpu_resolve_flags(ctx))
+
+#define CPU_FLAG_Z(ctx) BIT(CPU_FLAGS(ctx), 7)
+#define CPU_FLAG_N(ctx) BIT(CPU_FLAGS(ctx), 6)
+#define CPU_FLAG_H(ctx) BIT(CPU_FLAGS(ctx), 5)
+#define CPU_FLAG_C(ctx) BIT(CPU_FLAGS(ctx), 4)
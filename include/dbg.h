@@ -7,7 +7,8 @@ extern "C"
 {
 #endif
 
-    void dbg_update(void);
+    // bytes sent on the serial port, test ROMs print their results there
+    void dbg_serial(u8 value);
     void dbg_print(void);
 
 #ifdef __cplusplus
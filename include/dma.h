@@ -1,6 +1,7 @@
 #pragma once
 
 #include <common.h>
+#include <state.h>
 
 #ifdef __cplusplus
 extern "C"
@@ -9,9 +10,13 @@ extern "C"
 
     void dma_start(u8 start);
     void dma_tick(void);
+    void dma_sync(void);
 
     bool dma_transfering(void);
 
+    void dma_state_save(state_stream *stream);
+    void dma_state_load(state_stream *stream);
+
 #ifdef __cplusplus
 }
 #endif
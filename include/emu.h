@@ -1,15 +1,44 @@
 #pragma once
 
 #include <common.h>
+#include <state.h>
 
 #define EMU (emu_get_context())
 
+typedef enum
+{
+    TIMING_ACCURATE, // the machine runs between the M-cycles of an instruction
+    TIMING_FAST,     // it catches up after the instruction or before I/O
+} emu_timing;
+
 typedef struct
 {
     bool paused;
     bool running;
     bool die;
     u64 ticks;
+
+    bool idle_skip; // fast-forward polling loops (see cpu_idle.c)
+    bool jit;       // run basic blocks through the recompiler (see jit.c)
+    emu_timing timing;
+
+    // M-cycles the CPU is ahead of the machine while deferring (see emu_sync)
+    bool deferring;
+    u64 deferred;
+
+    bool headless;   // no window, no keyboard
+    bool turbo;      // don't pace frames
+    u32 frame_limit; // stop once this frame is reached, 0 runs forever
+
+    u32 run_ahead; // frames shown ahead of the machine (see emu_run_ahead)
+    bool hidden;   // running frames nobody sees: run ahead or the linked peer
+    u32 shown;     // frames presented by run-ahead
+
+    bool force_dmg;    // run CGB compatible cartridges as DMG
+    bool cgb;          // Game Boy Color mode, from the cartridge header
+    bool double_speed; // CGB CPU at 8 MHz, ticks keep counting the 4 MHz clock
+    bool speed_armed;  // KEY1 bit 0, the next STOP switches speed
+    u32 stall;         // cycles the CPU loses to HBlank DMA before its next step
 } emu_context;
 
 #ifdef __cplusplus
@@ -21,9 +50,32 @@ extern "C"
 
     int emu_run(int argc, char **argv);
     void emu_cycles(u64 cycles);
+    void emu_cycles_double(u64 cycles);
+
+    u8 emu_speed_read(void);
+    void emu_speed_write(u8 value);
+    bool emu_speed_switch(void);
+
+    // ticks per CPU cycle, 2 in CGB double speed
+    u32 emu_ppu_ticks(void);
+
+    u64 emu_idle_cycles(void);
+    u64 emu_quiet_cycles(void);
+
+    void emu_skip(u64 cpu_cycles);
+    void emu_advance(u64 cpu_cycles);
+
+    void emu_defer_begin(void);
+    void emu_defer_end(void);
+    void emu_sync(void);
+
+    void emu_run_ahead(void);
 
     emu_context *emu_get_context(void);
 
+    void emu_state_save(state_stream *stream);
+    void emu_state_load(state_stream *stream);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <emu.h>
+#include <timer.h>
+#include <ppu.h>
+#include <dma.h>
+#include <serial.h>
+#include <prof.h>
+
+// What the machine does for one M-cycle at normal speed, shared by emu_cycles
+// and prof_cycles so profiled runs do the same work. `sampled` charges each
+// part to its own slot; it is a constant at every call site, the switches
+// compile away where it is false.
+static inline void emu_cycle(emu_context *emu, bool sampled)
+{
+    for (u8 n = 0; n < 4; n++)
+    {
+        emu->ticks++;
+
+        if (sampled)
+            prof_switch(PROF_TIMER);
+
+        timer_tick();
+
+        if (sampled)
+            prof_switch(PROF_PPU);
+
+        ppu_tick();
+    }
+
+    // serial transfers are bus events like DMA, they share its slot
+    if (sampled)
+        prof_switch(PROF_DMA);
+
+    dma_tick();
+    serial_tick();
+}
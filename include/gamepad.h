@@ -1,6 +1,7 @@
 #pragma once
 
 #include <common.h>
+#include <state.h>
 
 #define GAMEPAD (gamepad_get_state())
 
@@ -28,6 +29,15 @@ extern "C"
 
     gamepad_state *gamepad_get_state(void);
 
+    // the game only sees the buttons latched at the start of each frame.
+    void gamepad_latch(u32 frame);
+
+    u8 gamepad_buttons(const gamepad_state *state);
+    void gamepad_set_buttons(gamepad_state *state, u8 buttons);
+
+    void gamepad_state_save(state_stream *stream);
+    void gamepad_state_load(state_stream *stream);
+
 #if defined(__cplusplus)
 }
 #endif
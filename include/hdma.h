@@ -0,0 +1,24 @@
+#pragma once
+
+#include <common.h>
+#include <state.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    void hdma_init(void);
+
+    u8 hdma_read(u16 address);
+    void hdma_write(u16 address, u8 value);
+
+    // the PPU entered HBlank on a visible line
+    void hdma_hblank(void);
+
+    void hdma_state_save(state_stream *stream);
+    void hdma_state_load(state_stream *stream);
+
+#ifdef __cplusplus
+}
+#endif
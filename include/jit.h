@@ -0,0 +1,19 @@
+#pragma once
+
+#include <common.h>
+#include <cpu.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    bool jit_available(void);
+
+    bool jit_run(cpu_context *cpu, u16 *last_pc);
+    void jit_write(u16 address);
+    void jit_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <common.h>
+#include <state.h>
 
 typedef struct
 {
@@ -19,6 +20,14 @@ typedef struct
     u32 bg_colors[4];  // Background Color Palette
     u32 sp1_colors[4]; // Sprite 1 Color Palette
     u32 sp2_colors[4]; // Sprite 2 Color Palette
+
+    // CGB palettes, 8 of each, 4 colors of 15 bits
+    u8 bcps;                  // Background Color Palette Specification
+    u8 ocps;                  // Object Color Palette Specification
+    u8 bg_cram[64];           // Background Color RAM
+    u8 obj_cram[64];          // Object Color RAM
+    u32 cgb_bg_colors[8][4];  // bg_cram as 32 bit colors
+    u32 cgb_obj_colors[8][4]; // obj_cram as 32 bit colors
 } lcd_context;
 
 typedef enum
@@ -42,12 +51,11 @@ typedef enum
 #define LCDC_WIN_MAP_AREA   ((BIT(LCDC, 6) == 1) ? 0x9C00 : 0x9800)
 #define LCDC_LCD_ENABLE     ((BIT(LCDC, 7) == 1) ? true : false)
 
-#define LCDC_WIN_MAP_AREA_READ(tile_x, tile_y) (bus_read(LCDC_WIN_MAP_AREA + (tile_x) + ((tile_y) * 32)))
-#define LCDC_WIN_MAP_AREA_READ_AT(at_x, at_y) LCDC_WIN_MAP_AREA_READ((at_x) >> 3, (at_y) >> 3)
+#define LCDC_WIN_MAP_AREA_AT(at_x, at_y) (LCDC_WIN_MAP_AREA + ((at_x) >> 3) + (((at_y) >> 3) * 32))
 
 #define LCDS                (LCD->lcds)
 #define LCDS_MODE           ((lcd_mode)(LCDS & 0x3))
-#define LCDS_MODE_SET(mode) (LCDS = (LCDS & 0xFC) | mode)
+#define LCDS_MODE_SET(mode) lcd_set_mode(mode)
 #define LCDS_LYC            ((BIT(LCDS, 2) == 1) : true : false)
 #define LCDS_LYC_SET(b)     BIT_SET(LCDS, 2, b)
 #define LCDS_STAT_INT(src)  (LCDS & src)
@@ -69,9 +77,24 @@ extern "C"
     void lcd_init(void);
     lcd_context *lcd_get_context(void);
 
+    // the calling thread works on `lcd`, NULL goes back to the emulated one
+    void lcd_set_context(lcd_context *lcd);
+
     void lcd_write(u16 addr, u8 value);
     u8 lcd_read(u16 addr);
 
+    // register writes without side effects (DMA, render log)
+    void lcd_store(lcd_context *lcd, u16 address, u8 value);
+    void lcd_cram_store(lcd_context *lcd, u16 address, u8 value);
+
+    void lcd_set_mode(lcd_mode mode);
+
+    u8 lcd_cram_read(u16 address);
+    void lcd_cram_write(u16 address, u8 value);
+
+    void lcd_state_save(state_stream *stream);
+    void lcd_state_load(state_stream *stream);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <common.h>
+
+#define LINK_QUANTUM 512 // ticks, one bit at the normal serial clock
+
+// set while a second machine is plugged on the serial port
+extern bool link_active;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // plugs a peer in the state the machine is in now, running the same
+    // cartridge. `quantum` bounds how far apart the two machines drift.
+    void link_init(u32 quantum);
+    void link_stop(void);
+
+    // called after each CPU step, hands the CPU over when the quantum is used
+    void link_update(void);
+    u32 link_idle_ticks(void);
+
+    // the loaded machine clocks `value` out, returns what the other one sent
+    u8 link_transfer(u8 value);
+
+    // the peer is the machine currently loaded
+    bool link_peer(void);
+
+    // frames completed by the local machine
+    u32 link_frame(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <common.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    bool movie_start_record(const char *path);
+    bool movie_start_replay(const char *path);
+    void movie_stop(void);
+
+    // frames covered by the movie being replayed
+    u32 movie_length(void);
+
+    void movie_record(u32 frame, u8 buttons);
+    bool movie_replay(u32 frame, u8 *buttons);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <common.h>
+
+// DMG refresh rate: 4194304 / 70224 = 59.7275 Hz
+#define PACER_CLOCK 4194304
+#define PACER_TICKS_PER_FRAME (LINES_PER_FRAME * TICKS_PER_LINE)
+
+typedef struct
+{
+    u64 frames;
+    double mean_ns;   // average time between two released frames
+    double stddev_ns; // jitter of that interval
+    int64_t min_ns;
+    int64_t max_ns;
+    int64_t max_late_ns; // worst release time past its deadline
+    u64 missed;          // deadlines dropped after a stall
+} pacer_stats;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    void pacer_init(void);
+    void pacer_stop(void);
+
+    // called once per frame by the emulation thread
+    void pacer_frame(void);
+
+    pacer_stats pacer_get_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <common.h>
+#include <state.h>
 
 #define PPU (ppu_get_context())
 #define PPU_FOREACH_LINE_SPRITE(__line) \
@@ -8,6 +9,9 @@
 
 #define PFC (&((PPU)->pfc))
 
+// the PPU reads VRAM by bank, whatever the CPU has selected in VBK
+#define VRAM_AT(bank, address) ((PPU)->vram[bank][(address) - ADDR_VRAM_START])
+
 #define PIXEL_FIFO (&((PFC)->pixel_fifo))
 
 #define VIDEO_BUFFER ((PPU)->video_buffer)
@@ -23,16 +27,12 @@ typedef enum
     FS_PUSH,
 } fetch_state;
 
-typedef struct _fifo_entry
-{
-    struct _fifo_entry *next;
-    u32 value; // 32 bit color value.
-} fifo_entry;
+#define PIXEL_FIFO_SIZE 16 // the fetcher adds 8 pixels when 8 or less are left
 
 typedef struct
 {
-    fifo_entry *head;
-    fifo_entry *tail;
+    u32 pixels[PIXEL_FIFO_SIZE]; // 32 bit color values, ring buffer
+    u8 head;
     u32 size;
 } fifo;
 
@@ -44,11 +44,13 @@ typedef struct
     u8 pushed_x;
     u8 fetch_x;
     u8 bgw_fetch_data[3];
+    u8 bgw_attr;            // CGB tile attributes from the VRAM bank 1 map
     u8 fetch_entry_data[6]; // oam data..
     u8 map_y;
     u8 map_x;
     u8 tile_y;
     u8 fifo_x;
+    bool timing_only; // count pixels without producing them (see render.c)
 } pixel_fifo_context;
 
 typedef struct
@@ -74,7 +76,8 @@ typedef struct _oam_line_entry
 typedef struct
 {
     oam_entry oam_ram[40];
-    u8 vram[0x2000];
+    u8 vram[2][0x2000]; // bank 1 is CGB only
+    u8 vram_bank;
 
     pixel_fifo_context pfc;
 
@@ -99,14 +102,28 @@ extern "C"
     void ppu_init(void);
     void ppu_tick(void);
 
+    u32 ppu_idle_ticks(void);
+    u32 ppu_quiet_ticks(void);
+    void ppu_skip(u32 ticks);
+
     void ppu_oam_write(u16 address, u8 value);
     u8 ppu_oam_read(u16 address);
 
     void ppu_vram_write(u16 address, u8 value);
     u8 ppu_vram_read(u16 address);
 
+    u8 ppu_vram_bank_read(void);
+    void ppu_vram_bank_write(u8 value);
+    u8 *ppu_vram(void);
+
     ppu_context *ppu_get_context(void);
 
+    // the calling thread works on `ppu`, NULL goes back to the emulated one
+    void ppu_set_context(ppu_context *ppu);
+
+    void ppu_state_save(state_stream *stream);
+    void ppu_state_load(state_stream *stream);
+
 #ifdef __cplusplus
 }
 #endif
@@ -12,6 +12,8 @@ extern "C"
     void ppu_mode_vblank(void);
     void ppu_mode_hblank(void);
 
+    void ppu_load_line_sprites(void);
+
 #if defined(__cplusplus)
 }
 #endif
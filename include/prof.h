@@ -0,0 +1,63 @@
+#pragma once
+
+#include <common.h>
+
+typedef enum
+{
+    PROF_NONE, // not accounted (threads outside the emulation loop)
+    PROF_CPU,
+    PROF_PPU,
+    PROF_TIMER,
+    PROF_DMA,
+    PROF_APU,
+    PROF_PACER,
+    PROF_UI,
+    PROF_SYSTEM, // timer + PPU + DMA, split between them by prof_get_stats()
+    PROF_COUNT,
+} prof_slot;
+
+typedef struct
+{
+    u64 ns[PROF_COUNT];
+    u64 calls[PROF_COUNT]; // estimated for timer, PPU and DMA
+    u64 frames;
+    u64 wall_ns; // since prof_init
+} prof_stats;
+
+// checked inline so the counters cost a single branch while disabled.
+extern bool prof_active;
+
+#define PROF_SWITCH(slot) (prof_active ? prof_switch(slot) : PROF_NONE)
+
+#define PROF_RESTORE(slot)     \
+    do                         \
+    {                          \
+        if (prof_active)       \
+            prof_switch(slot); \
+    } while (0)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    void prof_init(void);
+
+    // charges the time since the last switch to the current slot of this
+    // thread and makes `slot` current, returns the previous slot.
+    prof_slot prof_switch(prof_slot slot);
+
+    // timer, PPU and DMA for a number of M-cycles (see emu_cycles).
+    void prof_cycles(u64 cpu_cycles);
+
+    void prof_frame(void);
+
+    prof_stats prof_get_stats(void);
+    const char *prof_slot_name(prof_slot slot);
+
+    void prof_print(void);
+    bool prof_dump_json(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,18 +1,27 @@
 #pragma once
 
 #include <common.h>
+#include <state.h>
 
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
+    void ram_init(void);
+
     u8 wram_read(u16 address);
     void wram_write(u16 address, u8 value);
 
+    u8 wram_bank_read(void);
+    void wram_bank_write(u8 value);
+
     u8 hram_read(u16 address);
     void hram_write(u16 address, u8 value);
 
+    void ram_state_save(state_stream *stream);
+    void ram_state_load(state_stream *stream);
+
 #ifdef __cplusplus
 }
 #endif
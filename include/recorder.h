@@ -0,0 +1,35 @@
+#pragma once
+
+#include <common.h>
+
+// set while frames are captured to a video stream
+extern bool recorder_active;
+
+typedef enum
+{
+    RECORDER_Y4M, // YUV 4:4:4, what ffmpeg and most players read as is
+    RECORDER_RAW, // packed RGB24, -f rawvideo -pix_fmt rgb24 -s 160x144
+} recorder_format;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // spec is "y4m:<path>" or "raw:<path>", the path can be a FIFO
+    bool recorder_init(const char *spec);
+    void recorder_stop(void);
+
+    // hands a completed frame over, `*buffer` gets a free one to draw the
+    // next frame in. Called by the thread that draws the pixels.
+    void recorder_frame(u32 **buffer);
+
+    // the last completed frame, the video buffer is an old one being drawn over
+    const u32 *recorder_shown(void);
+
+    // frames lost because the writer was behind
+    u32 recorder_dropped(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <common.h>
+
+// set while the render thread runs, the PPU then only keeps time
+extern bool render_active;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    void render_init(void);
+    void render_stop(void);
+
+    // called by the emulation thread
+    void render_write(u16 address, u8 value);
+    void render_scan(void);
+    void render_line(void);
+    void render_frame(void);
+
+    // frames fully drawn by the render thread
+    u32 render_get_frame(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <common.h>
+#include <state.h>
+
+#define SERIAL (serial_get_context())
+
+typedef struct
+{
+    u8 sb; // $FF01 - Serial transfer data
+    u8 sc; // $FF02 - Serial transfer control
+
+    bool active; // a byte is being shifted
+    u8 in;       // byte from the other side, known up front on the external clock
+    u64 end;     // tick of the last bit
+} serial_context;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    void serial_init(void);
+    void serial_tick(void);
+
+    u32 serial_idle_ticks(void);
+
+    // the other machine shifted `value` in, its last bit lands at `tick`
+    bool serial_clock_in(u8 value, u64 tick);
+
+    serial_context *serial_get_context(void);
+
+    u8 serial_read(u16 address);
+    void serial_write(u16 address, u8 value);
+
+    void serial_state_save(state_stream *stream);
+    void serial_state_load(state_stream *stream);
+
+#ifdef __cplusplus
+}
+#endif
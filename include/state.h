@@ -0,0 +1,38 @@
+#pragma once
+
+#include <common.h>
+
+// copies a variable or a whole context in or out of a stream
+#define STATE_PUT(stream, var) state_put(stream, &(var), sizeof(var))
+#define STATE_GET(stream, var) state_get(stream, &(var), sizeof(var))
+
+typedef struct
+{
+    u8 *data; // NULL only measures the snapshot size
+    u32 size;
+} state_stream;
+
+typedef struct state_snapshot state_snapshot;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // a snapshot is sized for the cartridge loaded when it is created
+    state_snapshot *state_create(void);
+    void state_destroy(state_snapshot *snapshot);
+
+    u32 state_size(const state_snapshot *snapshot);
+
+    void state_save(state_snapshot *snapshot);
+    void state_load(const state_snapshot *snapshot);
+
+    // the next `size` bytes of the stream, NULL while measuring
+    void *state_next(state_stream *stream, u32 size);
+    void state_put(state_stream *stream, const void *data, u32 size);
+    void state_get(state_stream *stream, void *data, u32 size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <common.h>
+#include <state.h>
 
 #define TIMER (timer_get_context())
 
@@ -20,11 +21,18 @@ extern "C"
     void timer_init(void);
     void timer_tick(void);
 
+    u32 timer_idle_ticks(void);
+    void timer_skip(u32 ticks);
+    void timer_run(u32 ticks);
+
     timer_context *timer_get_context(void);
 
     void timer_write(u16 address, u8 value);
     u8 timer_read(u16 address);
 
+    void timer_state_save(state_stream *stream);
+    void timer_state_load(state_stream *stream);
+
 #ifdef __cplusplus
 }
 #endif
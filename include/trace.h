@@ -0,0 +1,53 @@
+#pragma once
+
+#include <common.h>
+
+// timeline rows in the exported trace, besides one row per thread
+typedef enum
+{
+    TRACK_THREAD, // the row of the recording thread
+    TRACK_FRAME,
+    TRACK_PPU,
+    TRACK_DMA,
+    TRACK_COUNT,
+} trace_track;
+
+// checked inline so disabled tracing costs a single branch.
+extern bool trace_active;
+
+#define TRACE_NOW() (trace_active ? trace_now() : 0)
+
+#define TRACE_COMPLETE(track, name, start, arg)         \
+    do                                                  \
+    {                                                   \
+        if (trace_active)                               \
+            trace_complete(track, name, start, arg);    \
+    } while (0)
+
+#define TRACE_INSTANT(track, name, arg)                 \
+    do                                                  \
+    {                                                   \
+        if (trace_active)                               \
+            trace_instant(track, name, arg);            \
+    } while (0)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    void trace_init(void);
+    void trace_set_thread_name(const char *name);
+
+    u64 trace_now(void);
+
+    // `name` must be a string literal, only the pointer is recorded.
+    void trace_complete(trace_track track, const char *name, u64 start, u32 arg);
+    void trace_instant(trace_track track, const char *name, u32 arg);
+
+    // Chrome trace event JSON, opens in chrome://tracing and Perfetto.
+    bool trace_dump(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
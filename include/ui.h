@@ -11,6 +11,9 @@ extern "C"
     void ui_handle_events(void);
     void ui_update(void);
 
+    bool ui_audio_open(u32 rate);
+    void ui_audio_close(void);
+
 #ifdef __cplusplus
 }
 #endif
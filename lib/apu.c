@@ -0,0 +1,692 @@
+#include <apu.h>
+#include <emu.h>
+#include <prof.h>
+#include <trace.h>
+
+#include <math.h>
+#include <stddef.h>
+
+// The channels are not ticked with the rest of the system. They are run up to
+// the current tick whenever a sound register is accessed and at the end of
+// each frame, and only report the moments their output level changes. Each
+// change is added as a band-limited step to a delta buffer per side, which is
+// integrated into samples when the frame ends.
+
+#define APU_SEQUENCER_PERIOD 8192 // 512 Hz
+#define APU_VOLUME_SCALE 64       // 4 channels * 15 * 8 * 64 fits in 16 bits
+
+#define BLIP_PHASE_BITS 5
+#define BLIP_PHASES (1 << BLIP_PHASE_BITS)
+#define BLIP_TAPS 16
+#define BLIP_SIZE 4096
+#define BLIP_BASS_SHIFT 9
+
+// samples per tick in 32.32 fixed point
+#define BLIP_FACTOR (((u64)APU_SAMPLE_RATE << 32) / APU_CLOCK)
+
+// the resampling ratio may be nudged by this much (see apu_set_resample_ratio)
+#define APU_MAX_SKEW 0.01
+
+// longest span kept in the delta buffer before samples are handed out.
+#define APU_MAX_FRAME_TICKS ((u64)((BLIP_SIZE - 2 * BLIP_TAPS) * (1 - APU_MAX_SKEW) * APU_CLOCK / APU_SAMPLE_RATE))
+
+#define APU_REG(address) (ctx.regs[(address) - APU_START])
+
+typedef struct
+{
+    bool enabled;
+    bool dac;
+    u16 length;
+    bool length_enabled;
+
+    u8 volume;
+    u8 env_period;
+    u8 env_timer;
+    bool env_up;
+
+    u16 freq;
+    u64 next;    // tick of the next waveform step
+    u8 position; // duty step or wave RAM nibble
+    u8 level;    // waveform level before volume
+
+    // channel 1 frequency sweep
+    u16 shadow;
+    u8 sweep_timer;
+    bool sweep_enabled;
+
+    // channel 4 noise
+    u16 lfsr;
+
+    int32_t left; // last amplitudes sent to the mixer
+    int32_t right;
+} apu_channel;
+
+typedef struct
+{
+    bool power;
+    u8 regs[APU_END - APU_START + 1];
+    apu_channel ch[4];
+
+    u64 time; // ticks synthesized so far
+    u64 next_step;
+    u8 step;
+
+    u64 frame_start;
+    u64 frame_offset; // sample position of frame_start, 32.32 fixed point
+    u64 factor;       // samples per tick, 32.32 fixed point
+    int32_t deltas[2][BLIP_SIZE + BLIP_TAPS];
+    int64_t integrator[2];
+    int16_t samples[BLIP_SIZE * 2];
+
+    apu_sink sink;
+    void *user;
+} apu_context;
+
+static apu_context ctx;
+static int16_t blip_kernel[BLIP_PHASES][BLIP_TAPS];
+
+// clang-format off
+static const u8 duty_table[4][8] = {
+    {0, 0, 0, 0, 0, 0, 0, 1},
+    {1, 0, 0, 0, 0, 0, 0, 1},
+    {1, 0, 0, 0, 0, 1, 1, 1},
+    {0, 1, 1, 1, 1, 1, 1, 0},
+};
+
+// bits that always read back as 1, FF10-FF2F
+static const u8 read_masks[0x20] = {
+    0x80, 0x3F, 0x00, 0xFF, 0xBF,
+    0xFF, 0x3F, 0x00, 0xFF, 0xBF,
+    0x7F, 0xFF, 0x9F, 0xFF, 0xBF,
+    0xFF, 0xFF, 0x00, 0x00, 0xBF,
+    0x00, 0x00, 0x70,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+// clang-format on
+
+// Windowed sinc impulses, one per sub-sample phase, each summing to 1 << 15.
+static void blip_init(void)
+{
+    const double cutoff = 0.9;
+
+    for (u32 p = 0; p < BLIP_PHASES; p++)
+    {
+        double taps[BLIP_TAPS];
+        double sum = 0;
+
+        for (u32 i = 0; i < BLIP_TAPS; i++)
+        {
+            double x = (double)i - (BLIP_TAPS / 2 - 1) - (double)p / BLIP_PHASES;
+            double sinc = x == 0 ? 1 : sin(M_PI * x * cutoff) / (M_PI * x * cutoff);
+            double window = 0.42 + 0.5 * cos(2 * M_PI * x / BLIP_TAPS) + 0.08 * cos(4 * M_PI * x / BLIP_TAPS);
+
+            taps[i] = sinc * window;
+            sum += taps[i];
+        }
+
+        int32_t total = 0;
+        for (u32 i = 0; i < BLIP_TAPS; i++)
+        {
+            blip_kernel[p][i] = (int16_t)lround(taps[i] / sum * (1 << 15) * 0.999);
+            total += blip_kernel[p][i];
+        }
+
+        blip_kernel[p][BLIP_TAPS / 2 - 1] += (1 << 15) - total;
+    }
+}
+
+static void blip_add(u8 side, u64 time, int32_t delta)
+{
+    u64 position = ctx.frame_offset + (time - ctx.frame_start) * ctx.factor;
+    u32 index = position >> 32;
+    u32 phase = (position >> (32 - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1);
+
+    int32_t *out = &ctx.deltas[side][index];
+    const int16_t *kernel = blip_kernel[phase];
+
+    for (u32 i = 0; i < BLIP_TAPS; i++)
+        out[i] += delta * kernel[i];
+}
+
+static void apu_mix(u8 index, u64 time)
+{
+    apu_channel *ch = &ctx.ch[index];
+    int32_t output = 0;
+
+    if (ch->enabled && ch->dac)
+    {
+        if (index == 2)
+        {
+            u8 code = (APU_REG(NR32) >> 5) & 0x3;
+            output = code ? ch->level >> (code - 1) : 0;
+        }
+        else
+            output = ch->level * ch->volume;
+    }
+
+    u8 nr50 = APU_REG(NR50);
+    u8 nr51 = APU_REG(NR51);
+
+    int32_t left = BIT(nr51, (index + 4)) ? output * (((nr50 >> 4) & 0x7) + 1) * APU_VOLUME_SCALE : 0;
+    int32_t right = BIT(nr51, index) ? output * ((nr50 & 0x7) + 1) * APU_VOLUME_SCALE : 0;
+
+    if (left != ch->left)
+    {
+        blip_add(0, time, left - ch->left);
+        ch->left = left;
+    }
+
+    if (right != ch->right)
+    {
+        blip_add(1, time, right - ch->right);
+        ch->right = right;
+    }
+}
+
+static u32 apu_period(u8 index)
+{
+    apu_channel *ch = &ctx.ch[index];
+
+    if (index == 2)
+        return (2048 - ch->freq) * 2;
+
+    if (index == 3)
+    {
+        u8 nr43 = APU_REG(NR43);
+        u32 divisor = (nr43 & 0x7) ? (nr43 & 0x7) * 16 : 8;
+        return divisor << (nr43 >> 4);
+    }
+
+    return (2048 - ch->freq) * 4;
+}
+
+static bool apu_silent(u8 index)
+{
+    apu_channel *ch = &ctx.ch[index];
+
+    if (!ch->enabled || !ch->dac)
+        return true;
+
+    if (index == 2)
+        return (APU_REG(NR32) & 0x60) == 0;
+
+    return ch->volume == 0;
+}
+
+static void apu_step_waveform(u8 index)
+{
+    apu_channel *ch = &ctx.ch[index];
+
+    switch (index)
+    {
+    case 2:
+    {
+        ch->position = (ch->position + 1) & 31;
+        u8 sample = APU_REG(WAVE_RAM + ch->position / 2);
+        ch->level = ch->position & 1 ? sample & 0xF : sample >> 4;
+        break;
+    }
+
+    case 3:
+    {
+        u16 bit = (ch->lfsr ^ (ch->lfsr >> 1)) & 1;
+        ch->lfsr = (ch->lfsr >> 1) | (bit << 14);
+
+        if (APU_REG(NR43) & 0x08)
+            ch->lfsr = (ch->lfsr & ~(1 << 6)) | (bit << 6);
+
+        ch->level = ~ch->lfsr & 1;
+        break;
+    }
+
+    default:
+    {
+        u8 duty = (APU_REG(index == 0 ? NR11 : NR21) >> 6) & 0x3;
+        ch->position = (ch->position + 1) & 7;
+        ch->level = duty_table[duty][ch->position];
+        break;
+    }
+    }
+}
+
+static void apu_run_channel(u8 index, u64 until)
+{
+    apu_channel *ch = &ctx.ch[index];
+    u32 period = apu_period(index);
+
+    if (ch->next > until)
+        return;
+
+    // nothing to hear, move the timer in one go.
+    if (apu_silent(index))
+    {
+        u64 steps = (until - ch->next) / period + 1;
+        ch->next += steps * period;
+
+        if (index == 0 || index == 1)
+        {
+            u8 duty = (APU_REG(index == 0 ? NR11 : NR21) >> 6) & 0x3;
+            ch->position = (ch->position + steps) & 7;
+            ch->level = duty_table[duty][ch->position];
+        }
+
+        return;
+    }
+
+    while (ch->next <= until)
+    {
+        apu_step_waveform(index);
+        apu_mix(index, ch->next);
+        ch->next += period;
+    }
+}
+
+static u16 apu_sweep_calc(void)
+{
+    apu_channel *ch = &ctx.ch[0];
+    u8 nr10 = APU_REG(NR10);
+
+    u16 delta = ch->shadow >> (nr10 & 0x7);
+    u16 freq = (nr10 & 0x08) ? ch->shadow - delta : ch->shadow + delta;
+
+    if (freq > 2047)
+        ch->enabled = false;
+
+    return freq;
+}
+
+static void apu_sequencer(void)
+{
+    // length counters
+    if ((ctx.step & 1) == 0)
+    {
+        for (u8 i = 0; i < 4; i++)
+        {
+            apu_channel *ch = &ctx.ch[i];
+
+            if (ch->length_enabled && ch->length > 0 && --ch->length == 0)
+                ch->enabled = false;
+        }
+    }
+
+    // channel 1 sweep
+    if (ctx.step == 2 || ctx.step == 6)
+    {
+        apu_channel *ch = &ctx.ch[0];
+        u8 nr10 = APU_REG(NR10);
+        u8 period = (nr10 >> 4) & 0x7;
+
+        if (ch->sweep_timer > 0 && --ch->sweep_timer == 0)
+        {
+            ch->sweep_timer = period ? period : 8;
+
+            if (ch->sweep_enabled && period)
+            {
+                u16 freq = apu_sweep_calc();
+
+                if (freq <= 2047 && (nr10 & 0x7))
+                {
+                    ch->freq = ch->shadow = freq;
+                    APU_REG(NR13) = freq & 0xFF;
+                    APU_REG(NR14) = (APU_REG(NR14) & ~0x7) | (freq >> 8);
+                    apu_sweep_calc();
+                }
+            }
+        }
+    }
+
+    // volume envelopes
+    if (ctx.step == 7)
+    {
+        for (u8 i = 0; i < 4; i++)
+        {
+            apu_channel *ch = &ctx.ch[i];
+
+            if (i == 2 || ch->env_period == 0 || --ch->env_timer > 0)
+                continue;
+
+            ch->env_timer = ch->env_period;
+
+            if (ch->env_up && ch->volume < 15)
+                ch->volume++;
+            else if (!ch->env_up && ch->volume > 0)
+                ch->volume--;
+        }
+    }
+
+    ctx.step = (ctx.step + 1) & 7;
+}
+
+static void apu_run(u64 until)
+{
+    while (ctx.time < until)
+    {
+        u64 end = until < ctx.next_step ? until : ctx.next_step;
+
+        if (ctx.power)
+        {
+            for (u8 i = 0; i < 4; i++)
+                apu_run_channel(i, end);
+        }
+
+        ctx.time = end;
+
+        if (end == ctx.next_step)
+        {
+            if (ctx.power)
+            {
+                apu_sequencer();
+
+                for (u8 i = 0; i < 4; i++)
+                    apu_mix(i, end);
+            }
+
+            ctx.next_step += APU_SEQUENCER_PERIOD;
+        }
+    }
+}
+
+// Integrates the deltas up to ctx.time into samples for the sink.
+static void apu_flush(void)
+{
+    u64 end = ctx.frame_offset + (ctx.time - ctx.frame_start) * ctx.factor;
+    u32 count = end >> 32;
+
+    for (u8 side = 0; side < 2; side++)
+    {
+        int32_t *deltas = ctx.deltas[side];
+        int64_t sum = ctx.integrator[side];
+
+        for (u32 i = 0; i < count; i++)
+        {
+            sum += deltas[i];
+            int32_t sample = sum >> 15;
+
+            // remove the DC offset of the unipolar channel outputs.
+            sum -= (int64_t)sample * ((int64_t)1 << (15 - BLIP_BASS_SHIFT));
+
+            if (sample > INT16_MAX)
+                sample = INT16_MAX;
+            if (sample < INT16_MIN)
+                sample = INT16_MIN;
+
+            ctx.samples[i * 2 + side] = sample;
+        }
+
+        ctx.integrator[side] = sum;
+
+        memmove(deltas, deltas + count, BLIP_TAPS * sizeof(int32_t));
+        memset(deltas + BLIP_TAPS, 0, (BLIP_SIZE) * sizeof(int32_t));
+    }
+
+    ctx.frame_offset = end & 0xFFFFFFFF;
+    ctx.frame_start = ctx.time;
+
+    // run-ahead frames are heard once, when the machine really plays them,
+    // the linked peer is never heard
+    if (ctx.sink && count > 0 && !EMU->hidden)
+        ctx.sink(ctx.samples, count, ctx.user);
+}
+
+static void apu_sync(void)
+{
+    u64 now = EMU->ticks;
+
+    while (ctx.time < now)
+    {
+        u64 limit = ctx.frame_start + APU_MAX_FRAME_TICKS;
+
+        if (now <= limit)
+        {
+            apu_run(now);
+            return;
+        }
+
+        // no frame end for a while (LCD off), hand out what we have.
+        apu_run(limit);
+        apu_flush();
+    }
+}
+
+void apu_end_frame(void)
+{
+    prof_slot slot = PROF_SWITCH(PROF_APU);
+    u64 start = TRACE_NOW();
+
+    apu_sync();
+    apu_flush();
+
+    TRACE_COMPLETE(TRACK_THREAD, "apu", start, 0);
+    PROF_RESTORE(slot);
+}
+
+// Output slightly more (ratio > 1) or fewer samples per emulated second, so
+// the consumer's clock can be followed without pitch artifacts.
+void apu_set_resample_ratio(double ratio)
+{
+    if (ratio < 1 - APU_MAX_SKEW)
+        ratio = 1 - APU_MAX_SKEW;
+    if (ratio > 1 + APU_MAX_SKEW)
+        ratio = 1 + APU_MAX_SKEW;
+
+    apu_sync();
+    apu_flush();
+
+    ctx.factor = BLIP_FACTOR * ratio;
+}
+
+void apu_set_sink(apu_sink sink, void *user)
+{
+    ctx.sink = sink;
+    ctx.user = user;
+}
+
+static void apu_trigger(u8 index)
+{
+    apu_channel *ch = &ctx.ch[index];
+    u8 envelope = ctx.regs[index * 5 + 2];
+
+    ch->enabled = ch->dac;
+
+    if (ch->length == 0)
+        ch->length = index == 2 ? 256 : 64;
+
+    ch->next = ctx.time + apu_period(index);
+
+    if (index == 2)
+        ch->position = 0;
+    else
+    {
+        ch->volume = envelope >> 4;
+        ch->env_up = envelope & 0x08;
+        ch->env_period = envelope & 0x7;
+        ch->env_timer = ch->env_period;
+    }
+
+    if (index == 3)
+        ch->lfsr = 0x7FFF;
+
+    if (index == 0)
+    {
+        u8 nr10 = APU_REG(NR10);
+        u8 period = (nr10 >> 4) & 0x7;
+
+        ch->shadow = ch->freq;
+        ch->sweep_timer = period ? period : 8;
+        ch->sweep_enabled = period || (nr10 & 0x7);
+
+        if (nr10 & 0x7)
+            apu_sweep_calc();
+    }
+}
+
+static void apu_power(bool on)
+{
+    if (on == ctx.power)
+        return;
+
+    ctx.power = on;
+
+    if (on)
+    {
+        ctx.step = 0;
+        ctx.next_step = ctx.time + APU_SEQUENCER_PERIOD;
+        return;
+    }
+
+    memset(ctx.regs, 0, NR52 - APU_START);
+
+    for (u8 i = 0; i < 4; i++)
+    {
+        apu_channel *ch = &ctx.ch[i];
+        int32_t left = ch->left;
+        int32_t right = ch->right;
+
+        *ch = (apu_channel){.left = left, .right = right};
+        apu_mix(i, ctx.time);
+    }
+}
+
+u8 apu_read(u16 address)
+{
+    if (address >= WAVE_RAM)
+        return APU_REG(address);
+
+    if (address == NR52)
+    {
+        apu_sync();
+
+        u8 value = ctx.power << 7 | read_masks[NR52 - APU_START];
+        for (u8 i = 0; i < 4; i++)
+            value |= ctx.ch[i].enabled << i;
+
+        return value;
+    }
+
+    return APU_REG(address) | read_masks[address - APU_START];
+}
+
+void apu_write(u16 address, u8 value)
+{
+    apu_sync();
+
+    if (address >= WAVE_RAM)
+    {
+        APU_REG(address) = value;
+        return;
+    }
+
+    if (address == NR52)
+    {
+        apu_power(value & 0x80);
+        return;
+    }
+
+    if (!ctx.power)
+        return;
+
+    APU_REG(address) = value;
+
+    u8 index = (address - APU_START) / 5;
+    apu_channel *ch = &ctx.ch[index < 4 ? index : 0];
+
+    switch (address)
+    {
+    case NR11:
+    case NR21:
+    case NR41:
+        ch->length = 64 - (value & 0x3F);
+        break;
+
+    case NR31:
+        ch->length = 256 - value;
+        break;
+
+    case NR12:
+    case NR22:
+    case NR42:
+        ch->dac = (value & 0xF8) != 0;
+        ch->enabled &= ch->dac;
+        break;
+
+    case NR30:
+        ch->dac = value & 0x80;
+        ch->enabled &= ch->dac;
+        break;
+
+    case NR13:
+    case NR23:
+    case NR33:
+        ch->freq = (ch->freq & 0x700) | value;
+        break;
+
+    case NR14:
+    case NR24:
+    case NR34:
+    case NR44:
+        if (address != NR44)
+            ch->freq = (ch->freq & 0xFF) | ((value & 0x7) << 8);
+
+        ch->length_enabled = value & 0x40;
+
+        if (value & 0x80)
+            apu_trigger(index);
+        break;
+
+    default:
+        break;
+    }
+
+    for (u8 i = 0; i < 4; i++)
+        apu_mix(i, ctx.time);
+}
+
+void apu_init(void)
+{
+    static bool kernel_ready = false;
+
+    if (!kernel_ready)
+    {
+        blip_init();
+        kernel_ready = true;
+    }
+
+    apu_sink sink = ctx.sink;
+    void *user = ctx.user;
+
+    memset(&ctx, 0, sizeof(ctx));
+
+    ctx.sink = sink;
+    ctx.user = user;
+    ctx.next_step = APU_SEQUENCER_PERIOD;
+    ctx.factor = BLIP_FACTOR;
+
+    // state left by the boot ROM
+    ctx.power = true;
+    APU_REG(NR10) = 0x80;
+    APU_REG(NR11) = 0xBF;
+    APU_REG(NR12) = 0xF3;
+    APU_REG(NR14) = 0xBF;
+    APU_REG(NR50) = 0x77;
+    APU_REG(NR51) = 0xF3;
+
+    // the boot chime leaves channel 1 running with its envelope at zero
+    ctx.ch[0].dac = true;
+    ctx.ch[0].enabled = true;
+}
+
+// everything up to the output buffer, the sink and the resampling ratio
+// follow the host.
+void apu_state_save(state_stream *stream)
+{
+    state_put(stream, &ctx, offsetof(apu_context, samples));
+}
+
+void apu_state_load(state_stream *stream)
+{
+    u64 factor = ctx.factor;
+
+    state_get(stream, &ctx, offsetof(apu_context, samples));
+
+    ctx.factor = factor;
+}
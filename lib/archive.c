@@ -0,0 +1,368 @@
+#include <archive.h>
+
+#include <strings.h>
+#include <zlib.h>
+
+// ROMs are read straight into the buffer the cartridge keeps, whatever they
+// are packed in. Plain and gzip files both go through gzread, which passes a
+// plain file through as is. A zip is walked header by header up to the first
+// ROM, which is inflated from the file a chunk at a time: nothing is extracted
+// to disk and the archive itself is never held in memory.
+//
+// The buffer starts at the size the file announces and only grows once there
+// is more to put in it, a ROM that fills it exactly is never moved.
+
+#define ARCHIVE_CHUNK (64 * 1024)
+
+#define ZIP_LOCAL_HEADER 0x04034B50
+#define ZIP_HEADER_SIZE 30
+#define ZIP_ENCRYPTED 0x01
+#define ZIP_DESCRIPTOR 0x08 // sizes and crc follow the data instead
+#define ZIP_STORED 0
+#define ZIP_DEFLATED 8
+#define ZIP64_EXTRA 0x0001
+
+typedef struct
+{
+    u8 *data;
+    u32 size;
+    u32 capacity;
+} archive_buffer;
+
+u32 archive_capacity(u32 size)
+{
+    u32 capacity = 0x8000;
+    while (capacity < size)
+        capacity <<= 1;
+
+    return capacity;
+}
+
+static u16 le16(const u8 *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static u32 le32(const u8 *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (u32)p[3] << 24;
+}
+
+static void archive_reserve(archive_buffer *buffer, u32 size)
+{
+    buffer->capacity = archive_capacity(size < ARCHIVE_MAX_SIZE ? size : ARCHIVE_MAX_SIZE);
+    buffer->data = malloc(buffer->capacity);
+    assert(buffer->data != NULL);
+}
+
+// a byte past the end of a full buffer
+static bool archive_push(archive_buffer *buffer, u8 value)
+{
+    if (buffer->capacity >= ARCHIVE_MAX_SIZE)
+    {
+        fprintf(stderr, "ROM TOO LARGE: over %d MB\n", ARCHIVE_MAX_SIZE >> 20);
+        return false;
+    }
+
+    buffer->capacity <<= 1;
+    buffer->data = realloc(buffer->data, buffer->capacity);
+    assert(buffer->data != NULL);
+
+    buffer->data[buffer->size++] = value;
+    return true;
+}
+
+static bool archive_gzip(const char *path, u32 size, archive_buffer *buffer)
+{
+    gzFile file = gzopen(path, "rb");
+
+    if (!file)
+        return false;
+
+    gzbuffer(file, ARCHIVE_CHUNK);
+    archive_reserve(buffer, size);
+
+    bool ok = true;
+
+    while (ok)
+    {
+        u8 next;
+        bool full = buffer->size == buffer->capacity;
+        int read = full ? gzread(file, &next, 1) : gzread(file, buffer->data + buffer->size, buffer->capacity - buffer->size);
+
+        if (read <= 0)
+        {
+            // a truncated stream ends without an error from gzread
+            int err;
+            const char *message = gzerror(file, &err);
+
+            if (read < 0 || err != Z_OK)
+                fprintf(stderr, "FAILED TO INFLATE: %s (%s)\n", path, message);
+
+            ok = read == 0 && err == Z_OK;
+            break;
+        }
+
+        if (full)
+            ok = archive_push(buffer, next);
+        else
+            buffer->size += read;
+    }
+
+    gzclose(file);
+    return ok;
+}
+
+static bool zip_stored(FILE *fp, u32 size, archive_buffer *buffer)
+{
+    if (size > ARCHIVE_MAX_SIZE)
+    {
+        fprintf(stderr, "ROM TOO LARGE: over %d MB\n", ARCHIVE_MAX_SIZE >> 20);
+        return false;
+    }
+
+    archive_reserve(buffer, size);
+    buffer->size = fread(buffer->data, 1, size, fp);
+
+    return buffer->size == size;
+}
+
+static bool zip_inflate(FILE *fp, u32 size, archive_buffer *buffer)
+{
+    z_stream stream = {0};
+    u8 *in = malloc(ARCHIVE_CHUNK);
+    assert(in != NULL);
+
+    // raw deflate, the zip headers stand in for the zlib ones
+    int ret = inflateInit2(&stream, -MAX_WBITS);
+    assert(ret == Z_OK);
+
+    archive_reserve(buffer, size);
+
+    do
+    {
+        if (stream.avail_in == 0)
+        {
+            stream.next_in = in;
+            stream.avail_in = fread(in, 1, ARCHIVE_CHUNK, fp);
+
+            if (stream.avail_in == 0)
+            {
+                ret = Z_DATA_ERROR; // truncated
+                break;
+            }
+        }
+
+        u8 next;
+        bool full = buffer->size == buffer->capacity;
+        stream.next_out = full ? &next : buffer->data + buffer->size;
+        stream.avail_out = full ? 1 : buffer->capacity - buffer->size;
+        u32 room = stream.avail_out;
+
+        ret = inflate(&stream, Z_NO_FLUSH);
+
+        if (ret != Z_OK && ret != Z_STREAM_END)
+            break;
+
+        u32 produced = room - stream.avail_out;
+
+        if (!full)
+            buffer->size += produced;
+        else if (produced && !archive_push(buffer, next))
+            ret = Z_MEM_ERROR;
+    } while (ret == Z_OK);
+
+    inflateEnd(&stream);
+    free(in);
+
+    return ret == Z_STREAM_END;
+}
+
+static bool zip_is_rom(const char *name)
+{
+    const char *ext = strrchr(name, '.');
+
+    return ext && (!strcasecmp(ext, ".gb") || !strcasecmp(ext, ".gbc") || !strcasecmp(ext, ".cgb"));
+}
+
+typedef struct
+{
+    char name[256];
+    u16 flags;
+    u16 method;
+    u32 crc;
+    u32 packed;
+    u32 size;
+} zip_entry;
+
+// zip64 sizes past 4 GB are as good as unknown here
+static u32 le64(const u8 *p)
+{
+    return le32(p + 4) ? 0xFFFFFFFF : le32(p);
+}
+
+// the local header at the file position, its data follows
+static bool zip_header(FILE *fp, zip_entry *entry)
+{
+    u8 header[ZIP_HEADER_SIZE];
+    u8 extra[256];
+
+    if (fread(header, sizeof(header), 1, fp) != 1 || le32(header) != ZIP_LOCAL_HEADER)
+        return false;
+
+    entry->flags = le16(header + 6);
+    entry->method = le16(header + 8);
+    entry->crc = le32(header + 14);
+    entry->packed = le32(header + 18);
+    entry->size = le32(header + 22);
+
+    u16 name_length = le16(header + 26);
+    u16 extra_length = le16(header + 28);
+    u16 name_kept = name_length < sizeof(entry->name) ? name_length : sizeof(entry->name) - 1;
+    u16 extra_kept = extra_length < sizeof(extra) ? extra_length : sizeof(extra);
+
+    if (fread(entry->name, 1, name_kept, fp) != name_kept)
+        return false;
+
+    entry->name[name_kept] = '\0';
+    fseek(fp, name_length - name_kept, SEEK_CUR);
+
+    if (fread(extra, 1, extra_kept, fp) != extra_kept)
+        return false;
+
+    fseek(fp, extra_length - extra_kept, SEEK_CUR);
+
+    // streaming zippers leave the sizes to a zip64 field
+    for (u32 i = 0; i + 4 <= extra_kept; i += 4 + le16(extra + i + 2))
+    {
+        if (le16(extra + i) != ZIP64_EXTRA)
+            continue;
+
+        u32 field = i + 4;
+        u32 end = field + le16(extra + i + 2) < extra_kept ? field + le16(extra + i + 2) : extra_kept;
+
+        if (entry->size == 0xFFFFFFFF && field + 8 <= end)
+        {
+            entry->size = le64(extra + field);
+            field += 8;
+        }
+
+        if (entry->packed == 0xFFFFFFFF && field + 8 <= end)
+            entry->packed = le64(extra + field);
+    }
+
+    return true;
+}
+
+// the first ROM in the archive, or the first entry that can't be skipped. A
+// lone entry is taken whatever its name, zip reading a pipe calls it "-".
+static bool archive_zip(FILE *fp, const char *path, archive_buffer *buffer)
+{
+    zip_entry entry;
+    u32 count = 0;
+    bool found = false;
+
+    while (zip_header(fp, &entry))
+    {
+        count++;
+
+        if (entry.flags & ZIP_DESCRIPTOR || zip_is_rom(entry.name))
+        {
+            found = true;
+            break;
+        }
+
+        fseek(fp, entry.packed, SEEK_CUR);
+    }
+
+    if (!found && count == 1)
+    {
+        fseek(fp, 0, SEEK_SET);
+        found = zip_header(fp, &entry);
+    }
+
+    if (!found)
+    {
+        fprintf(stderr, "NO ROM IN: %s\n", path);
+        return false;
+    }
+
+    bool sized = !(entry.flags & ZIP_DESCRIPTOR);
+
+    if (entry.flags & ZIP_ENCRYPTED || (entry.method != ZIP_DEFLATED && (entry.method != ZIP_STORED || !sized)))
+    {
+        fprintf(stderr, "UNSUPPORTED ZIP ENTRY: %s in %s\n", entry.name, path);
+        return false;
+    }
+
+    printf("Unpacking: %s\n", entry.name);
+
+    bool ok = entry.method == ZIP_STORED ? zip_stored(fp, entry.packed, buffer) : zip_inflate(fp, sized ? entry.size : 0, buffer);
+
+    if (!ok)
+    {
+        fprintf(stderr, "FAILED TO INFLATE: %s in %s\n", entry.name, path);
+        return false;
+    }
+
+    // the descriptor's crc is somewhere in the chunk read last, not worth
+    // finding: the checksum in the header still catches a bad dump
+    if (sized && crc32(0, buffer->data, buffer->size) != entry.crc)
+    {
+        fprintf(stderr, "BAD CRC: %s in %s\n", entry.name, path);
+        return false;
+    }
+
+    return true;
+}
+
+u8 *archive_read(const char *path, u32 *size)
+{
+    FILE *fp = fopen(path, "rb");
+
+    if (!fp)
+        return NULL;
+
+    u8 magic[4] = {0};
+    size_t found = fread(magic, 1, sizeof(magic), fp);
+
+    fseek(fp, 0, SEEK_END);
+    long length = ftell(fp);
+
+    archive_buffer buffer = {0};
+    bool ok;
+
+    if (found == sizeof(magic) && le32(magic) == ZIP_LOCAL_HEADER)
+    {
+        fseek(fp, 0, SEEK_SET);
+        ok = archive_zip(fp, path, &buffer);
+        fclose(fp);
+    }
+    else
+    {
+        u32 hint = length < 0 ? 0 : length < ARCHIVE_MAX_SIZE ? length : ARCHIVE_MAX_SIZE;
+
+        // gzip ends on the unpacked size, modulo 4 GB
+        u8 isize[4];
+        if (magic[0] == 0x1F && magic[1] == 0x8B && length >= 18 && fseek(fp, -4, SEEK_END) == 0 && fread(isize, sizeof(isize), 1, fp) == 1)
+            hint = le32(isize);
+
+        fclose(fp);
+        ok = archive_gzip(path, hint, &buffer);
+    }
+
+    if (!ok)
+    {
+        free(buffer.data);
+        return NULL;
+    }
+
+    // a size announced larger than what came out
+    u32 capacity = archive_capacity(buffer.size);
+
+    if (capacity < buffer.capacity)
+        buffer.data = realloc(buffer.data, capacity);
+
+    *size = buffer.size;
+    return buffer.data;
+}
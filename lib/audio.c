@@ -0,0 +1,270 @@
+#include <audio.h>
+#include <apu.h>
+#include <ui.h>
+
+#include <stdatomic.h>
+
+// The APU hands out a frame worth of samples at each VBlank. The SDL sink
+// queues them in a lock-free ring drained by the audio callback, so the
+// emulation thread never waits on the device: when the ring is full the
+// newest samples are dropped. The WAV sink writes every sample so captures
+// are reproducible.
+
+#define AUDIO_RING_FRAMES 8192 // ~170 ms at 48 kHz
+#define AUDIO_WAV_BUFFER (64 * 1024)
+
+struct audio_ring
+{
+    u32 mask;
+    _Atomic u32 head; // written by the producer
+    _Atomic u32 tail; // written by the consumer
+    int16_t data[];
+};
+
+typedef struct
+{
+    audio_sink_type type;
+    audio_ring *ring;
+    int16_t last[2];
+
+    FILE *wav;
+    u32 wav_frames;
+
+    u32 dropped;
+    u32 underruns;
+} audio_context;
+
+static audio_context ctx;
+
+audio_ring *audio_ring_create(u32 frames)
+{
+    u32 size = 1;
+    while (size < frames)
+        size <<= 1;
+
+    audio_ring *ring = malloc(sizeof(audio_ring) + size * 2 * sizeof(int16_t));
+    assert(ring != NULL);
+
+    ring->mask = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+
+    return ring;
+}
+
+void audio_ring_destroy(audio_ring *ring)
+{
+    free(ring);
+}
+
+u32 audio_ring_fill(const audio_ring *ring)
+{
+    u32 head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    u32 tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    return head - tail;
+}
+
+u32 audio_ring_write(audio_ring *ring, const int16_t *samples, u32 frames)
+{
+    u32 head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    u32 tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    u32 space = ring->mask + 1 - (head - tail);
+
+    if (frames > space)
+        frames = space;
+
+    for (u32 i = 0; i < frames; i++)
+    {
+        u32 index = (head + i) & ring->mask;
+        ring->data[index * 2] = samples[i * 2];
+        ring->data[index * 2 + 1] = samples[i * 2 + 1];
+    }
+
+    atomic_store_explicit(&ring->head, head + frames, memory_order_release);
+
+    return frames;
+}
+
+u32 audio_ring_read(audio_ring *ring, int16_t *samples, u32 frames)
+{
+    u32 tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    u32 head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (frames > head - tail)
+        frames = head - tail;
+
+    for (u32 i = 0; i < frames; i++)
+    {
+        u32 index = (tail + i) & ring->mask;
+        samples[i * 2] = ring->data[index * 2];
+        samples[i * 2 + 1] = ring->data[index * 2 + 1];
+    }
+
+    atomic_store_explicit(&ring->tail, tail + frames, memory_order_release);
+
+    return frames;
+}
+
+void audio_pull(int16_t *samples, u32 frames)
+{
+    u32 read = audio_ring_read(ctx.ring, samples, frames);
+
+    if (read > 0)
+    {
+        ctx.last[0] = samples[read * 2 - 2];
+        ctx.last[1] = samples[read * 2 - 1];
+    }
+
+    if (read < frames)
+        ctx.underruns++;
+
+    for (u32 i = read; i < frames; i++)
+    {
+        samples[i * 2] = ctx.last[0];
+        samples[i * 2 + 1] = ctx.last[1];
+    }
+}
+
+static void audio_put16(u8 *out, u16 value)
+{
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+}
+
+static void audio_put32(u8 *out, u32 value)
+{
+    audio_put16(out, value & 0xFFFF);
+    audio_put16(out + 2, value >> 16);
+}
+
+// 16-bit stereo PCM header, sizes are patched when the file is closed.
+static void audio_wav_header(u32 frames)
+{
+    u8 header[44];
+    u32 data_size = frames * 4;
+
+    memcpy(header, "RIFF", 4);
+    audio_put32(header + 4, 36 + data_size);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    audio_put32(header + 16, 16);
+    audio_put16(header + 20, 1);
+    audio_put16(header + 22, 2);
+    audio_put32(header + 24, APU_SAMPLE_RATE);
+    audio_put32(header + 28, APU_SAMPLE_RATE * 4);
+    audio_put16(header + 32, 4);
+    audio_put16(header + 34, 16);
+    memcpy(header + 36, "data", 4);
+    audio_put32(header + 40, data_size);
+
+    fseek(ctx.wav, 0, SEEK_SET);
+    fwrite(header, sizeof(header), 1, ctx.wav);
+}
+
+static void audio_submit(const int16_t *samples, u32 frames, void *user)
+{
+    ((void)user);
+
+    switch (ctx.type)
+    {
+    case AUDIO_SDL:
+        ctx.dropped += frames - audio_ring_write(ctx.ring, samples, frames);
+        break;
+
+    case AUDIO_WAV:
+        for (u32 i = 0; i < frames * 2;)
+        {
+            u8 bytes[1024];
+            u32 count = 0;
+
+            for (; i < frames * 2 && count < sizeof(bytes); i++, count += 2)
+                audio_put16(bytes + count, samples[i]);
+
+            fwrite(bytes, count, 1, ctx.wav);
+        }
+
+        ctx.wav_frames += frames;
+        break;
+
+    default:
+        break;
+    }
+}
+
+bool audio_init(const char *spec)
+{
+    audio_close();
+
+    if (strcmp(spec, "null") == 0)
+        ctx.type = AUDIO_NULL;
+    else if (strcmp(spec, "sdl") == 0)
+    {
+        ctx.type = AUDIO_SDL;
+        ctx.ring = audio_ring_create(AUDIO_RING_FRAMES);
+
+        if (!ui_audio_open(APU_SAMPLE_RATE))
+        {
+            fprintf(stderr, "FAILED TO OPEN AUDIO DEVICE, audio disabled\n");
+            audio_ring_destroy(ctx.ring);
+            ctx.ring = NULL;
+            ctx.type = AUDIO_NULL;
+        }
+    }
+    else if (strncmp(spec, "wav:", 4) == 0)
+    {
+        ctx.wav = fopen(spec + 4, "wb");
+
+        if (!ctx.wav)
+        {
+            fprintf(stderr, "FAILED TO OPEN: %s\n", spec + 4);
+            return false;
+        }
+
+        setvbuf(ctx.wav, NULL, _IOFBF, AUDIO_WAV_BUFFER);
+        ctx.type = AUDIO_WAV;
+        ctx.wav_frames = 0;
+        audio_wav_header(0);
+    }
+    else
+        return false;
+
+    apu_set_sink(ctx.type == AUDIO_NULL ? NULL : audio_submit, NULL);
+
+    return true;
+}
+
+void audio_close(void)
+{
+    apu_set_sink(NULL, NULL);
+
+    if (ctx.type == AUDIO_SDL)
+    {
+        ui_audio_close();
+        audio_ring_destroy(ctx.ring);
+        ctx.ring = NULL;
+
+        if (ctx.dropped || ctx.underruns)
+            printf("AUDIO: %u frames dropped, %u underruns\n", ctx.dropped, ctx.underruns);
+    }
+
+    if (ctx.type == AUDIO_WAV)
+    {
+        audio_wav_header(ctx.wav_frames);
+        fclose(ctx.wav);
+        ctx.wav = NULL;
+    }
+
+    ctx.type = AUDIO_NULL;
+    ctx.dropped = 0;
+    ctx.underruns = 0;
+}
+
+audio_sink_type audio_sink_get(void)
+{
+    return ctx.type;
+}
+
+u32 audio_buffered(void)
+{
+    return ctx.type == AUDIO_SDL ? audio_ring_fill(ctx.ring) : 0;
+}
@@ -0,0 +1,165 @@
+#include <battery.h>
+
+#include <trace.h>
+
+#include <pthread.h>
+
+// The emulation thread never touches the disk: it copies the dirty banks into
+// `image` and wakes the writer thread, which saves a private copy of the whole
+// image through a temporary file renamed over the previous save.
+
+typedef struct
+{
+    char path[1048];
+    char tmp_path[1056];
+    u8 bank_count;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool running;
+    bool pending;
+
+    u8 *image;  // latest snapshot of all banks (guarded by lock)
+    u8 *buffer; // copy of image owned by the writer thread
+} battery_context;
+
+static battery_context ctx = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static u32 battery_size(void)
+{
+    return ctx.bank_count * BATTERY_BANK_SIZE;
+}
+
+static void battery_copy_banks(u8 *const *banks, u16 dirty)
+{
+    for (u8 i = 0; i < ctx.bank_count; i++)
+        if (dirty & (1 << i))
+            memcpy(ctx.image + (i * BATTERY_BANK_SIZE), banks[i], BATTERY_BANK_SIZE);
+}
+
+static void battery_write(const u8 *data, u32 size)
+{
+    FILE *fp = fopen(ctx.tmp_path, "wb");
+
+    if (!fp)
+    {
+        fprintf(stderr, "FAILED TO OPEN: %s\n", ctx.tmp_path);
+        return;
+    }
+
+    bool written = fwrite(data, size, 1, fp) == 1;
+    written &= fflush(fp) == 0;
+    written &= fsync(fileno(fp)) == 0;
+    written &= fclose(fp) == 0;
+
+    // keep the previous save when anything went wrong, the rename is atomic.
+    if (!written || rename(ctx.tmp_path, ctx.path) != 0)
+    {
+        fprintf(stderr, "FAILED TO SAVE: %s\n", ctx.path);
+        remove(ctx.tmp_path);
+    }
+}
+
+static void *battery_run(void *data)
+{
+    ((void)data);
+
+    trace_set_thread_name("battery");
+
+    pthread_mutex_lock(&ctx.lock);
+
+    while (ctx.running || ctx.pending)
+    {
+        if (!ctx.pending)
+        {
+            pthread_cond_wait(&ctx.cond, &ctx.lock);
+            continue;
+        }
+
+        memcpy(ctx.buffer, ctx.image, battery_size());
+        ctx.pending = false;
+
+        pthread_mutex_unlock(&ctx.lock);
+
+        u64 start = TRACE_NOW();
+        battery_write(ctx.buffer, battery_size());
+        TRACE_COMPLETE(TRACK_THREAD, "battery save", start, battery_size());
+
+        pthread_mutex_lock(&ctx.lock);
+    }
+
+    pthread_mutex_unlock(&ctx.lock);
+    return NULL;
+}
+
+void battery_start(const char *path, u8 *const *banks, u8 bank_count)
+{
+    if (ctx.running || bank_count == 0)
+        return;
+
+    snprintf(ctx.path, sizeof(ctx.path), "%s", path);
+    snprintf(ctx.tmp_path, sizeof(ctx.tmp_path), "%s.tmp", path);
+
+    ctx.bank_count = bank_count;
+    ctx.image = calloc(battery_size(), sizeof(u8));
+    ctx.buffer = calloc(battery_size(), sizeof(u8));
+    assert(ctx.image != NULL && ctx.buffer != NULL);
+
+    battery_copy_banks(banks, 0xFFFF);
+
+    ctx.running = true;
+    ctx.pending = false;
+
+    if (pthread_create(&ctx.thread, NULL, battery_run, NULL))
+    {
+        fprintf(stderr, "Failed to create battery thread\n");
+        ctx.running = false;
+    }
+}
+
+bool battery_submit(u8 *const *banks, u16 dirty)
+{
+    if (!ctx.running)
+        return false;
+
+    // the writer may be busy copying the image, try again on the next save.
+    if (pthread_mutex_trylock(&ctx.lock) != 0)
+        return false;
+
+    battery_copy_banks(banks, dirty);
+    ctx.pending = true;
+    TRACE_INSTANT(TRACK_THREAD, "battery submit", dirty);
+
+    pthread_cond_signal(&ctx.cond);
+    pthread_mutex_unlock(&ctx.lock);
+
+    return true;
+}
+
+void battery_stop(u8 *const *banks, u16 dirty)
+{
+    if (!ctx.running)
+        return;
+
+    pthread_mutex_lock(&ctx.lock);
+
+    if (dirty)
+    {
+        battery_copy_banks(banks, dirty);
+        ctx.pending = true;
+    }
+
+    ctx.running = false;
+    pthread_cond_signal(&ctx.cond);
+    pthread_mutex_unlock(&ctx.lock);
+
+    pthread_join(ctx.thread, NULL);
+
+    free(ctx.image);
+    free(ctx.buffer);
+    ctx.image = ctx.buffer = NULL;
+}
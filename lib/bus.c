@@ -5,6 +5,7 @@
 #include <io.h>
 #include <ppu.h>
 #include <dma.h>
+#include <emu.h>
 
 // 0x0000 - 0x3FFF  :   16 KiB ROM bank 00                  :   From cartridge, usually a fixed bank
 // 0x4000 - 0x7FFF  :   16 KiB ROM Bank 01~NN               :   From cartridge, switchable bank via mapper (if any)
@@ -36,124 +37,291 @@
 // $FF80 - $FFFE    Zero Page - 127 bytes
 // $FFFF            Interrupt Enable Flag
 
-u8 bus_read(u16 address)
+// Accesses are dispatched on the high byte of the address. A page either
+// points straight at host memory for reads (ROM, VRAM, WRAM) or goes through
+// the handler of its region. Pages holding a watchpoint are switched to
+// bus_read_watched/bus_write_watched, the other pages never check them.
+
+#define BUS_PAGES 0x100
+#define BUS_MAX_WATCHPOINTS 32
+
+typedef u8 (*BUS_READ)(u16 address);
+typedef void (*BUS_WRITE)(u16 address, u8 value);
+
+typedef struct
+{
+    bool active;
+    u16 start;
+    u16 end;
+    u8 flags;
+    bus_watch_fn callback;
+    void *user;
+} bus_watchpoint;
+
+typedef struct
 {
-    assert(address >= 0x0000);
-    if (BETWEEN(address, 0x0000, 0x7FFF))
-        return cart_read(address);
+    // what the CPU uses
+    const u8 *read_map[BUS_PAGES];
+    BUS_READ readers[BUS_PAGES];
+    BUS_WRITE writers[BUS_PAGES];
 
-    assert(address >= ADDR_VRAM_START);
-    if (BETWEEN(address, ADDR_VRAM_START, ADDR_VRAM_END))
-        return ppu_vram_read(address);
+    // what the pages hold without watchpoints
+    const u8 *base_map[BUS_PAGES];
+    BUS_READ base_readers[BUS_PAGES];
+    BUS_WRITE base_writers[BUS_PAGES];
 
-    assert(address >= 0xA000);
-    if (BETWEEN(address, 0xA000, 0xBFFF))
-        return cart_read(address);
+    u8 read_watches[BUS_PAGES];
+    u8 write_watches[BUS_PAGES];
+    bus_watchpoint watchpoints[BUS_MAX_WATCHPOINTS];
+} bus_context;
 
-    assert(address >= 0xC000);
-    if (BETWEEN(address, 0xC000, 0xDFFF))
-        return wram_read(address);
+static bus_context ctx;
 
-    assert(address >= 0xE000);
-    if (BETWEEN(address, 0xE000, 0xFDFF))
-        return 0;
+typedef struct
+{
+    u8 *memory;
+    bus_access *log;
+    u32 capacity;
+    u32 count;
 
-    assert(address >= ADDR_OAM_START);
-    if (BETWEEN(address, ADDR_OAM_START, ADDR_OAM_END) && dma_transfering())
-        return 0xFF;
+    // what bus_flat_end() puts back
+    bus_context machine;
+    bool idle_skip;
+    bool jit;
+} bus_flat_context;
+
+static bus_flat_context flat;
 
-    assert(address >= ADDR_OAM_START);
-    if (BETWEEN(address, ADDR_OAM_START, ADDR_OAM_END))
-        return ppu_oam_read(address);
+bool bus_flat_active = false;
 
-    assert(address >= 0xFEA0);
-    if (BETWEEN(address, 0xFEA0, 0xFEFF))
-        // NO_IMPL(0);
+static u8 echo_read(u16 address)
+{
+    ((void)address);
+
+    return 0;
+}
+
+static void echo_write(u16 address, u8 value)
+{
+    ((void)address);
+    ((void)value);
+}
+
+static void vram_write(u16 address, u8 value)
+{
+    emu_sync();
+    ppu_vram_write(address, value);
+}
+
+static u8 oam_page_read(u16 address)
+{
+    if (address > ADDR_OAM_END)
         return 0;
 
-    assert(address >= 0xFF00);
-    if (BETWEEN(address, 0xFF00, 0xFF7F))
-        return io_read(address);
+    emu_sync();
 
-    assert(address >= 0xFF80);
-    if (BETWEEN(address, 0xFF80, 0xFFFE))
-        return hram_read(address);
+    if (dma_transfering())
+        return 0xFF;
 
-    assert(address == 0xFFFF);
-    return cpu_get_ie_register();
+    return ppu_oam_read(address);
 }
 
-void bus_write(u16 address, u8 value)
+static void oam_page_write(u16 address, u8 value)
 {
-    assert(address >= 0x0000);
-    if (BETWEEN(address, 0x0000, 0x7FFF))
-    {
-        cart_write(address, value);
+    if (address > ADDR_OAM_END)
         return;
-    }
 
-    assert(address >= ADDR_VRAM_START);
-    if (BETWEEN(address, ADDR_VRAM_START, ADDR_VRAM_END))
-    {
-        ppu_vram_write(address, value);
+    emu_sync();
+
+    if (dma_transfering())
         return;
-    }
 
-    assert(address >= 0xA000);
-    if (BETWEEN(address, 0xA000, 0xBFFF))
+    ppu_oam_write(address, value);
+}
+
+static u8 high_page_read(u16 address)
+{
+    if (address < 0xFF80)
     {
-        cart_write(address, value);
-        return;
+        emu_sync();
+        return io_read(address);
     }
 
-    assert(address >= 0xC000);
-    if (BETWEEN(address, 0xC000, 0xDFFF))
+    if (address < 0xFFFF)
+        return hram_read(address);
+
+    return cpu_get_ie_register();
+}
+
+static void high_page_write(u16 address, u8 value)
+{
+    if (address < 0xFF80)
     {
-        wram_write(address, value);
-        return;
+        emu_sync();
+        io_write(address, value);
     }
+    else if (address < 0xFFFF)
+        hram_write(address, value);
+    else
+        cpu_set_ie_register(value);
+}
+
+static u8 bus_read_watched(u16 address);
+static void bus_write_watched(u16 address, u8 value);
 
-    assert(address >= 0xE000);
-    if (BETWEEN(address, 0xE000, 0xFDFF))
+static void bus_refresh(u8 page)
+{
+    bool watch_read = ctx.read_watches[page] > 0;
+    bool watch_write = ctx.write_watches[page] > 0;
+
+    ctx.read_map[page] = watch_read ? NULL : ctx.base_map[page];
+    ctx.readers[page] = watch_read ? bus_read_watched : ctx.base_readers[page];
+    ctx.writers[page] = watch_write ? bus_write_watched : ctx.base_writers[page];
+}
+
+static void bus_set_region(u16 start, u16 end, BUS_READ reader, BUS_WRITE writer)
+{
+    for (u32 page = start >> 8; page <= (u32)(end >> 8); page++)
     {
-        return;
+        ctx.base_map[page] = NULL;
+        ctx.base_readers[page] = reader;
+        ctx.base_writers[page] = writer;
+        bus_refresh(page);
     }
+}
+
+void bus_init(void)
+{
+    bus_flat_end();
+    memset(&ctx, 0, sizeof(ctx));
 
-    assert(address >= ADDR_OAM_START);
-    if (BETWEEN(address, ADDR_OAM_START, ADDR_OAM_END) && dma_transfering())
+    // clang-format off
+    bus_set_region(0x0000, 0x7FFF, cart_read,      cart_write);
+    bus_set_region(0x8000, 0x9FFF, ppu_vram_read,  vram_write);
+    bus_set_region(0xA000, 0xBFFF, cart_read,      cart_write);
+    bus_set_region(0xC000, 0xDFFF, wram_read,      wram_write);
+    bus_set_region(0xE000, 0xFDFF, echo_read,      echo_write);
+    bus_set_region(0xFE00, 0xFEFF, oam_page_read,  oam_page_write);
+    bus_set_region(0xFF00, 0xFFFF, high_page_read, high_page_write);
+    // clang-format on
+}
+
+void bus_map(u16 start, u16 end, const u8 *data)
+{
+    for (u32 page = start >> 8; page <= (u32)(end >> 8); page++)
     {
-        return;
+        ctx.base_map[page] = data ? data + ((page << 8) - start) : NULL;
+        bus_refresh(page);
     }
+}
+
+const u8 *bus_page(u16 address)
+{
+    return ctx.base_map[address >> 8];
+}
+
+u8 bus_peek(u16 address)
+{
+    const u8 *page = ctx.base_map[address >> 8];
+
+    if (page)
+        return page[address & 0xFF];
 
-    assert(address >= ADDR_OAM_START);
-    if (BETWEEN(address, ADDR_OAM_START, ADDR_OAM_END))
+    return ctx.base_readers[address >> 8](address);
+}
+
+static void bus_notify(u16 address, u8 value, u8 flag)
+{
+    bus_access access = {
+        .pc = cpu_inst_pc(),
+        .address = address,
+        .value = value,
+        .write = flag == BUS_WATCH_WRITE,
+        .ticks = emu_get_context()->ticks,
+    };
+
+    for (u32 i = 0; i < BUS_MAX_WATCHPOINTS; i++)
     {
-        ppu_oam_write(address, value);
-        return;
+        bus_watchpoint *wp = &ctx.watchpoints[i];
+
+        if (wp->active && (wp->flags & flag) && BETWEEN(address, wp->start, wp->end))
+            wp->callback(&access, wp->user);
     }
+}
 
-    assert(address >= 0xFEA0);
-    if (BETWEEN(address, 0xFEA0, 0xFEFF))
+static u8 bus_read_watched(u16 address)
+{
+    u8 value = bus_peek(address);
+
+    if (ctx.read_watches[address >> 8])
+        bus_notify(address, value, BUS_WATCH_READ);
+
+    return value;
+}
+
+static void bus_write_watched(u16 address, u8 value)
+{
+    ctx.base_writers[address >> 8](address, value);
+    bus_notify(address, value, BUS_WATCH_WRITE);
+}
+
+static void bus_count_watch(const bus_watchpoint *wp, int delta)
+{
+    for (u32 page = wp->start >> 8; page <= (u32)(wp->end >> 8); page++)
     {
-        return;
+        if (wp->flags & BUS_WATCH_READ)
+            ctx.read_watches[page] += delta;
+
+        if (wp->flags & BUS_WATCH_WRITE)
+            ctx.write_watches[page] += delta;
+
+        bus_refresh(page);
     }
+}
+
+int bus_watch(u16 start, u16 end, u8 flags, bus_watch_fn callback, void *user)
+{
+    assert(start <= end && callback != NULL);
 
-    assert(address >= 0xFF00);
-    if (BETWEEN(address, 0xFF00, 0xFF7F))
+    for (u32 i = 0; i < BUS_MAX_WATCHPOINTS; i++)
     {
-        io_write(address, value);
-        return;
+        bus_watchpoint *wp = &ctx.watchpoints[i];
+
+        if (wp->active)
+            continue;
+
+        *wp = (bus_watchpoint){true, start, end, flags, callback, user};
+        bus_count_watch(wp, 1);
+
+        return i;
     }
 
-    assert(address >= 0xFF80);
-    if (BETWEEN(address, 0xFF80, 0xFFFE))
-    {
-        hram_write(address, value);
+    fprintf(stderr, "Too many watchpoints\n");
+    return -1;
+}
+
+void bus_unwatch(int id)
+{
+    if (id < 0 || id >= BUS_MAX_WATCHPOINTS || !ctx.watchpoints[id].active)
         return;
-    }
 
-    assert(address == 0xFFFF);
-    cpu_set_ie_register(value);
+    bus_count_watch(&ctx.watchpoints[id], -1);
+    ctx.watchpoints[id].active = false;
+}
+
+u8 bus_read(u16 address)
+{
+    const u8 *page = ctx.read_map[address >> 8];
+
+    if (page)
+        return page[address & 0xFF];
+
+    return ctx.readers[address >> 8](address);
+}
+
+void bus_write(u16 address, u8 value)
+{
+    ctx.writers[address >> 8](address, value);
 }
 
 u16 bus_read16(u16 address)
@@ -169,3 +337,93 @@ void bus_write16(u16 address, u16 value)
     bus_write(address + 1, (value >> 8) & 0xFF);
     bus_write(address, value & 0xFF);
 }
+
+static void flat_log(u16 address, u8 value, bool write)
+{
+    if (flat.count < flat.capacity)
+        flat.log[flat.count] = (bus_access){
+            .pc = cpu_inst_pc(),
+            .address = address,
+            .value = value,
+            .write = write,
+            .ticks = emu_get_context()->ticks,
+        };
+
+    flat.count++;
+}
+
+static u8 flat_read(u16 address)
+{
+    u8 value = flat.memory[address];
+    flat_log(address, value, false);
+    return value;
+}
+
+static void flat_write(u16 address, u8 value)
+{
+    flat.memory[address] = value;
+
+    if (flat.log)
+        flat_log(address, value, true);
+}
+
+void bus_flat(u8 *memory, bus_access *log, u32 capacity)
+{
+    emu_context *emu = emu_get_context();
+
+    if (!bus_flat_active)
+    {
+        flat.machine = ctx;
+        flat.idle_skip = emu->idle_skip;
+        flat.jit = emu->jit;
+    }
+
+    flat.memory = memory;
+    flat.log = log;
+    flat.capacity = log ? capacity : 0;
+    flat.count = 0;
+
+    // without a log reads skip the handler, bus_peek() never logs
+    for (u32 page = 0; page < BUS_PAGES; page++)
+    {
+        ctx.base_map[page] = memory + (page << 8);
+        ctx.base_readers[page] = flat_read;
+        ctx.base_writers[page] = flat_write;
+
+        ctx.read_map[page] = log ? NULL : ctx.base_map[page];
+        ctx.readers[page] = flat_read;
+        ctx.writers[page] = flat_write;
+    }
+
+    // the decoded blocks are from the machine's memory
+    emu->idle_skip = false;
+    emu->jit = false;
+    cpu_cache_flush();
+
+    bus_flat_active = true;
+}
+
+void bus_flat_end(void)
+{
+    if (!bus_flat_active)
+        return;
+
+    emu_context *emu = emu_get_context();
+
+    ctx = flat.machine;
+    emu->idle_skip = flat.idle_skip;
+    emu->jit = flat.jit;
+    cpu_cache_flush();
+
+    bus_flat_active = false;
+}
+
+u32 bus_flat_count(void)
+{
+    return flat.count;
+}
+
+void bus_flat_clear(void)
+{
+    flat.count = 0;
+}
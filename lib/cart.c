@@ -1,10 +1,15 @@
 #include <cart.h>
+#include <archive.h>
+#include <battery.h>
+#include <cpu.h>
+#include <bus.h>
 
 typedef struct
 {
     char filename[1024];
-    u64 rom_size;
+    u64 rom_size; // padded to a power of two, at least two banks
     u8 *rom_data;
+    u32 rom_bank_mask;
     rom_header *header;
 
     // mbc1 related data
@@ -18,17 +23,21 @@ typedef struct
 
     u8 *ram_bank;      // current selected ram bank
     u8 *ram_banks[16]; // all ram banks
+    u8 ram_bank_index; // index of ram_bank in ram_banks
+    u8 ram_bank_count; // number of allocated ram banks
+
+    u8 cgb_flag; // 0x0143, shares its byte with the end of the title
 
     // for battery
-    bool battery;   // has battery
-    bool need_save; // should save battery backup.
+    bool battery;    // has battery
+    u16 dirty_banks; // one bit per ram bank written since the last save.
 } cart_context;
 
 static cart_context ctx;
 
 bool cart_need_save(void)
 {
-    return ctx.need_save;
+    return ctx.dirty_banks != 0;
 }
 
 bool cart_mbc1(void)
@@ -36,6 +45,17 @@ bool cart_mbc1(void)
     return BETWEEN(ctx.header->type, 1, 3);
 }
 
+bool cart_cgb(void)
+{
+    // 0x80 works on both, 0xC0 is CGB only
+    return ctx.rom_data && (ctx.cgb_flag & 0x80);
+}
+
+bool cart_cgb_only(void)
+{
+    return ctx.rom_data && ctx.cgb_flag == 0xC0;
+}
+
 bool cart_battery(void)
 {
     // mbc1 only for now...
@@ -151,8 +171,16 @@ const char *cart_type_name(void)
     return result ? result : "Unknown";
 }
 
+static void cart_select_ram_bank(u8 bank)
+{
+    ctx.ram_bank = ctx.ram_banks[bank];
+    ctx.ram_bank_index = bank;
+}
+
 void cart_setup_banking(void)
 {
+    ctx.ram_bank_count = 0;
+
     for (int8_t i = 0; i < 16; i++)
     {
         bool allocate = false;
@@ -165,53 +193,67 @@ void cart_setup_banking(void)
             case 0x03: allocate = i < 0x04; break; // 32 KBytes
             case 0x04: allocate = i < 0x10; break; // 128 KBytes
             case 0x05: allocate = i < 0x08; break; // 64 KBytes
-            default: assert(false);
+            default: allocate = false; break;      // broken header, no RAM
         }
         // clang-format on
-        ctx.ram_banks[i] = allocate ? calloc(0x2000, sizeof(u8)) : NULL;
+        ctx.ram_banks[i] = allocate ? calloc(BATTERY_BANK_SIZE, sizeof(u8)) : NULL;
+        ctx.ram_bank_count += allocate ? 1 : 0;
     }
 
-    ctx.ram_bank = ctx.ram_banks[0];
+    cart_select_ram_bank(0);
     ctx.rom_bank_x = ctx.rom_data + 0x4000; // rom bank 1
 }
 
-bool cart_load(const char *cart)
+// frees what the previous cartridge left, its RAM is saved first so the
+// next cartridge starts its own battery writer
+static void cart_unload(void)
 {
-    snprintf(ctx.filename, sizeof(ctx.filename), "%s", cart);
+    cart_battery_flush();
 
-    FILE *fp = fopen(ctx.filename, "rb");
-    if (!fp)
+    free(ctx.rom_data);
+    ctx.rom_data = NULL;
+
+    for (u8 i = 0; i < 16; i++)
     {
-        printf("Failed to open: %s\n", ctx.filename);
-        return false;
+        free(ctx.ram_banks[i]);
+        ctx.ram_banks[i] = NULL;
     }
+}
 
-    printf("Opened: %s\n", ctx.filename);
-
-    fseek(fp, 0, SEEK_END);
-    ctx.rom_size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-
-    ctx.rom_data = calloc(ctx.rom_size, sizeof(u8));
-    assert(ctx.rom_data != NULL);
-    size_t read_size = fread(ctx.rom_data, sizeof(u8), ctx.rom_size, fp);
-    assert(read_size == ctx.rom_size);
+// takes `rom`, allocated with archive_capacity(size) bytes
+static void cart_setup(const char *name, u8 *rom, u32 size)
+{
+    cart_unload();
+    snprintf(ctx.filename, sizeof(ctx.filename), "%s", name);
 
-    int err = fclose(fp);
-    assert(err == 0);
+    // short or odd sized dumps read as open bus past their end, the header
+    // and both banks of the first 32 KB are always there.
+    ctx.rom_size = archive_capacity(size);
+    ctx.rom_data = rom;
+    memset(ctx.rom_data + size, 0xFF, ctx.rom_size - size);
+    ctx.rom_bank_mask = ctx.rom_size / 0x4000 - 1;
 
     ctx.header = (rom_header *)(ctx.rom_data + 0x100);
+    ctx.cgb_flag = ctx.header->title[15];
     ctx.header->title[15] = '\0';
     ctx.battery = cart_battery();
-    ctx.need_save = false;
+    ctx.dirty_banks = 0;
+    ctx.ram_enabled = false;
+    ctx.ram_banking = false;
+    ctx.rom_bank_value = 1;
+    ctx.ram_bank_value = 0;
 
     printf("Cartridge Loaded:\n");
     printf("\t Title    : %s\n", ctx.header->title);
     printf("\t Type     : %2.2X (%s)\n", ctx.header->type, cart_type_name());
-    printf("\t ROM Size : %d KB\n", 32 << ctx.header->rom_size);
+    if (ctx.header->rom_size <= 8)
+        printf("\t ROM Size : %d KB\n", 32 << ctx.header->rom_size);
+    else
+        printf("\t ROM Size : %2.2X (Unknown)\n", ctx.header->rom_size);
     printf("\t RAM Size : %2.2X\n", ctx.header->ram_size);
     printf("\t LIC Code : %2.2X (%s)\n", ctx.header->lic_code, cart_lic_name());
     printf("\t ROM Vers : %2.2X\n", ctx.header->version);
+    printf("\t CGB      : %2.2X\n", ctx.cgb_flag);
 
     cart_setup_banking();
 
@@ -222,6 +264,32 @@ bool cart_load(const char *cart)
         x = x - ctx.rom_data[i] - 1;
 
     printf("\t Checksum : %2.2X (%s)\n", ctx.header->checksum, (x & 0xFF) ? "PASSED" : "FAILED");
+}
+
+bool cart_load_data(const char *name, const u8 *data, u32 size)
+{
+    u8 *rom = malloc(archive_capacity(size));
+    assert(rom != NULL);
+    memcpy(rom, data, size);
+
+    cart_setup(name, rom, size);
+    return true;
+}
+
+bool cart_load(const char *cart)
+{
+    u32 size;
+    u8 *rom = archive_read(cart, &size);
+
+    if (!rom)
+    {
+        printf("Failed to open: %s\n", cart);
+        return false;
+    }
+
+    printf("Opened: %s\n", cart);
+
+    cart_setup(cart, rom, size);
 
     if (ctx.battery)
         cart_battery_load();
@@ -239,41 +307,42 @@ void cart_battery_load(void)
     FILE *fp = fopen(fn, "rb");
 
     if (!fp)
-    {
         fprintf(stderr, "FAILED TO OPEN: %s\n", fn);
-        return;
-    }
 
-    fread(ctx.ram_bank, 0x2000, 1, fp);
-    fclose(fp);
+    // older saves only hold the first bank, the others stay blank.
+    for (u8 i = 0; fp && i < ctx.ram_bank_count; i++)
+        if (fread(ctx.ram_banks[i], BATTERY_BANK_SIZE, 1, fp) != 1)
+            break;
+
+    if (fp)
+        fclose(fp);
+
+    battery_start(fn, ctx.ram_banks, ctx.ram_bank_count);
 }
 
 void cart_battery_save(void)
 {
-    if (!ctx.ram_bank)
+    if (!ctx.dirty_banks)
         return;
 
-    char fn[1048];
-    snprintf(fn, sizeof(fn), "%s.battery", ctx.filename);
-    FILE *fp = fopen(fn, "wb");
-
-    if (!fp)
-    {
-        fprintf(stderr, "FAILED TO OPEN: %s\n", fn);
-        return;
-    }
+    // never blocks: when the writer is busy the banks stay dirty until the next save.
+    if (battery_submit(ctx.ram_banks, ctx.dirty_banks))
+        ctx.dirty_banks = 0;
+}
 
-    fwrite(ctx.ram_bank, 0x2000, 1, fp);
-    fclose(fp);
+void cart_battery_flush(void)
+{
+    battery_stop(ctx.ram_banks, ctx.dirty_banks);
+    ctx.dirty_banks = 0;
 }
 
 u8 cart_read(u16 address)
 {
-    if (!cart_mbc1() || address < 0x4000)
-        return ctx.rom_data[address];
-
     if ((address & 0xE000) == 0xA000)
     {
+        if (!cart_mbc1())
+            return 0xFF;
+
         if (!ctx.ram_enabled)
             return 0xFF;
 
@@ -283,9 +352,32 @@ u8 cart_read(u16 address)
         return ctx.ram_bank[address - 0xA000];
     }
 
+    if (!cart_mbc1() || address < 0x4000)
+        return ctx.rom_data[address];
+
     return ctx.rom_bank_x[address - 0x4000];
 }
 
+void cart_map(void)
+{
+    if (!ctx.rom_data)
+        return;
+
+    // only the rom is read directly, the external ram goes through cart_read.
+    bus_map(0x0000, 0x3FFF, ctx.rom_data);
+    bus_map(0x4000, 0x7FFF, cart_mbc1() ? ctx.rom_bank_x : ctx.rom_data + 0x4000);
+}
+
+u8 cart_rom_bank(void)
+{
+    return (ctx.rom_bank_x - ctx.rom_data) / 0x4000;
+}
+
+const rom_header *cart_header(void)
+{
+    return ctx.header;
+}
+
 void cart_write(u16 address, u8 value)
 {
     if (cart_mbc1() == false)
@@ -304,8 +396,11 @@ void cart_write(u16 address, u8 value)
 
         value &= 0x1F;
 
-        ctx.rom_bank_value = value;
+        // the upper bits of the bank number are not wired on smaller roms
+        ctx.rom_bank_value = value & ctx.rom_bank_mask;
         ctx.rom_bank_x = ctx.rom_data + (0x4000 * ctx.rom_bank_value);
+        bus_map(0x4000, 0x7FFF, ctx.rom_bank_x);
+        cpu_cache_invalidate();
     }
 
     if ((address & 0xE000) == 0x4000)
@@ -313,11 +408,7 @@ void cart_write(u16 address, u8 value)
         // ram bank number
         ctx.ram_bank_value = value & 0x3;
         if (ctx.ram_banking)
-        {
-            if (cart_need_save())
-                cart_battery_save();
-            ctx.ram_bank = ctx.ram_banks[ctx.ram_bank_value];
-        }
+            cart_select_ram_bank(ctx.ram_bank_value);
     }
 
     if ((address & 0xE000) == 0x6000)
@@ -325,11 +416,7 @@ void cart_write(u16 address, u8 value)
         // banking mode select
         ctx.ram_banking = value & 1;
         if (ctx.ram_banking)
-        {
-            if (cart_need_save())
-                cart_battery_save();
-            ctx.ram_bank = ctx.ram_banks[ctx.ram_bank_value];
-        }
+            cart_select_ram_bank(ctx.ram_bank_value);
     }
 
     if ((address & 0xE000) == 0xA000)
@@ -342,6 +429,39 @@ void cart_write(u16 address, u8 value)
 
         ctx.ram_bank[address - 0xA000] = value;
         if (ctx.battery)
-            ctx.need_save = true;
+            ctx.dirty_banks |= 1 << ctx.ram_bank_index;
     }
 }
+
+// the mapper registers and the external ram, the rom never changes.
+void cart_state_save(state_stream *stream)
+{
+    STATE_PUT(stream, ctx.ram_enabled);
+    STATE_PUT(stream, ctx.ram_banking);
+    STATE_PUT(stream, ctx.rom_bank_x);
+    STATE_PUT(stream, ctx.rom_bank_value);
+    STATE_PUT(stream, ctx.ram_bank_value);
+    STATE_PUT(stream, ctx.ram_bank);
+    STATE_PUT(stream, ctx.ram_bank_index);
+    STATE_PUT(stream, ctx.dirty_banks);
+
+    for (u8 i = 0; i < ctx.ram_bank_count; i++)
+        state_put(stream, ctx.ram_banks[i], BATTERY_BANK_SIZE);
+}
+
+void cart_state_load(state_stream *stream)
+{
+    STATE_GET(stream, ctx.ram_enabled);
+    STATE_GET(stream, ctx.ram_banking);
+    STATE_GET(stream, ctx.rom_bank_x);
+    STATE_GET(stream, ctx.rom_bank_value);
+    STATE_GET(stream, ctx.ram_bank_value);
+    STATE_GET(stream, ctx.ram_bank);
+    STATE_GET(stream, ctx.ram_bank_index);
+    STATE_GET(stream, ctx.dirty_banks);
+
+    for (u8 i = 0; i < ctx.ram_bank_count; i++)
+        state_get(stream, ctx.ram_banks[i], BATTERY_BANK_SIZE);
+
+    cart_map();
+}
@@ -4,6 +4,8 @@
 #include <interrupts.h>
 #include <dbg.h>
 #include <timer.h>
+#include <jit.h>
+#include <trace.h>
 
 cpu_context ctx = {0};
 
@@ -13,6 +15,7 @@ cpu_context ctx = {0};
 #define REGS (CPU.regs)
 
 #define CPU_DEBUG 0
+#define CPU_BLOCK_CACHE 1
 
 u16 cpu_read_reg(reg_type rt)
 {
@@ -20,14 +23,14 @@ u16 cpu_read_reg(reg_type rt)
     switch (rt)
     {
     case RT_A: return REGS.a;
-    case RT_F: return REGS.f;
+    case RT_F: return CPU_FLAGS(&CPU);
     case RT_B: return REGS.b;
     case RT_C: return REGS.c;
     case RT_D: return REGS.d;
     case RT_E: return REGS.e;
     case RT_H: return REGS.h;
     case RT_L: return REGS.l;
-    case RT_AF: return (REGS.a << 8) | REGS.f;
+    case RT_AF: return (REGS.a << 8) | CPU_FLAGS(&CPU);
     case RT_BC: return (REGS.b << 8) | REGS.c;
     case RT_DE: return (REGS.d << 8) | REGS.e;
     case RT_HL: return (REGS.h << 8) | REGS.l;
@@ -47,14 +50,14 @@ void cpu_write_reg(reg_type rt, u16 value)
     switch (rt)
     {
         case RT_A: REGS.a = value; break;
-        case RT_F: REGS.f = value; break;
+        case RT_F: REGS.f = value; CPU.flags.op = LF_NONE; break;
         case RT_B: REGS.b = value; break;
         case RT_C: REGS.c = value; break;
         case RT_D: REGS.d = value; break;
         case RT_E: REGS.e = value; break;
         case RT_H: REGS.h = value; break;
         case RT_L: REGS.l = value; break;
-        case RT_AF: REGS.a = (value >> 8) & 0xFF; REGS.f =(value >> 0) & 0xFF; break;
+        case RT_AF: REGS.a = (value >> 8) & 0xFF; REGS.f =(value >> 0) & 0xFF; CPU.flags.op = LF_NONE; break;
         case RT_BC: REGS.b = (value >> 8) & 0xFF; REGS.c =(value >> 0) & 0xFF; break;
         case RT_DE: REGS.d = (value >> 8) & 0xFF; REGS.e =(value >> 0) & 0xFF; break;
         case RT_HL: REGS.h = (value >> 8) & 0xFF; REGS.l =(value >> 0) & 0xFF; break;
@@ -71,7 +74,7 @@ u8 cpu_read_reg8(reg_type rt)
     switch (rt)
     {
         case RT_A: return REGS.a;
-        case RT_F: return REGS.f;
+        case RT_F: return CPU_FLAGS(&CPU);
         case RT_B: return REGS.b;
         case RT_C: return REGS.c;
         case RT_D: return REGS.d;
@@ -90,7 +93,7 @@ void cpu_write_reg8(reg_type rt, u8 value)
     switch (rt)
     {
         case RT_A: REGS.a = value; break;
-        case RT_F: REGS.f = value; break;
+        case RT_F: REGS.f = value; CPU.flags.op = LF_NONE; break;
         case RT_B: REGS.b = value; break;
         case RT_C: REGS.c = value; break;
         case RT_D: REGS.d = value; break;
@@ -107,12 +110,26 @@ void cpu_init(void)
 {
     REGS.a = 0x01;
     REGS.f = 0xB0;
+    CPU.flags.op = LF_NONE;
     REGS.b = 0x00;
     REGS.c = 0x13;
     REGS.d = 0x00;
     REGS.e = 0xD8;
     REGS.h = 0x01;
     REGS.l = 0x4D;
+
+    if (EMU->cgb)
+    {
+        // games look for A = 0x11 to detect the CGB
+        REGS.a = 0x11;
+        REGS.f = 0x80;
+        REGS.c = 0x00;
+        REGS.d = 0xFF;
+        REGS.e = 0x56;
+        REGS.h = 0x00;
+        REGS.l = 0x0D;
+    }
+
     REGS.sp = 0xFFFE;
     REGS.pc = 0x0100;
 
@@ -124,7 +141,11 @@ void cpu_init(void)
     TIMER->div = 0xABCC;
 
     CPU.halted = false;
+    CPU.locked = false;
     CPU.stepping = false;
+
+    cpu_cache_flush();
+    jit_flush();
 }
 
 static void fetch_instruction(void)
@@ -133,58 +154,110 @@ static void fetch_instruction(void)
     CPU.current_instruction = instruction_by_opcode(CPU.current_opcode);
 }
 
-static void execute(void)
+static void fetch_decoded(const cpu_decoded *op)
 {
-    IN_PROC proc = inst_get_processor(CPU.current_instruction->type);
+    CPU.current_opcode = op->opcode;
+    CPU.current_instruction = op->inst;
+
+    // the opcode and immediate bytes were read when the block was decoded.
+    REGS.pc += op->cycles;
+    emu_cycles(op->cycles);
+
+    CPU.mem_dest = 0;
+    CPU.dest_is_mem = false;
+    op->fetch(op->imm);
+}
+
+static void execute(IN_PROC proc)
+{
+    if (proc == NULL)
+        proc = inst_get_processor(CPU.current_instruction->type);
     if (proc == NULL)
         NO_IMPL();
     proc(&ctx);
 }
 
-bool cpu_step(void)
+static void cpu_interpret(u16 pc)
 {
-    if (!CPU.halted)
-    {
-#if CPU_DEBUG == 1
-        u16 pc = REGS.pc;
+#if CPU_BLOCK_CACHE == 1
+    const cpu_decoded *op = cpu_cache_lookup(pc);
+#else
+    const cpu_decoded *op = NULL;
 #endif
 
+    if (op != NULL)
+        fetch_decoded(op);
+    else
+    {
         fetch_instruction();
         emu_cycles(1);
         cpu_fetch_data();
+    }
 
 #if CPU_DEBUG == 1
-        char flags[16];
-        snprintf(flags, sizeof(flags), "%c%c%c%c",
-                 REGS.f & (1 << 7) ? 'Z' : '-',
-                 REGS.f & (1 << 6) ? 'N' : '-',
-                 REGS.f & (1 << 5) ? 'H' : '-',
-                 REGS.f & (1 << 4) ? 'C' : '-');
-
-        const char *inst = instr_to_str(&ctx);
-
-        printf("%08llX - %04X: %-12s (%02X %02X %02X) A: %02X F: %s BC: %02X%02X DE: %02X%02X HL: %02X%02X\n",
-               EMU->ticks,
-               pc, inst, CPU.current_opcode,
-               bus_read(pc + 1), bus_read(pc + 2), REGS.a, flags, REGS.b, REGS.c,
-               REGS.d, REGS.e, REGS.h, REGS.l);
+    char flags[16];
+    snprintf(flags, sizeof(flags), "%c%c%c%c",
+             CPU_FLAG_Z(&CPU) ? 'Z' : '-',
+             CPU_FLAG_N(&CPU) ? 'N' : '-',
+             CPU_FLAG_H(&CPU) ? 'H' : '-',
+             CPU_FLAG_C(&CPU) ? 'C' : '-');
+
+    const char *inst = instr_to_str(&ctx);
+
+    printf("%08llX - %04X: %-12s (%02X %02X %02X) A: %02X F: %s BC: %02X%02X DE: %02X%02X HL: %02X%02X\n",
+           EMU->ticks,
+           pc, inst, CPU.current_opcode,
+           bus_peek(pc + 1), bus_peek(pc + 2), REGS.a, flags, REGS.b, REGS.c,
+           REGS.d, REGS.e, REGS.h, REGS.l);
 #endif
 
-        if (CPU.current_instruction == NULL)
-        {
-            printf("Unknown Instruction! %02X\n", CPU.current_opcode);
-            exit(-7);
-        }
-
-        dbg_update();
 #if CPU_DEBUG == 1
-        dbg_print();
+    dbg_print();
 #endif
 
-        execute();
+    execute(op != NULL ? op->proc : NULL);
+}
+
+bool cpu_step(void)
+{
+    if (CPU.locked)
+        return false;
+
+    if (EMU->stall)
+    {
+        // HBlank DMA blocks held the bus
+        u32 stall = EMU->stall;
+        EMU->stall = 0;
+        emu_cycles(stall);
+    }
+
+    if (!CPU.halted)
+    {
+        u16 pc = REGS.pc;
+        CPU.inst_pc = pc;
+
+        bool defer = EMU->timing == TIMING_FAST;
+        if (defer)
+            emu_defer_begin();
+
+        if (!EMU->jit || !jit_run(&ctx, &pc))
+            cpu_interpret(pc);
+
+        if (defer)
+            emu_defer_end();
+
+        if (CPU.locked)
+            return false;
+
+        if (EMU->idle_skip)
+            cpu_idle_update(&ctx, pc);
     }
     else
     {
+        // only the timer and the PPU can wake us up, run them up to their next event.
+        if (CPU.int_flags == 0)
+            emu_advance(emu_quiet_cycles());
+
         emu_cycles(1);
 
         if (CPU.int_flags != 0)
@@ -208,8 +281,38 @@ bool cpu_step(void)
     return true;
 }
 
+u8 cpu_resolve_flags(cpu_context *cpu)
+{
+    cpu_lazy_flags *lf = &cpu->flags;
+    u8 f = (lf->res == 0) << 7;
+
+    // clang-format off
+    switch (lf->op)
+    {
+    case LF_ADD: f |= ((lf->lhs & 0xF) + (lf->rhs & 0xF) + lf->carry > 0xF) << 5 | (lf->lhs + lf->rhs + lf->carry > 0xFF) << 4; break;
+    case LF_SUB: f |= 1 << 6 | ((lf->lhs & 0xF) < (lf->rhs & 0xF) + lf->carry) << 5 | (lf->lhs < lf->rhs + lf->carry) << 4; break;
+    case LF_AND: f |= 1 << 5; break;
+    case LF_OR: break;
+    case LF_INC: f |= ((lf->res & 0xF) == 0) << 5 | (cpu->regs.f & 0x10); break;
+    case LF_DEC: f |= 1 << 6 | ((lf->res & 0xF) == 0xF) << 5 | (cpu->regs.f & 0x10); break;
+    default: return cpu->regs.f;
+    }
+    // clang-format on
+
+    cpu->regs.f = f | (cpu->regs.f & 0x0F);
+    lf->op = LF_NONE;
+
+    return cpu->regs.f;
+}
+
 void cpu_set_flags(u8 z, u8 n, u8 h, u8 c)
 {
+    // flags left untouched (0xff) come from the last ALU op.
+    if (z == 0xff || n == 0xff || h == 0xff || c == 0xff)
+        cpu_resolve_flags(&CPU);
+    else
+        CPU.flags.op = LF_NONE;
+
     assert(z == 0xff || z == 0 || z == 1);
     if (z != 0xff)
         BIT_SET(REGS.f, 7, z);
@@ -242,6 +345,24 @@ cpu_registers *cpu_get_registers(void)
     return &CPU.regs;
 }
 
+u16 cpu_inst_pc(void)
+{
+    return CPU.inst_pc;
+}
+
+void cpu_state_save(state_stream *stream)
+{
+    STATE_PUT(stream, ctx);
+}
+
+void cpu_state_load(state_stream *stream)
+{
+    STATE_GET(stream, ctx);
+
+    // the block being replayed may not be the one at the restored PC
+    cpu_cache_invalidate();
+}
+
 u8 cpu_get_int_flags(void)
 {
     return CPU.int_flags;
@@ -255,4 +376,18 @@ void cpu_set_int_flags(u8 value)
 void cpu_request_interrupt(interrupt_type type)
 {
     CPU.int_flags |= type;
+
+    if (trace_active)
+    {
+        // clang-format off
+        switch (type)
+        {
+        case IT_VBLANK:   trace_instant(TRACK_THREAD, "int vblank", type); break;
+        case IT_LCD_STAT: trace_instant(TRACK_THREAD, "int stat", type); break;
+        case IT_TIMER:    trace_instant(TRACK_THREAD, "int timer", type); break;
+        case IT_SERIAL:   trace_instant(TRACK_THREAD, "int serial", type); break;
+        case IT_JOYPAD:   trace_instant(TRACK_THREAD, "int joypad", type); break;
+        }
+        // clang-format on
+    }
 }
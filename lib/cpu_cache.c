@@ -0,0 +1,256 @@
+#include <cpu.h>
+#include <bus.h>
+#include <cart.h>
+
+// Straight-line runs of instructions are decoded once: opcode, immediate
+// bytes, fetch handler and processor. cpu_step() then replays them without
+// going back to the bus or the addressing-mode switch.
+//
+// Blocks are keyed by bank:PC and end on control flow, EI/DI/HALT/STOP or an
+// illegal opcode. Blocks decoded from WRAM/HRAM are dropped when their page is
+// written, a ROM bank switch only stops the replay of the current block.
+
+#define CACHE_MAX_OPS 32
+#define CACHE_MAX_BLOCKS 4096
+#define CACHE_MAX_RAM_BLOCKS 512
+#define CACHE_POOL_SIZE (CACHE_MAX_BLOCKS * 8)
+#define CACHE_BUCKETS 4096
+#define CACHE_PAGE_SHIFT 8
+
+typedef struct cache_block
+{
+    u32 key;
+    u16 start;
+    u16 end; // first byte past the block
+    u8 count;
+    cpu_decoded *ops;
+    struct cache_block *next;
+} cache_block;
+
+typedef struct
+{
+    cache_block blocks[CACHE_MAX_BLOCKS];
+    u32 block_count;
+    cpu_decoded pool[CACHE_POOL_SIZE];
+    u32 pool_used;
+    cache_block *table[CACHE_BUCKETS];
+
+    cache_block *ram_blocks[CACHE_MAX_RAM_BLOCKS];
+    u32 ram_block_count;
+    bool code_pages[0x10000 >> CACHE_PAGE_SHIFT];
+
+    // block being replayed
+    cache_block *block;
+    u8 index;
+    u16 next_pc;
+} cache_context;
+
+static cache_context ctx;
+
+static u32 cache_hash(u32 key)
+{
+    return (key ^ (key >> 16)) & (CACHE_BUCKETS - 1);
+}
+
+static bool cache_region(u16 pc, u32 *key, u32 *limit)
+{
+    *key = pc;
+
+    // a flat memory is rewritten behind the cache's back
+    if (bus_flat_active)
+        return false;
+
+    if (pc < 0x4000)
+        *limit = 0x4000;
+    else if (pc < 0x8000)
+    {
+        *key |= cart_rom_bank() << 16;
+        *limit = 0x8000;
+    }
+    else if (BETWEEN(pc, 0xC000, 0xDFFF))
+        *limit = 0xE000;
+    else if (BETWEEN(pc, 0xFF80, 0xFFFE))
+        *limit = 0xFFFF;
+    else
+        return false;
+
+    return true;
+}
+
+static bool cache_ends_block(instruction *inst)
+{
+    switch (inst->type)
+    {
+    case IN_JP:
+    case IN_JR:
+    case IN_CALL:
+    case IN_RET:
+    case IN_RETI:
+    case IN_RST:
+    case IN_EI:
+    case IN_DI:
+    case IN_HALT:
+    case IN_STOP:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void cache_mark(cache_block *block)
+{
+    for (u32 page = block->start >> CACHE_PAGE_SHIFT; page <= (u32)(block->end - 1) >> CACHE_PAGE_SHIFT; page++)
+        ctx.code_pages[page] = true;
+}
+
+void cpu_cache_flush(void)
+{
+    ctx.block_count = 0;
+    ctx.pool_used = 0;
+    ctx.ram_block_count = 0;
+    ctx.block = NULL;
+
+    memset(ctx.table, 0, sizeof(ctx.table));
+    memset(ctx.code_pages, 0, sizeof(ctx.code_pages));
+}
+
+void cpu_cache_invalidate(void)
+{
+    ctx.block = NULL;
+}
+
+static void cache_unlink(cache_block *block)
+{
+    cache_block **link = &ctx.table[cache_hash(block->key)];
+
+    while (*link != block)
+        link = &(*link)->next;
+
+    *link = block->next;
+}
+
+void cpu_cache_write(u16 address)
+{
+    u32 page = address >> CACHE_PAGE_SHIFT;
+
+    if (!ctx.code_pages[page])
+        return;
+
+    for (u32 i = 0; i < ctx.ram_block_count;)
+    {
+        cache_block *block = ctx.ram_blocks[i];
+
+        if (page < (u32)block->start >> CACHE_PAGE_SHIFT || page > (u32)(block->end - 1) >> CACHE_PAGE_SHIFT)
+        {
+            i++;
+            continue;
+        }
+
+        cache_unlink(block);
+        ctx.ram_blocks[i] = ctx.ram_blocks[--ctx.ram_block_count];
+    }
+
+    memset(ctx.code_pages + (0xC000 >> CACHE_PAGE_SHIFT), 0, sizeof(ctx.code_pages) - (0xC000 >> CACHE_PAGE_SHIFT));
+    for (u32 i = 0; i < ctx.ram_block_count; i++)
+        cache_mark(ctx.ram_blocks[i]);
+
+    ctx.block = NULL;
+}
+
+static cache_block *cache_decode(u32 key, u16 start, u32 limit)
+{
+    bool ram = start >= 0xC000;
+
+    if (ctx.block_count == CACHE_MAX_BLOCKS || ctx.pool_used + CACHE_MAX_OPS > CACHE_POOL_SIZE ||
+        (ram && ctx.ram_block_count == CACHE_MAX_RAM_BLOCKS))
+        cpu_cache_flush();
+
+    cache_block *block = &ctx.blocks[ctx.block_count++];
+    block->key = key;
+    block->start = start;
+    block->count = 0;
+    block->ops = &ctx.pool[ctx.pool_used];
+
+    u32 pc = start;
+
+    while (block->count < CACHE_MAX_OPS)
+    {
+        u8 opcode = bus_peek(pc);
+        instruction *inst = instruction_by_opcode(opcode);
+        u8 length = inst_length(inst);
+
+        if (inst->type == IN_NONE || pc + length > limit)
+            break;
+
+        u16 imm = 0;
+        for (u8 i = 1; i < length; i++)
+            imm |= bus_peek(pc + i) << (8 * (i - 1));
+
+        block->ops[block->count++] = (cpu_decoded){
+            .opcode = opcode,
+            .cycles = length,
+            .imm = imm,
+            .inst = inst,
+            .fetch = inst_get_fetcher(inst->mode),
+            .proc = inst_get_processor(inst->type),
+        };
+
+        pc += length;
+
+        if (cache_ends_block(inst))
+            break;
+    }
+
+    // an empty block remembers that the interpreter handles this address.
+    if (block->count == 0)
+        pc = start + 1;
+
+    block->end = pc;
+    ctx.pool_used += block->count;
+
+    u32 bucket = cache_hash(key);
+    block->next = ctx.table[bucket];
+    ctx.table[bucket] = block;
+
+    if (ram)
+    {
+        ctx.ram_blocks[ctx.ram_block_count++] = block;
+        cache_mark(block);
+    }
+
+    return block;
+}
+
+const cpu_decoded *cpu_cache_lookup(u16 pc)
+{
+    cache_block *block = ctx.block;
+
+    if (block == NULL || pc != ctx.next_pc || ctx.index >= block->count)
+    {
+        u32 key;
+        u32 limit;
+
+        ctx.block = NULL;
+
+        if (!cache_region(pc, &key, &limit))
+            return NULL;
+
+        block = ctx.table[cache_hash(key)];
+        while (block && block->key != key)
+            block = block->next;
+
+        if (block == NULL)
+            block = cache_decode(key, pc, limit);
+
+        if (block->count == 0)
+            return NULL;
+
+        ctx.block = block;
+        ctx.index = 0;
+    }
+
+    const cpu_decoded *op = &block->ops[ctx.index++];
+    ctx.next_pc = pc + op->cycles;
+
+    return op;
+}
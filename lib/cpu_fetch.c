@@ -4,244 +4,267 @@
 
 extern cpu_context ctx;
 
-void cpu_fetch_data(void)
-{
-    ctx.mem_dest = 0;
-    ctx.dest_is_mem = false;
-
-    if (ctx.current_instruction == NULL)
-        return;
+// Addressing modes once the opcode and its immediate bytes are known. The
+// interpreter reads immediates from the bus itself, the block cache passes
+// the bytes it decoded ahead of time (see cpu_cache.c).
 
-    switch (ctx.current_instruction->mode)
-    {
-    case AM_NONE:
-        assert(ctx.current_instruction->reg_1 == RT_NONE);
-        assert(ctx.current_instruction->reg_2 == RT_NONE);
-        return;
+static void fetch_none(u16 imm)
+{
+    ((void)imm);
+}
 
-    case AM_R:
-        assert(ctx.current_instruction->reg_1 != RT_NONE);
-        assert(ctx.current_instruction->reg_2 == RT_NONE);
-        assert(ctx.current_instruction->cond == CT_NONE);
+static void fetch_r(u16 imm)
+{
+    ((void)imm);
+    ctx.fetched_data = cpu_read_reg(ctx.current_instruction->reg_1);
+}
 
-        ctx.fetched_data = cpu_read_reg(ctx.current_instruction->reg_1);
-        return;
+static void fetch_r_r(u16 imm)
+{
+    ((void)imm);
+    ctx.fetched_data = cpu_read_reg(ctx.current_instruction->reg_2);
+}
 
-    case AM_R_R:
-        assert(ctx.current_instruction->reg_1 != RT_NONE);
-        assert(ctx.current_instruction->reg_2 != RT_NONE);
-        assert(ctx.current_instruction->cond == CT_NONE);
+static void fetch_imm(u16 imm)
+{
+    ctx.fetched_data = imm;
+}
 
-        ctx.fetched_data = cpu_read_reg(ctx.current_instruction->reg_2);
-        return;
+static void fetch_r_a16(u16 imm)
+{
+    ctx.fetched_data = bus_read(imm);
+    emu_cycles(1);
+}
 
-    case AM_D16:
-        assert(ctx.current_instruction->reg_1 == RT_NONE);
-    case AM_R_D16:
-    case AM_R_A16:
-    {
-        assert(ctx.current_instruction->reg_2 == RT_NONE);
-        assert(ctx.current_instruction->mode == AM_D16 || ctx.current_instruction->cond == CT_NONE);
+static void fetch_mr_r(u16 imm)
+{
+    ((void)imm);
 
-        u16 lo = bus_read(ctx.regs.pc);
-        emu_cycles(1);
-        ctx.regs.pc++;
+    ctx.fetched_data = cpu_read_reg(ctx.current_instruction->reg_2);
+    ctx.mem_dest = cpu_read_reg(ctx.current_instruction->reg_1);
+    ctx.dest_is_mem = true;
 
-        u16 hi = bus_read(ctx.regs.pc);
-        emu_cycles(1);
-        ctx.regs.pc++;
+    if (ctx.current_instruction->reg_1 == RT_C)
+        ctx.mem_dest |= 0xFF00;
+}
 
-        ctx.fetched_data = (hi << 8) | lo;
-        if (ctx.current_instruction->mode == AM_R_A16)
-        {
-            ctx.fetched_data = bus_read(ctx.fetched_data);
-            emu_cycles(1);
-        }
+static void fetch_mr(u16 imm)
+{
+    ((void)imm);
 
-        return;
-    }
+    ctx.mem_dest = cpu_read_reg(ctx.current_instruction->reg_1);
+    ctx.dest_is_mem = true;
+    ctx.fetched_data = bus_read(cpu_read_reg(ctx.current_instruction->reg_1));
+    emu_cycles(1);
+}
 
-    case AM_MR_R:
-    {
-        assert(ctx.current_instruction->reg_1 != RT_NONE);
-        assert(ctx.current_instruction->reg_2 != RT_NONE);
-        assert(ctx.current_instruction->cond == CT_NONE);
+static void fetch_r_mr(u16 imm)
+{
+    ((void)imm);
 
-        ctx.fetched_data = cpu_read_reg(ctx.current_instruction->reg_2);
-        ctx.mem_dest = cpu_read_reg(ctx.current_instruction->reg_1);
-        ctx.dest_is_mem = true;
+    u16 addr = cpu_read_reg(ctx.current_instruction->reg_2);
+    if (ctx.current_instruction->reg_2 == RT_C)
+        addr |= 0xFF00;
 
-        if (ctx.current_instruction->reg_1 == RT_C)
-            ctx.mem_dest |= 0xFF00;
+    ctx.fetched_data = bus_read(addr);
+    emu_cycles(1);
+}
 
-        return;
-    }
+static void fetch_r_ri(u16 imm)
+{
+    ((void)imm);
 
-    case AM_MR:
-    {
-        assert(ctx.current_instruction->reg_1 != RT_NONE);
-        assert(ctx.current_instruction->reg_2 == RT_NONE);
-        assert(ctx.current_instruction->cond == CT_NONE);
+    u16 addr = cpu_read_reg(ctx.current_instruction->reg_2);
+    ctx.fetched_data = bus_read(addr);
+    emu_cycles(1);
+    cpu_write_reg(ctx.current_instruction->reg_2, addr + 1);
+}
 
-        ctx.mem_dest = cpu_read_reg(ctx.current_instruction->reg_1);
-        ctx.dest_is_mem = true;
-        ctx.fetched_data = bus_read(cpu_read_reg(ctx.current_instruction->reg_1));
-        emu_cycles(1);
+static void fetch_r_rd(u16 imm)
+{
+    ((void)imm);
 
-        return;
-    }
+    u16 addr = cpu_read_reg(ctx.current_instruction->reg_2);
+    ctx.fetched_data = bus_read(addr);
+    emu_cycles(1);
+    cpu_write_reg(ctx.current_instruction->reg_2, addr - 1);
+}
 
-    case AM_R_MR:
-    {
-        assert(ctx.current_instruction->reg_1 != RT_NONE);
-        assert(ctx.current_instruction->reg_2 != RT_NONE);
-        assert(ctx.current_instruction->cond == CT_NONE);
+static void fetch_ri_r(u16 imm)
+{
+    ((void)imm);
 
-        u16 addr = cpu_read_reg(ctx.current_instruction->reg_2);
-        if (ctx.current_instruction->reg_2 == RT_C)
-            addr |= 0xFF00;
+    u16 addr = cpu_read_reg(ctx.current_instruction->reg_1);
+    ctx.fetched_data = cpu_read_reg(ctx.current_instruction->reg_2);
+    ctx.mem_dest = addr;
+    ctx.dest_is_mem = true;
+    cpu_write_reg(ctx.current_instruction->reg_1, addr + 1);
+}
 
-        ctx.fetched_data = bus_read(addr);
-        emu_cycles(1);
+static void fetch_rd_r(u16 imm)
+{
+    ((void)imm);
 
-        return;
-    }
+    u16 addr = cpu_read_reg(ctx.current_instruction->reg_1);
+    ctx.fetched_data = cpu_read_reg(ctx.current_instruction->reg_2);
+    ctx.mem_dest = addr;
+    ctx.dest_is_mem = true;
+    cpu_write_reg(ctx.current_instruction->reg_1, addr - 1);
+}
 
-    case AM_R_RI:
-    {
-        assert(ctx.current_instruction->reg_1 != RT_NONE);
-        assert(ctx.current_instruction->reg_2 != RT_NONE);
-        assert(ctx.current_instruction->cond == CT_NONE);
+static void fetch_a8_r(u16 imm)
+{
+    ctx.mem_dest = imm | 0xFF00;
+    ctx.dest_is_mem = true;
+}
 
-        u16 addr = cpu_read_reg(ctx.current_instruction->reg_2);
-        ctx.fetched_data = bus_read(addr);
-        emu_cycles(1);
-        cpu_write_reg(ctx.current_instruction->reg_2, addr + 1);
+static void fetch_a16_r(u16 imm)
+{
+    ctx.mem_dest = imm;
+    ctx.dest_is_mem = true;
+    ctx.fetched_data = cpu_read_reg(ctx.current_instruction->reg_2);
+}
 
-        return;
-    }
+static void fetch_mr_d8(u16 imm)
+{
+    ctx.fetched_data = imm;
+    ctx.mem_dest = cpu_read_reg(ctx.current_instruction->reg_1);
+    ctx.dest_is_mem = true;
 
-    case AM_R_RD:
-    {
-        assert(ctx.current_instruction->reg_1 != RT_NONE);
-        assert(ctx.current_instruction->reg_2 != RT_NONE);
-        assert(ctx.current_instruction->cond == CT_NONE);
+    if (ctx.current_instruction->reg_1 == RT_C)
+        ctx.mem_dest |= 0xFF00;
+}
 
-        u16 addr = cpu_read_reg(ctx.current_instruction->reg_2);
-        ctx.fetched_data = bus_read(addr);
-        emu_cycles(1);
-        cpu_write_reg(ctx.current_instruction->reg_2, addr - 1);
+static FETCH_PROC fetchers[] = {
+    [AM_NONE] = fetch_none,
+    [AM_R_D16] = fetch_imm,
+    [AM_R_R] = fetch_r_r,
+    [AM_MR_R] = fetch_mr_r,
+    [AM_R] = fetch_r,
+    [AM_R_D8] = fetch_imm,
+    [AM_R_MR] = fetch_r_mr,
+    [AM_R_RI] = fetch_r_ri,
+    [AM_R_RD] = fetch_r_rd,
+    [AM_RI_R] = fetch_ri_r,
+    [AM_RD_R] = fetch_rd_r,
+    [AM_R_A8] = fetch_imm,
+    [AM_A8_R] = fetch_a8_r,
+    [AM_HL_SPR] = fetch_imm,
+    [AM_D16] = fetch_imm,
+    [AM_D8] = fetch_imm,
+    [AM_MR_D8] = fetch_mr_d8,
+    [AM_MR] = fetch_mr,
+    [AM_A16_R] = fetch_a16_r,
+    [AM_R_A16] = fetch_r_a16,
+};
 
-        return;
-    }
+FETCH_PROC inst_get_fetcher(addr_mode mode)
+{
+    return fetchers[mode];
+}
 
-    case AM_RI_R:
+u8 inst_length(instruction *inst)
+{
+    // clang-format off
+    switch (inst->mode)
     {
-        assert(ctx.current_instruction->reg_1 != RT_NONE);
-        assert(ctx.current_instruction->reg_2 != RT_NONE);
-        assert(ctx.current_instruction->cond == CT_NONE);
-
-        u16 addr = cpu_read_reg(ctx.current_instruction->reg_1);
-        ctx.fetched_data = cpu_read_reg(ctx.current_instruction->reg_2);
-        ctx.mem_dest = addr;
-        ctx.dest_is_mem = true;
-        cpu_write_reg(ctx.current_instruction->reg_1, addr + 1);
-
-        return;
+    case AM_R_D16: case AM_D16: case AM_R_A16: case AM_A16_R:
+        return 3;
+    case AM_R_D8: case AM_D8: case AM_R_A8: case AM_A8_R: case AM_HL_SPR: case AM_MR_D8:
+        return 2;
+    default:
+        return 1;
     }
+    // clang-format on
+}
 
-    case AM_RD_R:
-    {
-        assert(ctx.current_instruction->reg_1 != RT_NONE);
-        assert(ctx.current_instruction->reg_2 != RT_NONE);
-        assert(ctx.current_instruction->cond == CT_NONE);
-
-        u16 addr = cpu_read_reg(ctx.current_instruction->reg_1);
-        ctx.fetched_data = cpu_read_reg(ctx.current_instruction->reg_2);
-        ctx.mem_dest = addr;
-        ctx.dest_is_mem = true;
-        cpu_write_reg(ctx.current_instruction->reg_1, addr - 1);
-
-        return;
-    }
+static u16 fetch_immediate(u8 bytes)
+{
+    u16 value = 0;
 
-    case AM_A8_R:
+    for (u8 i = 0; i < bytes; i++)
     {
-        assert(ctx.current_instruction->reg_1 == RT_NONE);
-        assert(ctx.current_instruction->reg_2 != RT_NONE);
-        assert(ctx.current_instruction->cond == CT_NONE);
-
-        ctx.mem_dest = bus_read(ctx.regs.pc) | 0xFF00;
+        value |= bus_read(ctx.regs.pc) << (8 * i);
         emu_cycles(1);
         ctx.regs.pc++;
-
-        ctx.dest_is_mem = true;
-
-        return;
     }
 
-    case AM_D8:
-        assert(ctx.current_instruction->reg_1 == RT_NONE);
-    case AM_R_A8:
-    case AM_R_D8:
-        assert(ctx.current_instruction->reg_2 == RT_NONE);
-    case AM_HL_SPR:
-    {
-        assert(ctx.current_instruction->mode == AM_D8 || ctx.current_instruction->cond == CT_NONE);
+    return value;
+}
 
-        ctx.fetched_data = bus_read(ctx.regs.pc);
-        emu_cycles(1);
-        ctx.regs.pc++;
+void cpu_fetch_data(void)
+{
+    ctx.mem_dest = 0;
+    ctx.dest_is_mem = false;
 
+    instruction *inst = ctx.current_instruction;
+    if (inst == NULL)
         return;
-    }
 
-    case AM_A16_R:
+    switch (inst->mode)
     {
-        assert(ctx.current_instruction->reg_1 == RT_NONE);
-        assert(ctx.current_instruction->reg_2 != RT_NONE);
-        assert(ctx.current_instruction->cond == CT_NONE);
-
-        u16 lo = bus_read(ctx.regs.pc);
-        emu_cycles(1);
-        ctx.regs.pc++;
+    case AM_NONE:
+        assert(inst->reg_1 == RT_NONE);
+        assert(inst->reg_2 == RT_NONE);
+        break;
 
-        u16 hi = bus_read(ctx.regs.pc);
-        emu_cycles(1);
-        ctx.regs.pc++;
+    case AM_R:
+    case AM_MR:
+        assert(inst->reg_1 != RT_NONE);
+        assert(inst->reg_2 == RT_NONE);
+        assert(inst->cond == CT_NONE);
+        break;
 
-        ctx.mem_dest = (hi << 8) | lo;
-        ctx.dest_is_mem = true;
+    case AM_R_R:
+    case AM_MR_R:
+    case AM_R_MR:
+    case AM_R_RI:
+    case AM_R_RD:
+    case AM_RI_R:
+    case AM_RD_R:
+        assert(inst->reg_1 != RT_NONE);
+        assert(inst->reg_2 != RT_NONE);
+        assert(inst->cond == CT_NONE);
+        break;
 
-        ctx.fetched_data = cpu_read_reg(ctx.current_instruction->reg_2);
+    case AM_D16:
+    case AM_D8:
+        assert(inst->reg_1 == RT_NONE);
+        assert(inst->reg_2 == RT_NONE);
+        break;
 
-        return;
-    }
+    case AM_R_D16:
+    case AM_R_A16:
+    case AM_R_A8:
+    case AM_R_D8:
+        assert(inst->reg_2 == RT_NONE);
+        assert(inst->cond == CT_NONE);
+        break;
 
     case AM_MR_D8:
-    {
-        assert(ctx.current_instruction->reg_1 != RT_NONE);
-        assert(ctx.current_instruction->reg_2 == RT_NONE);
-        assert(ctx.current_instruction->cond == CT_NONE);
-
-        ctx.fetched_data = bus_read(ctx.regs.pc);
-        emu_cycles(1);
-        ctx.regs.pc++;
-
-        ctx.mem_dest = cpu_read_reg(ctx.current_instruction->reg_1);
-        ctx.dest_is_mem = true;
+        assert(inst->reg_1 != RT_NONE);
+        assert(inst->reg_2 == RT_NONE);
+        assert(inst->cond == CT_NONE);
+        break;
 
-        if (ctx.current_instruction->reg_1 == RT_C)
-            ctx.mem_dest |= 0xFF00;
+    case AM_A8_R:
+    case AM_A16_R:
+        assert(inst->reg_1 == RT_NONE);
+        assert(inst->reg_2 != RT_NONE);
+        assert(inst->cond == CT_NONE);
+        break;
 
-        return;
-    }
+    case AM_HL_SPR:
+        assert(inst->cond == CT_NONE);
+        break;
 
     default:
-        printf("Unhandled address mode %d\n", ctx.current_instruction->mode);
+        printf("Unhandled address mode %d\n", inst->mode);
         abort();
         return;
     }
+
+    fetchers[inst->mode](fetch_immediate(inst_length(inst) - 1));
 }
 
 static char *rt_lookup[] = {
@@ -323,7 +346,7 @@ const char *instr_to_str(cpu_context *ctx)
         return str;
 
     case AM_A8_R:
-        snprintf(str, sizeof(str), "%s $%02X,%s", instruction_name(inst), bus_read(ctx->regs.pc - 1), rt_lookup[inst->reg_2]);
+        snprintf(str, sizeof(str), "%s $%02X,%s", instruction_name(inst), bus_peek(ctx->regs.pc - 1), rt_lookup[inst->reg_2]);
         return str;
 
     case AM_HL_SPR:
@@ -0,0 +1,241 @@
+#include <cpu.h>
+#include <bus.h>
+#include <emu.h>
+#include <timer.h>
+
+// Polling loops such as:
+//
+//     loop: LDH A, ($44)  ; LY
+//           CP $90
+//           JR NZ, loop
+//
+// only read registers that change on subsystem events. Once such a loop has
+// been seen running with a stable cycle cost, the iterations left before the
+// next event are skipped in one go: they would all read the same values and
+// leave the CPU in the very same state.
+
+#define IDLE_LOOP_MAX_BYTES 16
+#define IDLE_LOOP_MAX_OPS 8
+#define IDLE_LOOP_CONFIRMATIONS 2
+
+typedef enum
+{
+    IO_LOAD, // LD A, (polled register)
+    IO_CP,   // CP d8
+    IO_AND,  // AND d8
+    IO_BIT,  // BIT n, A
+} idle_op_type;
+
+typedef struct
+{
+    idle_op_type type;
+    u16 value;
+} idle_op;
+
+typedef enum
+{
+    IL_UNKNOWN,
+    IL_IDLE,
+    IL_BUSY,
+} idle_loop_state;
+
+typedef struct
+{
+    u16 start;
+    u16 branch;
+    u64 ticks;
+    u64 cycles;
+    u8 confirmations;
+
+    idle_loop_state state;
+    bool polls_div;
+    cond_type cond;
+    u8 op_count;
+    idle_op ops[IDLE_LOOP_MAX_OPS];
+    u8 size;
+    u8 bytes[IDLE_LOOP_MAX_BYTES];
+} idle_loop;
+
+static idle_loop loop = {0};
+
+static bool idle_polled(u16 address)
+{
+    switch (address)
+    {
+    case TIMER_DIVIDER:
+    case INTERRUPT_FLAG:
+    case 0xFF41: // STAT
+    case 0xFF44: // LY
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool idle_add(idle_op_type type, u16 value)
+{
+    if (loop.op_count >= IDLE_LOOP_MAX_OPS)
+        return false;
+
+    loop.ops[loop.op_count++] = (idle_op){type, value};
+    return true;
+}
+
+static bool idle_decode(void)
+{
+    loop.op_count = 0;
+    loop.polls_div = false;
+    loop.size = loop.branch - loop.start;
+
+    for (u16 pc = loop.start; pc <= loop.branch + 2; pc++)
+        loop.bytes[pc - loop.start] = bus_peek(pc);
+
+    u8 *code = loop.bytes;
+    u8 pc = 0;
+
+    while (pc < loop.size)
+    {
+        u16 address;
+
+        // clang-format off
+        switch (code[pc])
+        {
+        case 0xF0: address = 0xFF00 | code[pc + 1]; pc += 2; break;
+        case 0xFA: address = code[pc + 1] | (code[pc + 2] << 8); pc += 3; break;
+        case 0xFE: if (!idle_add(IO_CP, code[pc + 1])) return false; pc += 2; continue;
+        case 0xE6: if (!idle_add(IO_AND, code[pc + 1])) return false; pc += 2; continue;
+        case 0xCB:
+            if ((code[pc + 1] & 0xC7) != 0x47)
+                return false;
+            if (!idle_add(IO_BIT, (code[pc + 1] >> 3) & 0x7)) return false;
+            pc += 2;
+            continue;
+        default: return false;
+        }
+        // clang-format on
+
+        if (!idle_polled(address) || !idle_add(IO_LOAD, address))
+            return false;
+
+        loop.polls_div |= address == TIMER_DIVIDER;
+    }
+
+    // the value of A on entry must not matter.
+    return pc == loop.size && loop.op_count > 0 && loop.ops[0].type == IO_LOAD;
+}
+
+// Runs one iteration of the loop on the current register values, returns true
+// when it ends on the same A and F and jumps back.
+static bool idle_stable(cpu_context *ctx)
+{
+    for (u8 i = 0; i < loop.size + 3; i++)
+        if (bus_peek(loop.start + i) != loop.bytes[i])
+            return false;
+
+    u8 a = ctx->regs.a;
+    u8 f = cpu_read_reg(RT_F);
+
+    for (u8 i = 0; i < loop.op_count; i++)
+    {
+        u16 value = loop.ops[i].value;
+
+        // clang-format off
+        switch (loop.ops[i].type)
+        {
+        case IO_LOAD: a = bus_peek(value); break;
+        case IO_CP: f = ((u8)(a - value) == 0) << 7 | 1 << 6 | ((a & 0xF) < (value & 0xF)) << 5 | (a < value) << 4; break;
+        case IO_AND: a &= value; f = (a == 0) << 7 | 1 << 5; break;
+        case IO_BIT: f = (!BIT(a, value)) << 7 | 1 << 5 | (f & 0x10); break;
+        default: break;
+        }
+        // clang-format on
+    }
+
+    bool jump = false;
+
+    // clang-format off
+    switch (loop.cond)
+    {
+    case CT_NZ: jump = !BIT(f, 7); break;
+    case CT_Z: jump = BIT(f, 7); break;
+    case CT_NC: jump = !BIT(f, 4); break;
+    case CT_C: jump = BIT(f, 4); break;
+    default: break;
+    }
+    // clang-format on
+
+    return jump && a == ctx->regs.a && f == cpu_read_reg(RT_F);
+}
+
+static u64 idle_cycles(void)
+{
+    u64 cycles = emu_quiet_cycles();
+
+    // DIV reads only change every 256 ticks.
+    if (loop.polls_div)
+    {
+        u64 div_cycles = (0xFF - (TIMER->div & 0xFF)) / 4;
+        cycles = div_cycles < cycles ? div_cycles : cycles;
+    }
+
+    return cycles;
+}
+
+void cpu_idle_update(cpu_context *ctx, u16 branch)
+{
+    instruction *inst = ctx->current_instruction;
+    if (inst->type != IN_JR && inst->type != IN_JP)
+        return;
+
+    if (inst->cond == CT_NONE || (inst->mode != AM_D8 && inst->mode != AM_D16))
+        return;
+
+    // only taken short backward jumps can close a polling loop.
+    u16 start = ctx->regs.pc;
+    if (start > branch || branch - start > IDLE_LOOP_MAX_BYTES - 3)
+        return;
+
+    if (loop.start != start || loop.branch != branch)
+    {
+        loop = (idle_loop){.start = start, .branch = branch, .ticks = EMU->ticks, .cond = inst->cond};
+        return;
+    }
+
+    u64 cycles = (EMU->ticks - loop.ticks) / emu_ppu_ticks();
+    loop.confirmations = cycles == loop.cycles ? loop.confirmations + 1 : 0;
+    loop.cycles = cycles;
+    loop.ticks = EMU->ticks;
+
+    if (loop.confirmations < IDLE_LOOP_CONFIRMATIONS)
+        return;
+
+    if (loop.state == IL_UNKNOWN)
+        loop.state = idle_decode() ? IL_IDLE : IL_BUSY;
+
+    if (loop.state != IL_IDLE)
+        return;
+
+    // a pending interrupt is serviced right after this instruction.
+    if (ctx->int_master_enabled && (ctx->int_flags & ctx->ie_register))
+        return;
+
+    if (!idle_stable(ctx))
+        return;
+
+    u64 iterations = idle_cycles() / loop.cycles;
+    if (iterations == 0)
+        return;
+
+    emu_advance(iterations * loop.cycles);
+    loop.ticks = EMU->ticks;
+}
+
+void cpu_idle_state_save(state_stream *stream)
+{
+    STATE_PUT(stream, loop);
+}
+
+void cpu_idle_state_load(state_stream *stream)
+{
+    STATE_GET(stream, loop);
+}
@@ -18,10 +18,20 @@ static bool is_16bit(reg_type reg)
     }
 }
 
+static void lazy_flags(cpu_context *ctx, lazy_flags_op op, u8 lhs, u8 rhs, u8 carry, u8 res)
+{
+    // INC and DEC keep C, resolve whatever op set it last.
+    if ((op == LF_INC || op == LF_DEC) && ctx->flags.op != LF_NONE)
+        cpu_resolve_flags(ctx);
+
+    ctx->flags = (cpu_lazy_flags){op, lhs, rhs, carry, res};
+}
+
 static void proc_none(cpu_context *ctx)
 {
+    // the real CPU hangs on these
     printf("INVALID INSTRUCTION: 0x%02X\n", ctx->current_opcode);
-    assert(false);
+    ctx->locked = true;
 }
 
 static void proc_nop(cpu_context *ctx)
@@ -81,7 +91,7 @@ static void proc_ld(cpu_context *ctx)
 static void proc_xor(cpu_context *ctx)
 {
     ctx->regs.a ^= ctx->fetched_data & 0xFF;
-    cpu_set_flags(ctx->regs.a == 0, 0, 0, 0);
+    lazy_flags(ctx, LF_OR, 0, 0, 0, ctx->regs.a);
 }
 
 static bool check_cond(cpu_context *ctx)
@@ -207,7 +217,7 @@ static void proc_inc(cpu_context *ctx)
         return;
     }
 
-    cpu_set_flags(val == 0, 0, (val & 0x0F) == 0, -1);
+    lazy_flags(ctx, LF_INC, 0, 0, 0, val);
 }
 
 static void proc_dec(cpu_context *ctx)
@@ -233,23 +243,31 @@ static void proc_dec(cpu_context *ctx)
     if ((ctx->current_opcode & 0x0B) == 0x0B)
         return;
 
-    cpu_set_flags(value == 0, 1, (value & 0x0F) == 0x0F, -1);
+    lazy_flags(ctx, LF_DEC, 0, 0, 0, value);
 }
 
 static void proc_adc(cpu_context *ctx)
 {
-    u16 u = ctx->fetched_data;
-    u16 a = ctx->regs.a;
-    u16 c = CPU_FLAG_C(ctx);
-
-    u16 value = a + u + c;
-    ctx->regs.a = value & 0xFF;
+    u8 u = ctx->fetched_data;
+    u8 a = ctx->regs.a;
+    u8 c = CPU_FLAG_C(ctx);
 
-    cpu_set_flags(ctx->regs.a == 0, 0, (a & 0x0F) + (u & 0x0F) + c > 0x0F, value > 0xFF);
+    ctx->regs.a = a + u + c;
+    lazy_flags(ctx, LF_ADD, a, u, c, ctx->regs.a);
 }
 
 static void proc_add(cpu_context *ctx)
 {
+    if (ctx->current_instruction->reg_1 == RT_A)
+    {
+        u8 a = ctx->regs.a;
+        u8 u = ctx->fetched_data;
+
+        ctx->regs.a = a + u;
+        lazy_flags(ctx, LF_ADD, a, u, 0, ctx->regs.a);
+        return;
+    }
+
     u32 value = cpu_read_reg(ctx->current_instruction->reg_1) + ctx->fetched_data;
 
     bool is16 = is_16bit(ctx->current_instruction->reg_1);
@@ -283,36 +301,27 @@ static void proc_add(cpu_context *ctx)
 
 static void proc_sub(cpu_context *ctx)
 {
-    u8 value = ctx->regs.a - ctx->fetched_data;
+    u8 a = ctx->regs.a;
+    u8 u = ctx->fetched_data;
 
-    u8 zflag = (value & 0xFF) == 0;
-    u8 hflag = (ctx->regs.a & 0x0F) < (ctx->fetched_data & 0x0F);
-    u8 cflag = (ctx->regs.a & 0xFF) < (ctx->fetched_data & 0xFF);
-
-    ctx->regs.a = value & 0xFF;
-    cpu_set_flags(zflag, 1, hflag, cflag);
+    ctx->regs.a = a - u;
+    lazy_flags(ctx, LF_SUB, a, u, 0, ctx->regs.a);
 }
 
 static void proc_sbc(cpu_context *ctx)
 {
-    u16 u = ctx->fetched_data;
-    u16 a = cpu_read_reg(ctx->current_instruction->reg_1);
-    u16 c = CPU_FLAG_C(ctx);
-
-    u16 value = a - u - c;
-    cpu_write_reg(ctx->current_instruction->reg_1, value & 0xFFFF);
-
-    u8 zflag = (value & 0xFF) == 0;
-    u8 hflag = (a & 0x0F) < (u & 0x0F) + c;
-    u8 cflag = (a & 0xFF) < (u & 0xFF) + c;
+    u8 u = ctx->fetched_data;
+    u8 a = ctx->regs.a;
+    u8 c = CPU_FLAG_C(ctx);
 
-    cpu_set_flags(zflag, 1, hflag, cflag);
+    ctx->regs.a = a - u - c;
+    lazy_flags(ctx, LF_SUB, a, u, c, ctx->regs.a);
 }
 
 static void proc_and(cpu_context *ctx)
 {
     ctx->regs.a &= ctx->fetched_data & 0xFF;
-    cpu_set_flags(ctx->regs.a == 0, 0, 1, 0);
+    lazy_flags(ctx, LF_AND, 0, 0, 0, ctx->regs.a);
 }
 
 static void proc_or(cpu_context *ctx)
@@ -320,20 +329,15 @@ static void proc_or(cpu_context *ctx)
     assert(ctx->current_instruction->reg_1 == RT_A);
 
     ctx->regs.a |= ctx->fetched_data & 0xFF;
-    cpu_set_flags(ctx->regs.a == 0, 0, 0, 0);
+    lazy_flags(ctx, LF_OR, 0, 0, 0, ctx->regs.a);
 }
 
 static void proc_cp(cpu_context *ctx)
 {
     assert(ctx->current_instruction->reg_1 == RT_A);
 
-    int16_t value = (int16_t)ctx->regs.a - (int16_t)ctx->fetched_data;
-
-    u8 zflag = (value & 0xFF) == 0;
-    u8 hflag = (int16_t)(ctx->regs.a & 0x0F) < (int16_t)(ctx->fetched_data & 0x0F);
-    u8 cflag = (int16_t)(ctx->regs.a & 0xFF) < (int16_t)(ctx->fetched_data & 0xFF);
-
-    cpu_set_flags(zflag, 1, hflag, cflag);
+    u8 u = ctx->fetched_data;
+    lazy_flags(ctx, LF_SUB, ctx->regs.a, u, 0, ctx->regs.a - u);
 }
 
 reg_type rt_lookup[] = {
@@ -513,6 +517,10 @@ static void proc_rra(cpu_context *ctx)
 
 static void proc_stop(cpu_context *ctx)
 {
+    // on CGB a STOP with KEY1 armed only switches the CPU speed
+    if (emu_speed_switch())
+        return;
+
     ctx->halted = true;
     // NO_IMPL();
 }
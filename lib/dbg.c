@@ -1,18 +1,17 @@
 #include <dbg.h>
-#include <bus.h>
+#include <emu.h>
 
 static char dbg_message[1024] = {0};
 static u64 dbg_size = 0;
 
-void dbg_update(void)
+void dbg_serial(u8 value)
 {
-    if (bus_read(SERIAL_TRANSFER_CONTROL) == 0x81)
-    {
-        char c = bus_read(SERIAL_TRANSFER_DATA);
-        dbg_message[dbg_size++] = c;
-        dbg_message[dbg_size] = '\0';
-        bus_write(SERIAL_TRANSFER_CONTROL, 0x00);
-    }
+    // run-ahead would print the same characters again
+    if (EMU->hidden || dbg_size >= sizeof(dbg_message) - 1)
+        return;
+
+    dbg_message[dbg_size++] = value;
+    dbg_message[dbg_size] = '\0';
 }
 
 void dbg_print(void)
@@ -1,43 +1,104 @@
 #include <dma.h>
 #include <ppu.h>
 #include <bus.h>
+#include <emu.h>
+#include <trace.h>
+#include <render.h>
+
+// OAM DMA is a timed event: after a 2 cycles delay one byte lands in OAM per
+// cycle. Nothing is copied while it runs, dma_sync catches OAM up with the
+// bytes that would have been transferred by now, either when somebody looks
+// at OAM or when the transfer completes.
+
+#define DMA_DELAY 2
+#define DMA_LENGTH 0xA0 // 160 bytes
 
 typedef struct
 {
     bool active;
-    u8 byte;
     u8 value;
-    u8 start_delay;
+    u8 copied;       // bytes already in OAM
+    u64 start;       // tick of the write to the DMA register
+    u64 end;         // tick of the last byte
+    u32 cycle_ticks; // 2 in CGB double speed, the transfer follows the CPU
+    u64 trace_start;
 } dma_context;
 
 static dma_context ctx = {0};
 
+static void dma_copy(u8 from, u8 to)
+{
+    u16 source = ctx.value * 0x100;
+    const u8 *page = bus_page(source);
+    u8 *oam = (u8 *)PPU->oam_ram;
+
+    if (page)
+        memcpy(oam + from, page + from, to - from);
+    else
+        for (u8 i = from; i < to; i++)
+            oam[i] = bus_peek(source + i);
+
+    if (render_active)
+        for (u8 i = from; i < to; i++)
+            render_write(ADDR_OAM_START + i, oam[i]);
+
+    ctx.copied = to;
+}
+
+void dma_sync(void)
+{
+    if (!ctx.active)
+        return;
+
+    // the PPU ticks before dma_tick within a cycle, it sees one byte less on
+    // the tick ending the cycle.
+    u64 elapsed = EMU->ticks - ctx.start;
+    u64 cycles = elapsed ? (elapsed - 1) / ctx.cycle_ticks : 0;
+    u8 count = cycles <= DMA_DELAY ? 0 : cycles - DMA_DELAY;
+
+    if (count > DMA_LENGTH)
+        count = DMA_LENGTH;
+
+    if (count > ctx.copied)
+        dma_copy(ctx.copied, count);
+}
+
 void dma_start(u8 start)
 {
+    // a restart keeps what the previous transfer already wrote
+    dma_sync();
+
     ctx.active = true;
-    ctx.byte = 0;
-    ctx.start_delay = 2; // we start after 2 cycles
     ctx.value = start;
+    ctx.copied = 0;
+    ctx.start = EMU->ticks;
+    ctx.cycle_ticks = emu_ppu_ticks();
+    ctx.end = ctx.start + (DMA_DELAY + DMA_LENGTH) * ctx.cycle_ticks;
+    ctx.trace_start = TRACE_NOW();
 }
 
 void dma_tick(void)
 {
-    if (!ctx.active)
-        return;
-
-    if (ctx.start_delay > 0)
-    {
-        ctx.start_delay--;
+    if (!ctx.active || EMU->ticks < ctx.end)
         return;
-    }
 
-    ppu_oam_write(ctx.byte | ADDR_OAM_START, bus_read((ctx.value * 0x100) + ctx.byte));
+    dma_copy(ctx.copied, DMA_LENGTH);
+    ctx.active = false;
 
-    ctx.byte++;
-    ctx.active = ctx.byte < 0xA0; // 160 bytes
+    TRACE_COMPLETE(TRACK_DMA, "dma", ctx.trace_start, ctx.value);
 }
 
 bool dma_transfering(void)
 {
     return ctx.active;
 }
+
+void dma_state_save(state_stream *stream)
+{
+    STATE_PUT(stream, ctx);
+}
+
+void dma_state_load(state_stream *stream)
+{
+    STATE_GET(stream, ctx);
+}
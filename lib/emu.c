@@ -1,37 +1,130 @@
 #include <emu.h>
+#include <emu_cycle.h>
 #include <cart.h>
 #include <cpu.h>
 #include <ui.h>
 #include <timer.h>
 #include <dma.h>
 #include <ppu.h>
+#include <jit.h>
+#include <apu.h>
+#include <audio.h>
+#include <pacer.h>
+#include <gamepad.h>
+#include <movie.h>
+#include <prof.h>
+#include <trace.h>
+#include <bus.h>
+#include <ram.h>
+#include <hdma.h>
+#include <render.h>
+#include <state.h>
+#include <serial.h>
+#include <link.h>
+#include <recorder.h>
 
 #include <stdio.h>
+#include <getopt.h>
 #include <pthread.h>
 #include <unistd.h>
 
 static emu_context ctx;
+static state_snapshot *ahead_snapshot = NULL;
 
 emu_context *emu_get_context(void)
 {
     return &ctx;
 }
 
+// only the machine, the options and the run state belong to the host.
+void emu_state_save(state_stream *stream)
+{
+    STATE_PUT(stream, ctx.ticks);
+    STATE_PUT(stream, ctx.cgb);
+    STATE_PUT(stream, ctx.double_speed);
+    STATE_PUT(stream, ctx.speed_armed);
+    STATE_PUT(stream, ctx.stall);
+}
+
+void emu_state_load(state_stream *stream)
+{
+    STATE_GET(stream, ctx.ticks);
+    STATE_GET(stream, ctx.cgb);
+    STATE_GET(stream, ctx.double_speed);
+    STATE_GET(stream, ctx.speed_armed);
+    STATE_GET(stream, ctx.stall);
+}
+
 void emu_init(void)
 {
+    ctx.cgb = cart_cgb() && (!ctx.force_dmg || cart_cgb_only());
+    ctx.double_speed = false;
+    ctx.speed_armed = false;
+    ctx.stall = 0;
+
+    bus_init();
+    cart_map();
+    ram_init();
     timer_init();
     cpu_init();
     ppu_init();
+    gamepad_init();
+    serial_init();
 
     ctx.running = true;
     ctx.paused = false;
     ctx.ticks = 0;
+
+    apu_init();
+    hdma_init();
+
+    // sized for the cartridge, made again on the first run-ahead
+    state_destroy(ahead_snapshot);
+    ahead_snapshot = NULL;
+}
+
+// Run-ahead hides the frames of latency games put between a joypad read and
+// the picture: each frame the machine is saved, run `run_ahead` frames
+// further with the buttons held now, and restored. Only the last of those
+// frames is drawn, the machine itself never produces pixels.
+void emu_run_ahead(void)
+{
+    if (!ahead_snapshot)
+        ahead_snapshot = state_create();
+
+    u64 start = TRACE_NOW();
+
+    state_save(ahead_snapshot);
+    ctx.hidden = true;
+
+    u32 target = PPU->current_frame + ctx.run_ahead;
+
+    while (PPU->current_frame < target)
+    {
+        PFC->timing_only = PPU->current_frame + 1 < target;
+
+        if (!cpu_step())
+            break;
+    }
+
+    PFC->timing_only = true;
+    ctx.hidden = false;
+    state_load(ahead_snapshot);
+    ctx.shown++;
+
+    TRACE_COMPLETE(TRACK_THREAD, "run-ahead", start, ctx.run_ahead);
 }
 
 void *cpu_run(void *data)
 {
     ((void)data);
 
+    PROF_SWITCH(PROF_CPU);
+    trace_set_thread_name("emulation");
+
+    u32 frame = PPU->current_frame;
+    PFC->timing_only = ctx.run_ahead > 0;
+
     while (ctx.running)
     {
         if (ctx.paused)
@@ -45,34 +138,223 @@ void *cpu_run(void *data)
             // printf("BREAK\n");
         }
 
+        // the linked peer keeps its own frame count
+        if (ctx.frame_limit && !ctx.hidden && PPU->current_frame >= ctx.frame_limit)
+        {
+            ctx.die = true;
+            return NULL;
+        }
+
         if (!cpu_step())
         {
             printf("CPU Stopped\n");
+            ctx.die = true;
             return NULL;
         }
+
+        if (link_active)
+            link_update();
+
+        if (ctx.run_ahead && PPU->current_frame != frame)
+        {
+            frame = PPU->current_frame;
+            emu_run_ahead();
+        }
     }
 
     return NULL;
 }
 
+// the frame the window should show, once it is complete
+static u32 emu_shown_frame(void)
+{
+    if (render_active)
+        return render_get_frame();
+
+    if (ctx.run_ahead)
+        return ctx.shown;
+
+    if (link_active)
+        return link_frame();
+
+    return PPU->current_frame;
+}
+
+static void emu_usage(const char *name)
+{
+    printf("Usage: %s [options] <rom>\n", name);
+    printf("\t <rom> can be a plain file, gzip or zip\n");
+    printf("\t --no-idle-skip  : run polling loops cycle by cycle\n");
+    printf("\t --timing=<mode> : accurate (default) or fast, the machine catching up per instruction\n");
+    printf("\t --jit           : translate basic blocks to native code\n");
+    printf("\t --audio=<sink>  : sdl (default), null or wav:<path>\n");
+    printf("\t --record=<file> : record the joypad to a movie\n");
+    printf("\t --replay=<file> : play the joypad back from a movie\n");
+    printf("\t --frames=<n>    : quit after n frames (default: end of the replay)\n");
+    printf("\t --headless      : run without a window, null audio by default\n");
+    printf("\t --turbo         : run as fast as possible\n");
+    printf("\t --stats[=<file>]: print host time per subsystem, JSON at exit\n");
+    printf("\t --trace=<file>  : write a Chrome/Perfetto trace at exit\n");
+    printf("\t --dmg           : run Game Boy Color cartridges as DMG when they allow it\n");
+    printf("\t --render-thread : draw pixels on a separate thread, one frame behind\n");
+    printf("\t --run-ahead=<n> : show the frame n frames ahead to hide input lag\n");
+    printf("\t --link          : plug a second machine running the same cartridge\n");
+    printf("\t --video=<spec>  : capture to y4m:<path> or raw:<path> (RGB24), FIFOs work\n");
+}
+
 int emu_run(int argc, char **argv)
 {
-    if (argc < 2)
+    static const struct option options[] = {
+        {"no-idle-skip", no_argument, NULL, 'I'},
+        {"timing", required_argument, NULL, 'M'},
+        {"jit", no_argument, NULL, 'J'},
+        {"audio", required_argument, NULL, 'A'},
+        {"record", required_argument, NULL, 'R'},
+        {"replay", required_argument, NULL, 'P'},
+        {"frames", required_argument, NULL, 'F'},
+        {"headless", no_argument, NULL, 'H'},
+        {"turbo", no_argument, NULL, 'T'},
+        {"stats", optional_argument, NULL, 'S'},
+        {"trace", required_argument, NULL, 'X'},
+        {"dmg", no_argument, NULL, 'D'},
+        {"render-thread", no_argument, NULL, 'G'},
+        {"run-ahead", required_argument, NULL, 'N'},
+        {"link", no_argument, NULL, 'L'},
+        {"video", required_argument, NULL, 'V'},
+        {NULL, 0, NULL, 0},
+    };
+
+    ctx.idle_skip = true;
+
+    const char *audio = NULL;
+    const char *record = NULL;
+    const char *replay = NULL;
+    const char *stats = NULL;
+    const char *trace = NULL;
+    const char *video = NULL;
+    const char *timing = "accurate";
+    bool profile = false;
+    bool render = false;
+    bool link = false;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        // clang-format off
+        switch (opt)
+        {
+        case 'I': ctx.idle_skip = false; break;
+        case 'M': timing = optarg; break;
+        case 'J': ctx.jit = true; break;
+        case 'A': audio = optarg; break;
+        case 'R': record = optarg; break;
+        case 'P': replay = optarg; break;
+        case 'F': ctx.frame_limit = strtoul(optarg, NULL, 0); break;
+        case 'H': ctx.headless = true; break;
+        case 'T': ctx.turbo = true; break;
+        case 'S': profile = true; stats = optarg; break;
+        case 'X': trace = optarg; break;
+        case 'D': ctx.force_dmg = true; break;
+        case 'G': render = true; break;
+        case 'N': ctx.run_ahead = strtoul(optarg, NULL, 0); break;
+        case 'L': link = true; break;
+        case 'V': video = optarg; break;
+        default: emu_usage(argv[0]); return -1;
+        }
+        // clang-format on
+    }
+
+    if (strcmp(timing, "fast") == 0)
+        ctx.timing = TIMING_FAST;
+    else if (strcmp(timing, "accurate") != 0)
     {
-        printf("Usage: %s <rom>\n", argv[0]);
+        printf("Invalid timing: %s\n", timing);
         return -1;
     }
 
-    if (!cart_load(argv[1]))
+    if (ctx.jit && !jit_available())
     {
-        printf("Failed to load ROM file: %s\n", argv[1]);
+        printf("JIT not available in this build, using the interpreter\n");
+        ctx.jit = false;
+    }
+
+    if (optind >= argc)
+    {
+        emu_usage(argv[0]);
+        return -1;
+    }
+
+    const char *rom = argv[optind];
+
+    if (!cart_load(rom))
+    {
+        printf("Failed to load ROM file: %s\n", rom);
         return -2;
     }
 
     printf("Cart loaded..\n");
 
     emu_init();
-    ui_init();
+
+    if (!ctx.headless)
+        ui_init();
+
+    if (!audio)
+        audio = ctx.headless ? "null" : "sdl";
+
+    if (!audio_init(audio))
+    {
+        printf("Invalid audio sink: %s\n", audio);
+        return -1;
+    }
+
+    if (video && !recorder_init(video))
+    {
+        printf("Invalid video capture: %s\n", video);
+        return -1;
+    }
+
+    if (record && !movie_start_record(record))
+        return -2;
+
+    if (replay)
+    {
+        if (!movie_start_replay(replay))
+            return -2;
+
+        if (!ctx.frame_limit)
+            ctx.frame_limit = movie_length();
+    }
+
+    if (!ctx.turbo)
+        pacer_init();
+
+    if (profile)
+        prof_init();
+
+    if (trace)
+    {
+        trace_init();
+        trace_set_thread_name("ui");
+    }
+
+    if (link && ctx.run_ahead)
+    {
+        printf("Run-ahead would replay the linked peer too, ignoring --run-ahead\n");
+        ctx.run_ahead = 0;
+    }
+
+    if (render && (ctx.run_ahead || link))
+    {
+        printf("Run-ahead and the link draw on the emulation thread, ignoring --render-thread\n");
+        render = false;
+    }
+
+    if (link)
+        link_init(LINK_QUANTUM);
+
+    if (render)
+        render_init();
 
     pthread_t cpu_thread;
     if (pthread_create(&cpu_thread, NULL, cpu_run, NULL))
@@ -87,29 +369,258 @@ int emu_run(int argc, char **argv)
     while (!ctx.die)
     {
         usleep(1000);
+
+        if (ctx.headless)
+            continue;
+
         ui_handle_events();
 
-        if (prev_frame != PPU->current_frame)
+        u32 frame = emu_shown_frame();
+
+        if (prev_frame != frame)
         {
-            prev_frame = PPU->current_frame;
+            prev_frame = frame;
+
+            prof_slot slot = PROF_SWITCH(PROF_UI);
+            u64 start = TRACE_NOW();
+
             ui_update();
+
+            TRACE_COMPLETE(TRACK_THREAD, "present", start, prev_frame);
+            PROF_RESTORE(slot);
         }
     }
 
+    ctx.running = false;
+    pthread_join(cpu_thread, NULL);
+    render_stop();
+    link_stop();
+    recorder_stop();
+
+    if (profile)
+        prof_dump_json(stats);
+
+    pacer_stop();
+    movie_stop();
+    audio_close();
+    cart_battery_flush();
+
+    if (trace)
+        trace_dump(trace);
+
     return 0;
 }
 
 void emu_cycles(u64 cpu_cycles)
+{
+    if (ctx.deferring)
+    {
+        ctx.deferred += cpu_cycles;
+        return;
+    }
+
+    // the CPU runs alone (see bus_flat)
+    if (bus_flat_active)
+    {
+        ctx.ticks += cpu_cycles * 4;
+        return;
+    }
+
+    if (prof_active)
+    {
+        prof_cycles(cpu_cycles);
+        return;
+    }
+
+    if (ctx.double_speed)
+    {
+        emu_cycles_double(cpu_cycles);
+        return;
+    }
+
+    for (u64 i = 0; i < cpu_cycles; i++)
+        emu_cycle(&ctx, false);
+}
+
+// in double speed the timer follows the CPU, the PPU keeps its 4 MHz clock.
+void emu_cycles_double(u64 cpu_cycles)
 {
     for (u64 i = 0; i < cpu_cycles; i++)
     {
-        for (u8 n = 0; n < 4; n++)
+        for (u8 n = 0; n < 2; n++)
         {
             ctx.ticks++;
             timer_tick();
+            timer_tick();
             ppu_tick();
         }
 
         dma_tick();
+        serial_tick();
+    }
+}
+
+u8 emu_speed_read(void)
+{
+    return (ctx.double_speed << 7) | 0x7E | ctx.speed_armed;
+}
+
+void emu_speed_write(u8 value)
+{
+    ctx.speed_armed = value & 1;
+}
+
+bool emu_speed_switch(void)
+{
+    if (!ctx.cgb || !ctx.speed_armed)
+        return false;
+
+    ctx.double_speed = !ctx.double_speed;
+    ctx.speed_armed = false;
+    timer_write(TIMER_DIVIDER, 0);
+
+    return true;
+}
+
+// ppu ticks per cpu cycle
+u32 emu_ppu_ticks(void)
+{
+    return ctx.double_speed ? 2 : 4;
+}
+
+// a serial transfer ending or the link handing over stops skips too
+static u64 emu_bound_cycles(u64 cycles)
+{
+    u64 serial_cycles = serial_idle_ticks() / emu_ppu_ticks();
+    cycles = serial_cycles < cycles ? serial_cycles : cycles;
+
+    if (!link_active)
+        return cycles;
+
+    u64 link_cycles = link_idle_ticks() / emu_ppu_ticks();
+    return link_cycles < cycles ? link_cycles : cycles;
+}
+
+u64 emu_idle_cycles(void)
+{
+    if (dma_transfering())
+        return 0;
+
+    u32 timer_cycles = timer_idle_ticks() / 4;
+    u32 ppu_cycles = ppu_idle_ticks() / emu_ppu_ticks();
+
+    return emu_bound_cycles(timer_cycles < ppu_cycles ? timer_cycles : ppu_cycles);
+}
+
+u64 emu_quiet_cycles(void)
+{
+    u32 timer_cycles = timer_idle_ticks() / 4;
+    u32 ppu_cycles = ppu_quiet_ticks() / emu_ppu_ticks();
+
+    return emu_bound_cycles(timer_cycles < ppu_cycles ? timer_cycles : ppu_cycles);
+}
+
+void emu_skip(u64 cpu_cycles)
+{
+    u32 ticks = cpu_cycles * emu_ppu_ticks();
+    prof_slot slot = PROF_SWITCH(PROF_SYSTEM);
+
+    ctx.ticks += ticks;
+    timer_skip(cpu_cycles * 4);
+    ppu_skip(ticks);
+
+    PROF_RESTORE(slot);
+}
+
+void emu_advance(u64 cpu_cycles)
+{
+    if (bus_flat_active)
+    {
+        emu_cycles(cpu_cycles);
+        return;
+    }
+
+    while (cpu_cycles > 0)
+    {
+        u64 idle = emu_idle_cycles();
+
+        if (idle == 0)
+        {
+            emu_cycles(1);
+            cpu_cycles--;
+            continue;
+        }
+
+        idle = idle < cpu_cycles ? idle : cpu_cycles;
+        emu_skip(idle);
+        cpu_cycles -= idle;
+    }
+}
+
+// The timer only talks to the CPU, it catches up on its own. The PPU skips
+// the spans where it only counts ticks and runs tick by tick otherwise.
+static void emu_catch_up(u64 cpu_cycles)
+{
+    // OAM DMA races the PPU for OAM, double speed splits the clocks
+    if (prof_active || ctx.double_speed || dma_transfering())
+    {
+        emu_cycles(cpu_cycles);
+        return;
+    }
+
+    timer_run(cpu_cycles * 4);
+
+    while (cpu_cycles > 0)
+    {
+        u64 idle = emu_bound_cycles(ppu_idle_ticks() / 4);
+
+        if (idle > 0)
+        {
+            idle = idle < cpu_cycles ? idle : cpu_cycles;
+            ctx.ticks += idle * 4;
+            ppu_skip(idle * 4);
+            cpu_cycles -= idle;
+            continue;
+        }
+
+        for (u8 n = 0; n < 4; n++)
+        {
+            ctx.ticks++;
+            ppu_tick();
+        }
+
+        serial_tick();
+        cpu_cycles--;
     }
 }
+
+// Fast timing runs an instruction first and the rest of the machine after
+// it, in one go instead of interleaving each M-cycle. The bus syncs before
+// I/O, VRAM writes and OAM, so the machine sees the CPU's accesses on the
+// same cycles as in accurate mode. What it loses: OAM DMA no longer
+// interleaves with the CPU's other memory accesses, and a recompiled block
+// only notices an interrupt at its end or at its next I/O access.
+void emu_defer_begin(void)
+{
+    ctx.deferring = true;
+}
+
+void emu_defer_end(void)
+{
+    u64 cycles = ctx.deferred;
+
+    ctx.deferring = false;
+    ctx.deferred = 0;
+
+    if (cycles)
+        emu_catch_up(cycles);
+}
+
+void emu_sync(void)
+{
+    if (!ctx.deferred)
+        return;
+
+    emu_defer_end();
+    ctx.deferring = true;
+}
@@ -1,23 +1,36 @@
 #include <gamepad.h>
+#include <movie.h>
+#include <emu.h>
+#include <link.h>
 #include <string.h>
 
 #undef GAMEPAD
-#define GAMEPAD ctx.controller
+#define GAMEPAD ctx.latched
+
+// `controller` is updated by the UI thread at any time. The joypad register
+// reads `latched`, which only changes at the start of a frame, either from
+// `controller` or from the movie being replayed.
 
 typedef struct
 {
     bool select_action;
     bool select_direction;
     gamepad_state controller;
+    gamepad_state latched;
 } gamepad_context;
 
 static gamepad_context ctx = {0};
 
+void gamepad_init(void)
+{
+    memset(&ctx, 0, sizeof(ctx));
+}
+
 void gamepad_write(u8 value)
 {
     ctx.select_action = BIT(value, 5) == 0;
+    // selecting both reads the two groups at once, games use it to wait for any key
     ctx.select_direction = BIT(value, 4) == 0;
-    assert(!ctx.select_action || !ctx.select_direction);
 }
 
 gamepad_state *gamepad_get_state(void)
@@ -25,6 +38,46 @@ gamepad_state *gamepad_get_state(void)
     return &ctx.controller;
 }
 
+u8 gamepad_buttons(const gamepad_state *state)
+{
+    return state->a << 0 | state->b << 1 | state->select << 2 | state->start << 3 |
+           state->right << 4 | state->left << 5 | state->up << 6 | state->down << 7;
+}
+
+void gamepad_set_buttons(gamepad_state *state, u8 buttons)
+{
+    state->a = BIT(buttons, 0);
+    state->b = BIT(buttons, 1);
+    state->select = BIT(buttons, 2);
+    state->start = BIT(buttons, 3);
+    state->right = BIT(buttons, 4);
+    state->left = BIT(buttons, 5);
+    state->up = BIT(buttons, 6);
+    state->down = BIT(buttons, 7);
+}
+
+void gamepad_latch(u32 frame)
+{
+    u8 buttons;
+
+    // nobody holds the machine on the other end of the cable
+    if (link_peer())
+    {
+        gamepad_set_buttons(&ctx.latched, 0);
+        return;
+    }
+
+    if (!movie_replay(frame, &buttons))
+    {
+        buttons = gamepad_buttons(&ctx.controller);
+
+        if (!EMU->hidden)
+            movie_record(frame, buttons);
+    }
+
+    gamepad_set_buttons(&ctx.latched, buttons);
+}
+
 u8 gamepad_read(void)
 {
     u8 output = 0xCF; // 0b11001111
@@ -49,3 +102,18 @@ u8 gamepad_read(void)
 
     return output;
 }
+
+// the controller is live input, only what the game has seen is saved.
+void gamepad_state_save(state_stream *stream)
+{
+    STATE_PUT(stream, ctx.select_action);
+    STATE_PUT(stream, ctx.select_direction);
+    STATE_PUT(stream, ctx.latched);
+}
+
+void gamepad_state_load(state_stream *stream)
+{
+    STATE_GET(stream, ctx.select_action);
+    STATE_GET(stream, ctx.select_direction);
+    STATE_GET(stream, ctx.latched);
+}
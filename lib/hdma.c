@@ -0,0 +1,123 @@
+#include <hdma.h>
+#include <ppu.h>
+#include <bus.h>
+#include <emu.h>
+#include <render.h>
+
+// CGB VRAM DMA (HDMA1-5). Data moves by blocks of 16 bytes, each one is a
+// single memcpy from the source page followed by the cycles the CPU loses:
+// a general purpose transfer copies everything at once when HDMA5 is
+// written, an HBlank transfer copies one block per visible line.
+
+#define HDMA_BLOCK 0x10
+
+typedef struct
+{
+    u16 source;
+    u16 dest;     // offset in VRAM
+    u8 remaining; // blocks left - 1, as read back from HDMA5
+    bool hblank;  // HBlank transfer running
+} hdma_context;
+
+static hdma_context ctx;
+
+void hdma_init(void)
+{
+    ctx.source = 0;
+    ctx.dest = 0;
+    ctx.remaining = 0x7F;
+    ctx.hblank = false;
+}
+
+// 8 cycles per block in normal speed, twice as many in double speed.
+static u32 hdma_block_cycles(void)
+{
+    return EMU->double_speed ? 16 : 8;
+}
+
+static void hdma_copy_block(void)
+{
+    const u8 *page = bus_page(ctx.source);
+    u8 *vram = ppu_vram();
+
+    if (page)
+        memcpy(vram + ctx.dest, page + (ctx.source & 0xFF), HDMA_BLOCK);
+    else
+        for (u8 i = 0; i < HDMA_BLOCK; i++)
+            vram[ctx.dest + i] = bus_peek(ctx.source + i);
+
+    if (render_active)
+        for (u8 i = 0; i < HDMA_BLOCK; i++)
+            render_write(ADDR_VRAM_START + ctx.dest + i, vram[ctx.dest + i]);
+
+    ctx.source += HDMA_BLOCK;
+    ctx.dest = (ctx.dest + HDMA_BLOCK) & 0x1FF0;
+    ctx.remaining = (ctx.remaining - 1) & 0x7F;
+}
+
+u8 hdma_read(u16 address)
+{
+    if (address != HDMA_END)
+        return 0xFF;
+
+    // bit 7 is clear while an HBlank transfer is running
+    return (ctx.hblank ? 0x00 : 0x80) | (ctx.remaining & 0x7F);
+}
+
+void hdma_write(u16 address, u8 value)
+{
+    // clang-format off
+    switch (address)
+    {
+    case 0xFF51: ctx.source = (ctx.source & 0x00FF) | value << 8; return;
+    case 0xFF52: ctx.source = (ctx.source & 0xFF00) | (value & 0xF0); return;
+    case 0xFF53: ctx.dest = (ctx.dest & 0x00FF) | (value & 0x1F) << 8; return;
+    case 0xFF54: ctx.dest = (ctx.dest & 0x1F00) | (value & 0xF0); return;
+    }
+    // clang-format on
+
+    if (ctx.hblank && !BIT(value, 7))
+    {
+        // cancel, the remaining length stays readable
+        ctx.hblank = false;
+        return;
+    }
+
+    ctx.remaining = value & 0x7F;
+
+    if (BIT(value, 7))
+    {
+        ctx.hblank = true;
+        return;
+    }
+
+    u32 blocks = ctx.remaining + 1;
+
+    for (u32 i = 0; i < blocks; i++)
+        hdma_copy_block();
+
+    emu_cycles(blocks * hdma_block_cycles());
+}
+
+void hdma_hblank(void)
+{
+    if (!ctx.hblank)
+        return;
+
+    hdma_copy_block();
+    EMU->stall += hdma_block_cycles();
+
+    // remaining wraps to 0x7F after the last block
+    if (ctx.remaining == 0x7F)
+        ctx.hblank = false;
+}
+
+void hdma_state_save(state_stream *stream)
+{
+    STATE_PUT(stream, ctx);
+}
+
+void hdma_state_load(state_stream *stream)
+{
+    STATE_GET(stream, ctx);
+}
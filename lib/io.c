@@ -4,19 +4,20 @@
 #include <dma.h>
 #include <lcd.h>
 #include <gamepad.h>
-
-static char serial_data[2];
+#include <apu.h>
+#include <emu.h>
+#include <ppu.h>
+#include <ram.h>
+#include <hdma.h>
+#include <serial.h>
 
 u8 io_read(u16 address)
 {
     if (address == JOYPAD)
         return gamepad_read();
 
-    if (address == SERIAL_TRANSFER_DATA)
-        return serial_data[0];
-
-    if (address == SERIAL_TRANSFER_CONTROL)
-        return serial_data[1];
+    if (BETWEEN(address, SERIAL_TRANSFER_DATA, SERIAL_TRANSFER_CONTROL))
+        return serial_read(address);
 
     if (BETWEEN(address, TIMER_DIVIDER, TIMER_CONTROL))
         return timer_read(address);
@@ -27,9 +28,19 @@ u8 io_read(u16 address)
     if (address == INTERRUPT_FLAG)
         return cpu_get_int_flags();
 
-    // ignore sound
-    if (BETWEEN(address, 0xFF10, 0xFF3F))
-        return 0;
+    if (BETWEEN(address, APU_START, APU_END))
+        return apu_read(address);
+
+    if (EMU->cgb)
+    {
+        // clang-format off
+        if (address == SPEED_SWITCH)                          return emu_speed_read();
+        if (address == VRAM_BANK)                             return ppu_vram_bank_read();
+        if (BETWEEN(address, HDMA_START, HDMA_END))           return hdma_read(address);
+        if (BETWEEN(address, ADDR_CRAM_START, ADDR_CRAM_END)) return lcd_cram_read(address);
+        if (address == WRAM_BANK)                             return wram_bank_read();
+        // clang-format on
+    }
 
     printf("UNSUPPORTED bus_read(%04X)\n", address);
     return 0;
@@ -43,15 +54,9 @@ void io_write(u16 address, u8 value)
         return;
     }
 
-    if (address == SERIAL_TRANSFER_DATA)
-    {
-        serial_data[0] = value;
-        return;
-    }
-
-    if (address == SERIAL_TRANSFER_CONTROL)
+    if (BETWEEN(address, SERIAL_TRANSFER_DATA, SERIAL_TRANSFER_CONTROL))
     {
-        serial_data[1] = value;
+        serial_write(address, value);
         return;
     }
 
@@ -73,11 +78,22 @@ void io_write(u16 address, u8 value)
         return;
     }
 
-    // ignore sound
-    if (BETWEEN(address, 0xFF10, 0xFF3F))
+    if (BETWEEN(address, APU_START, APU_END))
     {
+        apu_write(address, value);
         return;
     }
 
+    if (EMU->cgb)
+    {
+        // clang-format off
+        if (address == SPEED_SWITCH)                          { emu_speed_write(value); return; }
+        if (address == VRAM_BANK)                             { ppu_vram_bank_write(value); return; }
+        if (BETWEEN(address, HDMA_START, HDMA_END))           { hdma_write(address, value); return; }
+        if (BETWEEN(address, ADDR_CRAM_START, ADDR_CRAM_END)) { lcd_cram_write(address, value); return; }
+        if (address == WRAM_BANK)                             { wram_bank_write(value); return; }
+        // clang-format on
+    }
+
     printf("UNSUPPORTED bus_write(%04X)\n", address);
 }
@@ -0,0 +1,562 @@
+#include <jit.h>
+#include <cpu.h>
+#include <bus.h>
+#include <cart.h>
+#include <emu.h>
+
+// Basic blocks are translated to x86-64 code that keeps the cpu_context in
+// rbx and strings together:
+//
+//  - plain register moves, emitted inline,
+//  - calls into the processors of cpu_proc.c for everything else.
+//
+// The cycles of instructions that never touch the bus are added up and handed
+// to emu_cycles() at the next bus access or at the block exit. Interrupts are
+// dispatched by cpu_step() between blocks, a block also leaves early when one
+// became pending, the ROM bank changed or its own code got overwritten.
+//
+// Blocks are keyed by bank:PC, blocks in WRAM/HRAM are dropped on any write to
+// the bytes they were translated from.
+
+#if defined(USE_JIT) && defined(__x86_64__)
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+#define JIT_ARENA_SIZE (4 << 20)
+#define JIT_BLOCK_MAX_CODE 4096
+#define JIT_MAX_BLOCKS 8192
+#define JIT_MAX_RAM_BLOCKS 512
+#define JIT_BUCKETS 4096
+#define JIT_MAX_INSTRUCTIONS 32
+
+#define JIT_FN(f) ((u64)(uintptr_t)(f))
+#define JIT_OFFSET(field) ((u8)offsetof(cpu_context, field))
+
+typedef u16 (*jit_code)(void);
+
+typedef struct jit_block
+{
+    u32 key;
+    u16 start;
+    u16 end;       // first byte past the block
+    jit_code code; // NULL when the first instruction is left to the interpreter
+    struct jit_block *next;
+} jit_block;
+
+typedef struct
+{
+    bool broken;
+    u8 *arena;
+    u32 arena_used;
+
+    jit_block blocks[JIT_MAX_BLOCKS];
+    u32 block_count;
+    jit_block *table[JIT_BUCKETS];
+
+    jit_block *ram_blocks[JIT_MAX_RAM_BLOCKS];
+    u32 ram_block_count;
+    u8 code_map[0x10000 / 8]; // RAM bytes covered by a block
+
+    cpu_context *cpu;
+    u8 bank; // ROM bank mapped when the running block was entered
+    bool exit;
+
+    u8 *out;
+} jit_context;
+
+static jit_context jit = {0};
+
+bool jit_available(void)
+{
+    return true;
+}
+
+static u32 jit_hash(u32 key)
+{
+    return (key ^ (key >> 16)) & (JIT_BUCKETS - 1);
+}
+
+static bool jit_region(u16 pc, u32 *key, u32 *limit)
+{
+    *key = pc;
+
+    if (pc < 0x4000)
+        *limit = 0x4000;
+    else if (pc < 0x8000)
+    {
+        *key |= cart_rom_bank() << 16;
+        *limit = 0x8000;
+    }
+    else if (BETWEEN(pc, 0xC000, 0xDFFF))
+        *limit = 0xE000;
+    else if (BETWEEN(pc, 0xFF80, 0xFFFE))
+        *limit = 0xFFFF;
+    else
+        return false;
+
+    return true;
+}
+
+static void jit_mark(jit_block *block)
+{
+    for (u32 address = block->start; address < block->end; address++)
+        jit.code_map[address >> 3] |= 1 << (address & 7);
+}
+
+void jit_flush(void)
+{
+    jit.arena_used = 0;
+    jit.block_count = 0;
+    jit.ram_block_count = 0;
+
+    memset(jit.table, 0, sizeof(jit.table));
+    memset(jit.code_map, 0, sizeof(jit.code_map));
+}
+
+static void jit_unlink(jit_block *block)
+{
+    jit_block **link = &jit.table[jit_hash(block->key)];
+
+    while (*link != block)
+        link = &(*link)->next;
+
+    *link = block->next;
+}
+
+void jit_write(u16 address)
+{
+    if (!(jit.code_map[address >> 3] & (1 << (address & 7))))
+        return;
+
+    for (u32 i = 0; i < jit.ram_block_count;)
+    {
+        jit_block *block = jit.ram_blocks[i];
+
+        if (address < block->start || address >= block->end)
+        {
+            i++;
+            continue;
+        }
+
+        jit_unlink(block);
+        jit.ram_blocks[i] = jit.ram_blocks[--jit.ram_block_count];
+    }
+
+    memset(jit.code_map + (0xC000 >> 3), 0, sizeof(jit.code_map) - (0xC000 >> 3));
+    for (u32 i = 0; i < jit.ram_block_count; i++)
+        jit_mark(jit.ram_blocks[i]);
+
+    // the running block may be the one just overwritten.
+    jit.exit = true;
+}
+
+static bool jit_should_exit(void)
+{
+    cpu_context *cpu = jit.cpu;
+
+    return jit.exit || jit.bank != cart_rom_bank() ||
+           (cpu->int_master_enabled && (cpu->int_flags & cpu->ie_register));
+}
+
+// clang-format off
+static void emit8(u8 value) { *jit.out++ = value; }
+static void emit16(u16 value) { memcpy(jit.out, &value, 2); jit.out += 2; }
+static void emit32(u32 value) { memcpy(jit.out, &value, 4); jit.out += 4; }
+static void emit64(u64 value) { memcpy(jit.out, &value, 8); jit.out += 8; }
+// clang-format on
+
+static void emit_call(u64 function)
+{
+    emit8(0x48), emit8(0xB8), emit64(function); // movabs rax, function
+    emit8(0xFF), emit8(0xD0);                   // call rax
+}
+
+static void emit_call_proc(u64 function)
+{
+    emit8(0x48), emit8(0x89), emit8(0xDF); // mov rdi, rbx
+    emit_call(function);
+}
+
+static void emit_store8(u8 offset, u8 value)
+{
+    emit8(0xC6), emit8(0x43), emit8(offset), emit8(value); // mov byte [rbx + offset], value
+}
+
+static void emit_store16(u8 offset, u16 value)
+{
+    emit8(0x66), emit8(0xC7), emit8(0x43), emit8(offset), emit16(value); // mov word [rbx + offset], value
+}
+
+static void emit_store_ptr(u8 offset, const void *value)
+{
+    emit8(0x48), emit8(0xB8), emit64((u64)(uintptr_t)value); // movabs rax, value
+    emit8(0x48), emit8(0x89), emit8(0x43), emit8(offset);     // mov [rbx + offset], rax
+}
+
+static void emit_load8(u8 offset)
+{
+    emit8(0x0F), emit8(0xB6), emit8(0x43), emit8(offset); // movzx eax, byte [rbx + offset]
+}
+
+static void emit_save8(u8 offset)
+{
+    emit8(0x88), emit8(0x43), emit8(offset); // mov [rbx + offset], al
+}
+
+static void emit_save16(u8 offset)
+{
+    emit8(0x66), emit8(0x89), emit8(0x43), emit8(offset); // mov [rbx + offset], ax
+}
+
+static void emit_cycles(u32 cycles)
+{
+    if (cycles == 0)
+        return;
+
+    emit8(0xBF), emit32(cycles); // mov edi, cycles
+    emit_call(JIT_FN(emu_cycles));
+}
+
+static void emit_return(u16 pc)
+{
+    emit8(0xB8), emit32(pc); // mov eax, pc
+    emit8(0x5B);             // pop rbx
+    emit8(0xC3);             // ret
+}
+
+static u8 jit_reg_offset(reg_type rt)
+{
+    // clang-format off
+    switch (rt)
+    {
+    case RT_A: return JIT_OFFSET(regs.a);
+    case RT_F: return JIT_OFFSET(regs.f);
+    case RT_B: case RT_BC: return JIT_OFFSET(regs.b);
+    case RT_C: return JIT_OFFSET(regs.c);
+    case RT_D: case RT_DE: return JIT_OFFSET(regs.d);
+    case RT_E: return JIT_OFFSET(regs.e);
+    case RT_H: case RT_HL: return JIT_OFFSET(regs.h);
+    case RT_L: return JIT_OFFSET(regs.l);
+    case RT_SP: return JIT_OFFSET(regs.sp);
+    default: return 0xFF;
+    }
+    // clang-format on
+}
+
+static bool jit_reg8(reg_type rt)
+{
+    return rt >= RT_A && rt <= RT_L;
+}
+
+static bool jit_ends_block(instruction *inst)
+{
+    switch (inst->type)
+    {
+    case IN_JP:
+    case IN_JR:
+    case IN_CALL:
+    case IN_RET:
+    case IN_RETI:
+    case IN_RST:
+    case IN_EI:
+    case IN_DI:
+    case IN_HALT:
+    case IN_STOP:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool jit_touches_bus(instruction *inst, u8 cb)
+{
+    switch (inst->type)
+    {
+    case IN_LDH:
+    case IN_POP:
+    case IN_PUSH:
+    case IN_CALL:
+    case IN_RET:
+    case IN_RETI:
+    case IN_RST:
+        return true;
+    case IN_CB:
+        return (cb & 0x7) == 0x6;
+    default:
+        break;
+    }
+
+    switch (inst->mode)
+    {
+    case AM_NONE:
+    case AM_R:
+    case AM_R_R:
+    case AM_R_D8:
+    case AM_R_D16:
+    case AM_D8:
+    case AM_D16:
+    case AM_HL_SPR:
+        return false;
+    default:
+        return true;
+    }
+}
+
+// Register moves that need neither flags nor the processors.
+static bool jit_emit_inline(instruction *inst, u16 imm)
+{
+    if (inst->type == IN_NOP)
+        return true;
+
+    if (inst->type != IN_LD)
+        return false;
+
+    if (inst->mode == AM_R_R && jit_reg8(inst->reg_1) && jit_reg8(inst->reg_2))
+    {
+        emit_load8(jit_reg_offset(inst->reg_2));
+        emit_save8(jit_reg_offset(inst->reg_1));
+        return true;
+    }
+
+    if (inst->mode == AM_R_D8 && jit_reg8(inst->reg_1))
+    {
+        emit_store8(jit_reg_offset(inst->reg_1), imm);
+        return true;
+    }
+
+    if (inst->mode == AM_R_D16)
+    {
+        // register pairs are stored high byte first.
+        u16 value = inst->reg_1 == RT_SP ? imm : (imm >> 8) | (imm << 8);
+        emit_store16(jit_reg_offset(inst->reg_1), value);
+        return true;
+    }
+
+    return false;
+}
+
+static void emit_fetch(instruction *inst, u16 imm)
+{
+    emit_store8(JIT_OFFSET(dest_is_mem), false);
+
+    switch (inst->mode)
+    {
+    case AM_NONE:
+        return;
+
+    case AM_R:
+    case AM_R_R:
+    {
+        reg_type rt = inst->mode == AM_R ? inst->reg_1 : inst->reg_2;
+
+        if (!jit_reg8(rt))
+        {
+            emit_call(JIT_FN(cpu_fetch_data));
+            return;
+        }
+
+        emit_load8(jit_reg_offset(rt));
+        emit_save16(JIT_OFFSET(fetched_data));
+        return;
+    }
+
+    default:
+        emit_store16(JIT_OFFSET(fetched_data), imm);
+        return;
+    }
+}
+
+static void emit_instruction(u8 opcode, instruction *inst)
+{
+    emit_store8(JIT_OFFSET(current_opcode), opcode);
+    emit_store_ptr(JIT_OFFSET(current_instruction), inst);
+}
+
+static jit_code jit_compile(cpu_context *cpu, u16 start, u32 limit, u16 *end)
+{
+    u8 *code = jit.arena + jit.arena_used;
+    jit.out = code;
+
+    emit8(0x53);                                    // push rbx
+    emit8(0x48), emit8(0xBB), emit64((uintptr_t)cpu); // movabs rbx, cpu
+
+    u32 pending = 0;
+    u32 pc = start;
+    u32 last_pc = start;
+    u8 last_opcode = 0;
+    instruction *last_inst = NULL;
+    bool pc_stored = false;
+
+    for (u8 count = 0; count < JIT_MAX_INSTRUCTIONS; count++)
+    {
+        u8 opcode = bus_peek(pc);
+        instruction *inst = instruction_by_opcode(opcode);
+        u8 length = inst_length(inst);
+
+        if (inst->type == IN_NONE || pc + length > limit)
+            break;
+
+        u16 imm = 0;
+        for (u8 i = 1; i < length; i++)
+            imm |= bus_peek(pc + i) << (8 * (i - 1));
+
+        u16 next = pc + length;
+        bool ends = jit_ends_block(inst);
+
+        last_pc = pc;
+        last_opcode = opcode;
+        last_inst = inst;
+
+        if (jit_touches_bus(inst, imm))
+        {
+            emit_cycles(pending + 1);
+            pending = 0;
+
+            emit_instruction(opcode, inst);
+            emit_store16(JIT_OFFSET(regs.pc), pc + 1);
+            emit_call(JIT_FN(cpu_fetch_data));
+            emit_call_proc(JIT_FN(inst_get_processor(inst->type)));
+            pc_stored = true;
+
+            if (!ends)
+            {
+                emit_call(JIT_FN(jit_should_exit));
+                emit8(0x84), emit8(0xC0); // test al, al
+                emit8(0x74), emit8(7);    // jz +7
+                emit_return(pc);
+            }
+        }
+        else if (jit_emit_inline(inst, imm))
+        {
+            pending += length;
+            pc_stored = false;
+        }
+        else
+        {
+            emit_instruction(opcode, inst);
+            emit_store16(JIT_OFFSET(regs.pc), next);
+            emit_fetch(inst, imm);
+            emit_call_proc(JIT_FN(inst_get_processor(inst->type)));
+            pending += length;
+            pc_stored = true;
+        }
+
+        pc = next;
+
+        if (ends)
+            break;
+    }
+
+    if (last_inst == NULL)
+        return NULL;
+
+    if (!pc_stored)
+        emit_store16(JIT_OFFSET(regs.pc), pc);
+
+    // cpu_idle_update() looks at the last instruction of the block.
+    emit_instruction(last_opcode, last_inst);
+    emit_cycles(pending);
+    emit_return(last_pc);
+
+    assert(jit.out - code <= JIT_BLOCK_MAX_CODE);
+
+    jit.arena_used += jit.out - code;
+    *end = pc;
+
+    return (jit_code)(uintptr_t)code;
+}
+
+static jit_block *jit_translate(cpu_context *cpu, u32 key, u16 start, u32 limit)
+{
+    if (jit.arena == NULL)
+    {
+        jit.arena = mmap(NULL, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (jit.arena == MAP_FAILED)
+        {
+            fprintf(stderr, "JIT: failed to map code arena, using the interpreter\n");
+            jit.arena = NULL;
+            jit.broken = true;
+            return NULL;
+        }
+    }
+
+    bool ram = start >= 0xC000;
+
+    if (jit.block_count == JIT_MAX_BLOCKS || jit.arena_used + JIT_BLOCK_MAX_CODE > JIT_ARENA_SIZE ||
+        (ram && jit.ram_block_count == JIT_MAX_RAM_BLOCKS))
+        jit_flush();
+
+    jit_block *block = &jit.blocks[jit.block_count++];
+    block->key = key;
+    block->start = start;
+    block->code = jit_compile(cpu, start, limit, &block->end);
+
+    if (block->code == NULL)
+        block->end = start + 1;
+
+    u32 bucket = jit_hash(key);
+    block->next = jit.table[bucket];
+    jit.table[bucket] = block;
+
+    if (ram)
+    {
+        jit.ram_blocks[jit.ram_block_count++] = block;
+        jit_mark(block);
+    }
+
+    return block;
+}
+
+bool jit_run(cpu_context *cpu, u16 *last_pc)
+{
+    u32 key;
+    u32 limit;
+
+    if (jit.broken || !jit_region(cpu->regs.pc, &key, &limit))
+        return false;
+
+    jit_block *block = jit.table[jit_hash(key)];
+    while (block && block->key != key)
+        block = block->next;
+
+    if (block == NULL)
+        block = jit_translate(cpu, key, cpu->regs.pc, limit);
+
+    if (block == NULL || block->code == NULL)
+        return false;
+
+    jit.cpu = cpu;
+    jit.bank = cart_rom_bank();
+    jit.exit = false;
+
+    *last_pc = block->code();
+    return true;
+}
+
+#else
+
+bool jit_available(void)
+{
+    return false;
+}
+
+bool jit_run(cpu_context *cpu, u16 *last_pc)
+{
+    ((void)cpu);
+    ((void)last_pc);
+    return false;
+}
+
+void jit_write(u16 address)
+{
+    ((void)address);
+}
+
+void jit_flush(void)
+{
+}
+
+#endif
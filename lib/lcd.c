@@ -1,8 +1,11 @@
 #include <lcd.h>
 #include <ppu.h>
 #include <dma.h>
+#include <trace.h>
+#include <render.h>
 
 static lcd_context ctx = {0};
+static _Thread_local lcd_context *current = &ctx;
 
 static u32 colors_default[4] = {COLOR0, COLOR1, COLOR2, COLOR3};
 
@@ -25,11 +28,43 @@ void lcd_init(void)
         ctx.sp1_colors[i] = colors_default[i];
         ctx.sp2_colors[i] = colors_default[i];
     }
+
+    // the CGB boot rom leaves every color white
+    ctx.bcps = 0;
+    ctx.ocps = 0;
+    memset(ctx.bg_cram, 0xFF, sizeof(ctx.bg_cram));
+    memset(ctx.obj_cram, 0xFF, sizeof(ctx.obj_cram));
+
+    for (int i = 0; i < 32; i++)
+    {
+        ctx.cgb_bg_colors[i / 4][i % 4] = 0xFFFFFFFF;
+        ctx.cgb_obj_colors[i / 4][i % 4] = 0xFFFFFFFF;
+    }
 }
 
 lcd_context *lcd_get_context(void)
 {
-    return &ctx;
+    return current;
+}
+
+void lcd_set_context(lcd_context *lcd)
+{
+    current = lcd ? lcd : &ctx;
+}
+
+static const char *mode_names[4] = {"hblank", "vblank", "oam", "xfer"};
+
+void lcd_set_mode(lcd_mode mode)
+{
+    static u64 mode_start = 0;
+
+    if (trace_active)
+    {
+        trace_complete(TRACK_PPU, mode_names[LCDS & 0x3], mode_start, ctx.ly);
+        mode_start = trace_now();
+    }
+
+    LCDS = (LCDS & 0xFC) | mode;
 }
 
 u8 lcd_read(u16 address)
@@ -40,6 +75,68 @@ u8 lcd_read(u16 address)
     return p[offset];
 }
 
+static u32 cram_color(const u8 *cram, u8 index)
+{
+    u16 rgb = cram[index & 0x3E] | cram[(index & 0x3E) + 1] << 8;
+
+    u8 r = (rgb >> 0) & 0x1F;
+    u8 g = (rgb >> 5) & 0x1F;
+    u8 b = (rgb >> 10) & 0x1F;
+
+    // 5 to 8 bits per channel
+    r = (r << 3) | (r >> 2);
+    g = (g << 3) | (g >> 2);
+    b = (b << 3) | (b >> 2);
+
+    return 0xFF000000 | r << 16 | g << 8 | b;
+}
+
+u8 lcd_cram_read(u16 address)
+{
+    // clang-format off
+    switch (address)
+    {
+    case 0xFF68: return ctx.bcps | 0x40;
+    case 0xFF69: return ctx.bg_cram[ctx.bcps & 0x3F];
+    case 0xFF6A: return ctx.ocps | 0x40;
+    default:     return ctx.obj_cram[ctx.ocps & 0x3F];
+    }
+    // clang-format on
+}
+
+static void cram_write(u8 *spec, u8 *cram, u32 colors[8][4], u8 value)
+{
+    u8 index = *spec & 0x3F;
+
+    cram[index] = value;
+    colors[index >> 3][(index >> 1) & 0x3] = cram_color(cram, index);
+
+    // auto increment
+    if (*spec & 0x80)
+        *spec = 0x80 | ((index + 1) & 0x3F);
+}
+
+void lcd_cram_store(lcd_context *lcd, u16 address, u8 value)
+{
+    // clang-format off
+    switch (address)
+    {
+    case 0xFF68: lcd->bcps = value & 0xBF; break;
+    case 0xFF69: cram_write(&lcd->bcps, lcd->bg_cram, lcd->cgb_bg_colors, value); break;
+    case 0xFF6A: lcd->ocps = value & 0xBF; break;
+    default:     cram_write(&lcd->ocps, lcd->obj_cram, lcd->cgb_obj_colors, value); break;
+    }
+    // clang-format on
+}
+
+void lcd_cram_write(u16 address, u8 value)
+{
+    if (render_active)
+        render_write(address, value);
+
+    lcd_cram_store(&ctx, address, value);
+}
+
 static void palette_update(u32 *palette, u8 palette_data)
 {
     palette[0] = colors_default[(palette_data >> 0) & 0x3];
@@ -48,33 +145,49 @@ static void palette_update(u32 *palette, u8 palette_data)
     palette[3] = colors_default[(palette_data >> 6) & 0x3];
 }
 
-void lcd_write(u16 address, u8 value)
+void lcd_store(lcd_context *lcd, u16 address, u8 value)
 {
+    // LY is read only, the PPU indexes the frame with it
+    if (address == 0xFF44)
+        return;
+
     u8 offset = (address - ADDR_LCD_START);
-    u8 *p = (u8 *)&ctx;
+    u8 *p = (u8 *)lcd;
     p[offset] = value;
 
-    if (offset == 6)
+    // clang-format off
+    switch (address)
     {
-        dma_start(value);
-        return;
+    case 0xFF47: palette_update(lcd->bg_colors, value); break;
+    case 0xFF48: palette_update(lcd->sp1_colors, value & 0xFC); break;
+    case 0xFF49: palette_update(lcd->sp2_colors, value & 0xFC); break;
     }
+    // clang-format on
+}
 
-    if (address == 0xFF47)
+void lcd_write(u16 address, u8 value)
+{
+    if (render_active)
     {
-        palette_update(ctx.bg_colors, value);
-        return;
-    }
+        render_write(address, value);
 
-    if (address == 0xFF48)
-    {
-        palette_update(ctx.sp1_colors, value & 0xFC);
-        return;
+        // writing the mode bits of STAT can end the transfer early
+        if (address == 0xFF41 && LCDS_MODE == MODE_XFER && (value & 0x3) != MODE_XFER)
+            render_line();
     }
 
-    if (address == 0xFF49)
-    {
-        palette_update(ctx.sp2_colors, value & 0xFC);
-        return;
-    }
+    lcd_store(&ctx, address, value);
+
+    if (address == DMA_TRANSFER)
+        dma_start(value);
+}
+
+void lcd_state_save(state_stream *stream)
+{
+    STATE_PUT(stream, ctx);
+}
+
+void lcd_state_load(state_stream *stream)
+{
+    STATE_GET(stream, ctx);
 }
@@ -0,0 +1,138 @@
+#include <link.h>
+#include <state.h>
+#include <serial.h>
+#include <emu.h>
+#include <ppu.h>
+
+// Two machines on one cable, in one thread. The modules keep a single machine
+// in their static contexts, so the link swaps whole machines through state
+// snapshots: each runs until it is `quantum` ticks past the other, then hands
+// the CPU over. A byte clocked on the internal clock hands over at once so the
+// other side shifts it in on the right tick, what comes back is the other
+// side's SB as it was at most a quantum ago.
+//
+// The local machine is the one on screen and on the speakers, the peer is
+// hidden: it keeps time without drawing, is not heard and nobody holds its
+// joypad.
+
+bool link_active = false;
+
+typedef struct
+{
+    state_snapshot *machine; // while the other one runs
+
+    // the serial port as it was when the machine was swapped out
+    u8 out;
+    bool waiting; // transfer armed on the external clock
+
+    // a byte the other machine clocked in
+    bool pending;
+    u8 in;
+    u64 tick;
+} link_side;
+
+typedef struct
+{
+    link_side sides[2];
+    u8 current;
+    u32 quantum;
+    u64 until; // tick the loaded machine hands over at
+    u32 frame;
+} link_context;
+
+static link_context ctx = {0};
+
+void link_init(u32 quantum)
+{
+    link_stop();
+
+    ctx.current = 0;
+    ctx.quantum = quantum;
+    ctx.until = EMU->ticks + quantum;
+    ctx.frame = PPU->current_frame;
+
+    for (u8 i = 0; i < 2; i++)
+    {
+        ctx.sides[i] = (link_side){.machine = state_create(), .out = 0xFF};
+        state_save(ctx.sides[i].machine);
+    }
+
+    link_active = true;
+}
+
+static void link_switch(void)
+{
+    link_side *side = ctx.sides + ctx.current;
+    link_side *other = ctx.sides + !ctx.current;
+    u64 ticks = EMU->ticks;
+
+    if (ctx.current == 0)
+        ctx.frame = PPU->current_frame;
+
+    side->out = SERIAL->sb;
+    side->waiting = BIT(SERIAL->sc, 7) && !BIT(SERIAL->sc, 0);
+    state_save(side->machine);
+
+    state_load(other->machine);
+    ctx.current = !ctx.current;
+
+    EMU->hidden = ctx.current == 1;
+    PFC->timing_only = ctx.current == 1;
+
+    if (other->pending)
+    {
+        serial_clock_in(other->in, other->tick);
+        other->pending = false;
+    }
+
+    ctx.until = ticks + ctx.quantum;
+}
+
+void link_stop(void)
+{
+    if (!link_active)
+        return;
+
+    // the local machine is the one saved to the battery
+    if (ctx.current != 0)
+        link_switch();
+
+    for (u8 i = 0; i < 2; i++)
+        state_destroy(ctx.sides[i].machine);
+
+    link_active = false;
+}
+
+void link_update(void)
+{
+    if (EMU->ticks >= ctx.until)
+        link_switch();
+}
+
+u32 link_idle_ticks(void)
+{
+    return ctx.until > EMU->ticks ? ctx.until - EMU->ticks : 0;
+}
+
+u8 link_transfer(u8 value)
+{
+    link_side *other = ctx.sides + !ctx.current;
+
+    other->pending = true;
+    other->in = value;
+    other->tick = EMU->ticks;
+
+    ctx.until = EMU->ticks;
+
+    return other->waiting ? other->out : 0xFF;
+}
+
+bool link_peer(void)
+{
+    return link_active && ctx.current == 1;
+}
+
+u32 link_frame(void)
+{
+    return ctx.current == 0 ? PPU->current_frame : ctx.frame;
+}
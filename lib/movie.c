@@ -0,0 +1,223 @@
+#include <movie.h>
+#include <cart.h>
+
+// A movie holds the joypad state latched at each frame (see gamepad_latch).
+// Only changes are stored, as a varint count of frames since the previous
+// change followed by the button byte. The header holds the number of frames
+// recorded, patched when the recording stops:
+//
+//   "GBMV" version:u8 checksum:u8 global_checksum:u16 length:u32
+//   { delta:varint buttons:u8 }*
+//
+// Buttons use the bit order a, b, select, start, right, left, up, down.
+
+#define MOVIE_MAGIC "GBMV"
+#define MOVIE_VERSION 1
+#define MOVIE_HEADER_SIZE 12
+
+typedef enum
+{
+    MOVIE_IDLE,
+    MOVIE_RECORDING,
+    MOVIE_REPLAYING,
+} movie_mode;
+
+typedef struct
+{
+    u32 frame;
+    u8 buttons;
+} movie_event;
+
+typedef struct
+{
+    movie_mode mode;
+    FILE *fp;
+
+    // recording
+    u32 last_frame;
+    u8 last_buttons;
+    u32 frames;
+
+    // replay
+    movie_event *events;
+    u32 event_count;
+    u32 length;
+} movie_context;
+
+static movie_context ctx;
+
+static void movie_write_varint(u32 value)
+{
+    do
+    {
+        u8 byte = value & 0x7F;
+        value >>= 7;
+        fputc(byte | (value ? 0x80 : 0), ctx.fp);
+    } while (value);
+}
+
+static bool movie_read_varint(FILE *fp, u32 *value)
+{
+    *value = 0;
+
+    for (u8 shift = 0; shift < 35; shift += 7)
+    {
+        int byte = fgetc(fp);
+        if (byte == EOF)
+            return false;
+
+        *value |= (u32)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+
+    return false;
+}
+
+static void movie_rom_id(u8 *id)
+{
+    const rom_header *header = cart_header();
+
+    id[0] = header ? header->checksum : 0;
+    id[1] = header ? header->global_checksum : 0;
+    id[2] = header ? header->global_checksum >> 8 : 0;
+}
+
+bool movie_start_record(const char *path)
+{
+    movie_stop();
+
+    ctx.fp = fopen(path, "wb");
+    if (!ctx.fp)
+    {
+        fprintf(stderr, "FAILED TO OPEN: %s\n", path);
+        return false;
+    }
+
+    u8 header[MOVIE_HEADER_SIZE] = MOVIE_MAGIC;
+    header[4] = MOVIE_VERSION;
+    movie_rom_id(header + 5);
+    fwrite(header, sizeof(header), 1, ctx.fp);
+
+    ctx.mode = MOVIE_RECORDING;
+    ctx.last_frame = 0;
+    ctx.last_buttons = 0;
+    ctx.frames = 0;
+
+    return true;
+}
+
+bool movie_start_replay(const char *path)
+{
+    movie_stop();
+
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+    {
+        fprintf(stderr, "FAILED TO OPEN: %s\n", path);
+        return false;
+    }
+
+    u8 header[MOVIE_HEADER_SIZE];
+    u8 id[3];
+    movie_rom_id(id);
+
+    if (fread(header, sizeof(header), 1, fp) != 1 || memcmp(header, MOVIE_MAGIC, 4) != 0 ||
+        header[4] != MOVIE_VERSION)
+    {
+        fprintf(stderr, "INVALID MOVIE: %s\n", path);
+        fclose(fp);
+        return false;
+    }
+
+    if (memcmp(header + 5, id, sizeof(id)) != 0)
+        printf("Movie %s was recorded with another ROM\n", path);
+
+    u32 capacity = 0;
+    u32 frame = 0;
+    u32 delta;
+    int buttons;
+
+    while (movie_read_varint(fp, &delta) && (buttons = fgetc(fp)) != EOF)
+    {
+        frame += delta;
+
+        if (ctx.event_count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 256;
+            ctx.events = realloc(ctx.events, capacity * sizeof(movie_event));
+            assert(ctx.events != NULL);
+        }
+
+        ctx.events[ctx.event_count++] = (movie_event){frame, buttons};
+    }
+
+    fclose(fp);
+
+    ctx.mode = MOVIE_REPLAYING;
+    ctx.length = header[8] | header[9] << 8 | header[10] << 16 | (u32)header[11] << 24;
+
+    return true;
+}
+
+void movie_stop(void)
+{
+    if (ctx.mode == MOVIE_RECORDING)
+    {
+        u8 length[4] = {ctx.frames, ctx.frames >> 8, ctx.frames >> 16, ctx.frames >> 24};
+
+        fseek(ctx.fp, 8, SEEK_SET);
+        fwrite(length, sizeof(length), 1, ctx.fp);
+        fclose(ctx.fp);
+    }
+
+    free(ctx.events);
+    memset(&ctx, 0, sizeof(ctx));
+}
+
+u32 movie_length(void)
+{
+    return ctx.mode == MOVIE_REPLAYING ? ctx.length : 0;
+}
+
+void movie_record(u32 frame, u8 buttons)
+{
+    if (ctx.mode != MOVIE_RECORDING)
+        return;
+
+    ctx.frames = frame;
+
+    if (buttons == ctx.last_buttons)
+        return;
+
+    movie_write_varint(frame - ctx.last_frame);
+    fputc(buttons, ctx.fp);
+
+    ctx.last_frame = frame;
+    ctx.last_buttons = buttons;
+}
+
+// looked up, not stepped through: run-ahead latches frames ahead of the
+// machine, then restores it and latches them again
+bool movie_replay(u32 frame, u8 *buttons)
+{
+    if (ctx.mode != MOVIE_REPLAYING)
+        return false;
+
+    // first event after `frame`
+    u32 low = 0;
+    u32 high = ctx.event_count;
+
+    while (low < high)
+    {
+        u32 mid = (low + high) / 2;
+
+        if (ctx.events[mid].frame <= frame)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    *buttons = low ? ctx.events[low - 1].buttons : 0;
+    return true;
+}
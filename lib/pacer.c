@@ -0,0 +1,172 @@
+#include <pacer.h>
+#include <apu.h>
+#include <audio.h>
+#include <prof.h>
+#include <trace.h>
+
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+// Frames are released against an absolute CLOCK_MONOTONIC deadline that
+// advances by exactly 70224 ticks of the 4 MHz clock per frame (the fraction
+// of a nanosecond is carried over). The thread sleeps until shortly before
+// the deadline and spins the rest of the way, since a sleep may wake up late
+// by the scheduler's granularity.
+//
+// With the sdl audio sink the host audio clock is what must never be
+// starved, and it drifts from the system clock. After each frame the fill
+// level of the sample ring is compared to a target latency and the APU
+// resampling ratio is nudged proportionally (dynamic rate control), so the
+// ring settles around the target without audible pitch changes. If the ring
+// still grows past twice the target, the frame waits for the device to drain.
+
+#define PACER_SPIN_NS 300000LL
+#define PACER_AUDIO_TARGET (APU_SAMPLE_RATE / 20) // 50 ms
+#define PACER_AUDIO_SKEW 0.005
+#define PACER_POLL_NS 1000000LL
+
+#define NSEC_PER_SEC 1000000000LL
+
+typedef struct
+{
+    bool enabled;
+    int64_t deadline;
+    u64 remainder; // nanoseconds * PACER_CLOCK not yet added to deadline
+    int64_t last;  // release time of the previous frame
+
+    pacer_stats stats;
+    double m2; // running sum of squared deviations (Welford)
+} pacer_context;
+
+static pacer_context ctx;
+
+static int64_t pacer_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void pacer_sleep_until(int64_t deadline)
+{
+    struct timespec ts = {
+        .tv_sec = deadline / NSEC_PER_SEC,
+        .tv_nsec = deadline % NSEC_PER_SEC,
+    };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+static void pacer_audio(void)
+{
+    u32 fill = audio_buffered();
+
+    double error = ((double)PACER_AUDIO_TARGET - fill) / PACER_AUDIO_TARGET;
+    apu_set_resample_ratio(1 + PACER_AUDIO_SKEW * error);
+
+    while (audio_buffered() > PACER_AUDIO_TARGET * 2)
+        pacer_sleep_until(pacer_now() + PACER_POLL_NS);
+}
+
+static void pacer_wait(int64_t deadline)
+{
+    int64_t now = pacer_now();
+
+    if (deadline - now > PACER_SPIN_NS)
+        pacer_sleep_until(deadline - PACER_SPIN_NS);
+
+    while (pacer_now() < deadline)
+        ;
+}
+
+static void pacer_record(int64_t now)
+{
+    pacer_stats *stats = &ctx.stats;
+
+    if (now - ctx.deadline > stats->max_late_ns)
+        stats->max_late_ns = now - ctx.deadline;
+
+    if (ctx.last != 0)
+    {
+        int64_t interval = now - ctx.last;
+        u64 n = ++stats->frames;
+
+        double delta = interval - stats->mean_ns;
+        stats->mean_ns += delta / n;
+        ctx.m2 += delta * (interval - stats->mean_ns);
+        stats->stddev_ns = n > 1 ? sqrt(ctx.m2 / (n - 1)) : 0;
+
+        if (n == 1 || interval < stats->min_ns)
+            stats->min_ns = interval;
+        if (interval > stats->max_ns)
+            stats->max_ns = interval;
+    }
+
+    ctx.last = now;
+}
+
+void pacer_init(void)
+{
+    memset(&ctx, 0, sizeof(ctx));
+
+    ctx.enabled = true;
+    ctx.deadline = pacer_now();
+}
+
+void pacer_stop(void)
+{
+    if (!ctx.enabled)
+        return;
+
+    ctx.enabled = false;
+    apu_set_resample_ratio(1);
+
+    pacer_stats *stats = &ctx.stats;
+    if (stats->frames > 0)
+        printf("PACER: %llu frames, %.3f ms avg, %.3f ms jitter, %.3f-%.3f ms, %.3f ms late max, %llu missed\n",
+               (unsigned long long)stats->frames, stats->mean_ns / 1e6, stats->stddev_ns / 1e6,
+               stats->min_ns / 1e6, stats->max_ns / 1e6, stats->max_late_ns / 1e6,
+               (unsigned long long)stats->missed);
+}
+
+pacer_stats pacer_get_stats(void)
+{
+    return ctx.stats;
+}
+
+void pacer_frame(void)
+{
+    if (!ctx.enabled)
+        return;
+
+    prof_slot slot = PROF_SWITCH(PROF_PACER);
+    u64 start = TRACE_NOW();
+
+    if (audio_sink_get() == AUDIO_SDL)
+        pacer_audio();
+
+    ctx.remainder += (u64)PACER_TICKS_PER_FRAME * NSEC_PER_SEC;
+    ctx.deadline += ctx.remainder / PACER_CLOCK;
+    ctx.remainder %= PACER_CLOCK;
+
+    int64_t now = pacer_now();
+
+    // too far behind (breakpoint, slow host), don't try to catch up.
+    if (now - ctx.deadline > NSEC_PER_SEC / 10)
+    {
+        ctx.deadline = now;
+        ctx.last = 0;
+        ctx.stats.missed++;
+        PROF_RESTORE(slot);
+        return;
+    }
+
+    pacer_wait(ctx.deadline);
+    pacer_record(pacer_now());
+
+    TRACE_COMPLETE(TRACK_THREAD, "pacer", start, 0);
+    PROF_RESTORE(slot);
+}
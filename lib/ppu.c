@@ -1,8 +1,11 @@
 #include <ppu.h>
 #include <lcd.h>
 #include <ppu_sm.h>
+#include <bus.h>
+#include <render.h>
 
 static ppu_context ctx = {0};
+static _Thread_local ppu_context *current = &ctx;
 
 #undef PPU
 #define PPU (ctx)
@@ -18,20 +21,28 @@ static ppu_context ctx = {0};
 
 ppu_context *ppu_get_context(void)
 {
-    return &ctx;
+    return current;
+}
+
+void ppu_set_context(ppu_context *ppu)
+{
+    current = ppu ? ppu : &ctx;
 }
 
 void ppu_init(void)
 {
     ctx.current_frame = 0;
     ctx.line_ticks = 0;
-    ctx.video_buffer = malloc(YRES * XRES * sizeof(32));
+
+    // kept across resets
+    if (!ctx.video_buffer)
+        ctx.video_buffer = malloc(YRES * XRES * sizeof(u32));
 
     ctx.pfc.line_x = 0;
     ctx.pfc.pushed_x = 0;
     ctx.pfc.fetch_x = 0;
     ctx.pfc.pixel_fifo.size = 0;
-    ctx.pfc.pixel_fifo.head = ctx.pfc.pixel_fifo.tail = NULL;
+    ctx.pfc.pixel_fifo.head = 0;
     ctx.pfc.cur_fetch_state = FS_TILE;
 
     ctx.line_sprites = 0;
@@ -43,6 +54,8 @@ void ppu_init(void)
 
     memset(ctx.oam_ram, 0, sizeof(ctx.oam_ram));
     memset(ctx.video_buffer, 0, YRES * XRES * sizeof(u32));
+
+    ppu_vram_bank_write(0);
 }
 
 void ppu_tick(void)
@@ -66,6 +79,34 @@ void ppu_tick(void)
     }
 }
 
+u32 ppu_idle_ticks(void)
+{
+    // clang-format off
+    switch (LCDS_MODE)
+    {
+    // sprites are loaded on the first tick, the mode ends on the 80th.
+    case MODE_OAM: return ctx.line_ticks ? 79 - ctx.line_ticks : 0;
+    case MODE_HBLANK: return TICKS_PER_LINE - 1 - ctx.line_ticks;
+    case MODE_VBLANK: return TICKS_PER_LINE - 1 - ctx.line_ticks;
+    default: return 0;
+    }
+    // clang-format on
+}
+
+u32 ppu_quiet_ticks(void)
+{
+    // the transfer can't end before every pixel has been pushed, one per tick.
+    if (LCDS_MODE == MODE_XFER)
+        return ctx.pfc.pushed_x < XRES ? XRES - 1 - ctx.pfc.pushed_x : 0;
+
+    return ppu_idle_ticks();
+}
+
+void ppu_skip(u32 ticks)
+{
+    ctx.line_ticks += ticks;
+}
+
 void ppu_oam_write(u16 address, u8 value)
 {
     if (address >= ADDR_OAM_START)
@@ -73,6 +114,9 @@ void ppu_oam_write(u16 address, u8 value)
 
     u8 *p = (u8 *)ctx.oam_ram;
     p[address] = value;
+
+    if (render_active)
+        render_write(ADDR_OAM_START + address, value);
 }
 
 u8 ppu_oam_read(u16 address)
@@ -86,10 +130,48 @@ u8 ppu_oam_read(u16 address)
 
 void ppu_vram_write(u16 address, u8 value)
 {
-    ctx.vram[address - ADDR_VRAM_START] = value;
+    ctx.vram[ctx.vram_bank][address - ADDR_VRAM_START] = value;
+
+    if (render_active)
+        render_write(address, value);
 }
 
 u8 ppu_vram_read(u16 address)
 {
-    return ctx.vram[address - ADDR_VRAM_START];
+    return ctx.vram[ctx.vram_bank][address - ADDR_VRAM_START];
+}
+
+u8 ppu_vram_bank_read(void)
+{
+    return 0xFE | ctx.vram_bank;
+}
+
+void ppu_vram_bank_write(u8 value)
+{
+    ctx.vram_bank = value & 1;
+    bus_map(ADDR_VRAM_START, ADDR_VRAM_END, ctx.vram[ctx.vram_bank]);
+}
+
+u8 *ppu_vram(void)
+{
+    return ctx.vram[ctx.vram_bank];
+}
+
+void ppu_state_save(state_stream *stream)
+{
+    STATE_PUT(stream, ctx);
+}
+
+void ppu_state_load(state_stream *stream)
+{
+    // the frame buffer and the pixel mode belong to the host
+    u32 *video_buffer = ctx.video_buffer;
+    bool timing_only = ctx.pfc.timing_only;
+
+    STATE_GET(stream, ctx);
+
+    ctx.video_buffer = video_buffer;
+    ctx.pfc.timing_only = timing_only;
+
+    bus_map(ADDR_VRAM_START, ADDR_VRAM_END, ctx.vram[ctx.vram_bank]);
 }
@@ -1,7 +1,7 @@
 #include <ppu_pipeline.h>
 #include <ppu.h>
 #include <lcd.h>
-#include <bus.h>
+#include <emu.h>
 
 bool window_visible(void)
 {
@@ -14,21 +14,9 @@ bool window_visible(void)
 
 static void pixel_fifo_push(u32 value)
 {
-    fifo_entry *next = malloc(sizeof(fifo_entry));
-    next->next = NULL;
-    next->value = value;
-
-    if (!PIXEL_FIFO->head)
-    {
-        PIXEL_FIFO->head = next;
-        PIXEL_FIFO->tail = next;
-    }
-    else
-    {
-        PIXEL_FIFO->tail->next = next;
-        PIXEL_FIFO->tail = next;
-    }
+    assert(PIXEL_FIFO->size < PIXEL_FIFO_SIZE);
 
+    PIXEL_FIFO->pixels[(PIXEL_FIFO->head + PIXEL_FIFO->size) & (PIXEL_FIFO_SIZE - 1)] = value;
     PIXEL_FIFO->size += 1;
 }
 
@@ -36,18 +24,15 @@ static u32 pixel_fifo_pop(void)
 {
     assert(PIXEL_FIFO->size > 0);
 
-    fifo_entry *entry = PIXEL_FIFO->head;
-    PIXEL_FIFO->head = entry->next;
-    PIXEL_FIFO->tail = PIXEL_FIFO->head ? PIXEL_FIFO->tail : PIXEL_FIFO->head;
+    u32 value = PIXEL_FIFO->pixels[PIXEL_FIFO->head];
+    PIXEL_FIFO->head = (PIXEL_FIFO->head + 1) & (PIXEL_FIFO_SIZE - 1);
     PIXEL_FIFO->size -= 1;
 
-    u32 value = entry->value;
-    free(entry);
-
     return value;
 }
 
-static u32 fetch_sprite_pixels(int bit, u32 color, u8 bg_color)
+// bg_priority: the CGB tile attribute puts the background over objects
+static u32 fetch_sprite_pixels(int bit, u32 color, u8 bg_color, bool bg_priority)
 {
     for (int i = 0; i < PPU->fetched_entry_count; i++)
     {
@@ -73,9 +58,13 @@ static u32 fetch_sprite_pixels(int bit, u32 color, u8 bg_color)
         if (index == 0)
             continue;
 
-        if (entry->f_bgp == false || bg_color == 0)
+        if (bg_color == 0 || (entry->f_bgp == false && bg_priority == false))
         {
-            u32 *palette_colors = entry->f_pn ? LCD->sp2_colors : LCD->sp1_colors;
+            const u32 *palette_colors = entry->f_pn ? LCD->sp2_colors : LCD->sp1_colors;
+
+            if (EMU->cgb)
+                palette_colors = LCD->cgb_obj_colors[entry->f_cgb_pn];
+
             color = palette_colors[index];
             break;
         }
@@ -92,14 +81,37 @@ static bool pipeline_fifo_add(void)
     if (PFC->fetch_x < 8 - (LCD->scroll_x % 8))
         return false;
 
+    if (PFC->timing_only)
+    {
+        PIXEL_FIFO->size += 8;
+        PFC->fifo_x += 8;
+        return true;
+    }
+
+    const u8 attr = PFC->bgw_attr;
+    const bool x_flip = BIT(attr, 5);
+    const bool bg_priority = BIT(attr, 7);
+
     for (int bit = 7; bit >= 0; --bit)
     {
-        const u8 hi = BIT(PFC->bgw_fetch_data[1 + 0], bit) << 0;
-        const u8 lo = BIT(PFC->bgw_fetch_data[1 + 1], bit) << 1;
+        const int tile_bit = x_flip ? 7 - bit : bit;
+        const u8 hi = BIT(PFC->bgw_fetch_data[1 + 0], tile_bit) << 0;
+        const u8 lo = BIT(PFC->bgw_fetch_data[1 + 1], tile_bit) << 1;
         const u8 index = hi | lo;
-        const u32 color = LCD->bg_colors[LCDC_BGW_ENABLE ? index : 0];
 
-        pixel_fifo_push(LCDC_OBJ_ENABLE ? fetch_sprite_pixels(bit, color, index) : color);
+        u32 color;
+        u8 bg_color = index;
+
+        if (EMU->cgb)
+        {
+            // LCDC bit 0 only drops the background priority, it is always drawn
+            color = LCD->cgb_bg_colors[attr & 0x7][index];
+            bg_color = LCDC_BGW_ENABLE ? index : 0;
+        }
+        else
+            color = LCD->bg_colors[LCDC_BGW_ENABLE ? index : 0];
+
+        pixel_fifo_push(LCDC_OBJ_ENABLE ? fetch_sprite_pixels(bit, color, bg_color, bg_priority) : color);
         PFC->fifo_x++;
     }
 
@@ -149,7 +161,8 @@ static void pipeline_load_sprite_data(u8 offset)
         if (sprite_height == 16)
             tile_index &= ~(1);
 
-        PFC->fetch_entry_data[(i * 2) + offset] = bus_read(ADDR_VRAM_START + (tile_index * 16) + tile_y + offset);
+        u8 bank = EMU->cgb ? entry->f_cgb_vram_bank : 0;
+        PFC->fetch_entry_data[(i * 2) + offset] = VRAM_AT(bank, ADDR_VRAM_START + (tile_index * 16) + tile_y + offset);
     }
 }
 
@@ -167,7 +180,10 @@ void pipeline_load_window_tile(void)
         if (NEARBY_LIMIT(LCD->ly, window_y, XRES))
         {
             const u8 at_y = PPU->window_line;
-            PFC->bgw_fetch_data[0] = LCDC_WIN_MAP_AREA_READ_AT(at_x, at_y);
+            const u16 map = LCDC_WIN_MAP_AREA_AT(at_x, at_y);
+
+            PFC->bgw_fetch_data[0] = VRAM_AT(0, map);
+            PFC->bgw_attr = VRAM_AT(1, map);
 
             if (LCDC_BGW_DATA_AREA == 0x8800)
                 PFC->bgw_fetch_data[0] += 128;
@@ -175,6 +191,12 @@ void pipeline_load_window_tile(void)
     }
 }
 
+// offset of the tile row, the CGB can flip tiles vertically
+static u8 tile_data_y(void)
+{
+    return BIT(PFC->bgw_attr, 6) ? 14 - PFC->tile_y : PFC->tile_y;
+}
+
 static void pipeline_fetch(void)
 {
     switch (PFC->cur_fetch_state)
@@ -183,7 +205,7 @@ static void pipeline_fetch(void)
     {
         PPU->fetched_entry_count = 0;
 
-        if (LCDC_BGW_ENABLE)
+        if (LCDC_BGW_ENABLE || EMU->cgb)
         {
             u8 tile_y = PFC->map_y;
             tile_y >>= 3;
@@ -191,7 +213,11 @@ static void pipeline_fetch(void)
             u8 tile_x = PFC->map_x;
             tile_x >>= 3;
 
-            PFC->bgw_fetch_data[0] = bus_read(LCDC_BG_MAP_AREA + tile_y * 32 + tile_x);
+            const u16 map = LCDC_BG_MAP_AREA + tile_y * 32 + tile_x;
+
+            // bank 1 holds the attributes, always 0 on DMG
+            PFC->bgw_fetch_data[0] = VRAM_AT(0, map);
+            PFC->bgw_attr = VRAM_AT(1, map);
 
             if (LCDC_BGW_DATA_AREA == 0x8800)
                 PFC->bgw_fetch_data[0] += 0x80;
@@ -199,7 +225,8 @@ static void pipeline_fetch(void)
             pipeline_load_window_tile();
         }
 
-        if (LCDC_OBJ_ENABLE && PPU->line_sprites)
+        // the tile data is still fetched, a line drawn later may reuse it
+        if (LCDC_OBJ_ENABLE && PPU->line_sprites && !PFC->timing_only)
             pipeline_load_sprite_tile();
 
         PFC->cur_fetch_state = FS_DATA0;
@@ -210,9 +237,9 @@ static void pipeline_fetch(void)
     case FS_DATA0:
     {
         u8 data_index = PFC->bgw_fetch_data[0];
-        u8 data_y = PFC->tile_y + 0;
+        u8 data_y = tile_data_y() + 0;
 
-        PFC->bgw_fetch_data[1] = bus_read(LCDC_BGW_DATA_AREA + data_index * 16 + data_y);
+        PFC->bgw_fetch_data[1] = VRAM_AT(BIT(PFC->bgw_attr, 3), LCDC_BGW_DATA_AREA + data_index * 16 + data_y);
         pipeline_load_sprite_data(0);
         PFC->cur_fetch_state = FS_DATA1;
     }
@@ -221,9 +248,9 @@ static void pipeline_fetch(void)
     case FS_DATA1:
     {
         u8 data_index = PFC->bgw_fetch_data[0];
-        u8 data_y = PFC->tile_y + 1;
+        u8 data_y = tile_data_y() + 1;
 
-        PFC->bgw_fetch_data[2] = bus_read(LCDC_BGW_DATA_AREA + data_index * 16 + data_y);
+        PFC->bgw_fetch_data[2] = VRAM_AT(BIT(PFC->bgw_attr, 3), LCDC_BGW_DATA_AREA + data_index * 16 + data_y);
         pipeline_load_sprite_data(1);
         PFC->cur_fetch_state = FS_IDLE;
     }
@@ -248,11 +275,18 @@ static void pipeline_push_pixel(void)
 {
     if (PIXEL_FIFO->size > 8)
     {
-        u32 pixel_data = pixel_fifo_pop();
+        u32 pixel_data = 0;
+
+        if (PFC->timing_only)
+            PIXEL_FIFO->size -= 1;
+        else
+            pixel_data = pixel_fifo_pop();
 
         if (PFC->line_x >= (LCD->scroll_x % 8))
         {
-            VIDEO_BUFFER_SET(PFC->pushed_x, LCD->ly, pixel_data);
+            if (!PFC->timing_only)
+                VIDEO_BUFFER_SET(PFC->pushed_x, LCD->ly, pixel_data);
+
             PFC->pushed_x++;
         }
 
@@ -277,10 +311,6 @@ void pipeline_process(void)
 
 void pipeline_fifo_reset(void)
 {
-    while (PIXEL_FIFO->size)
-        pixel_fifo_pop();
-
-    assert(PIXEL_FIFO->size == 0);
-    assert(PIXEL_FIFO->head == NULL);
-    assert(PIXEL_FIFO->tail == NULL);
+    PIXEL_FIFO->head = 0;
+    PIXEL_FIFO->size = 0;
 }
@@ -4,6 +4,16 @@
 #include <interrupts.h>
 #include <ppu_pipeline.h>
 #include <cart.h>
+#include <apu.h>
+#include <pacer.h>
+#include <gamepad.h>
+#include <prof.h>
+#include <trace.h>
+#include <dma.h>
+#include <hdma.h>
+#include <emu.h>
+#include <render.h>
+#include <recorder.h>
 
 bool window_visible(void);
 
@@ -24,7 +34,13 @@ static void increment_ly(void)
         LCDS_LYC_SET(0);
 }
 
-static void load_line_sprites(void)
+// DMG gives priority to the lowest X, CGB to the lowest OAM index
+static bool sprite_before(const oam_entry *a, const oam_entry *b)
+{
+    return !EMU->cgb && a->x < b->x;
+}
+
+void ppu_load_line_sprites(void)
 {
     int cur_y = LCD->ly;
 
@@ -53,7 +69,7 @@ static void load_line_sprites(void)
             entry->entry = object_entry;
             entry->next = NULL;
 
-            if (PPU->line_sprites == NULL || PPU->line_sprites->entry->x > object_entry->x)
+            if (PPU->line_sprites == NULL || sprite_before(object_entry, PPU->line_sprites->entry))
             {
                 entry->next = PPU->line_sprites;
                 PPU->line_sprites = entry;
@@ -67,7 +83,7 @@ static void load_line_sprites(void)
 
             while (le)
             {
-                if (le->entry->x > object_entry->x)
+                if (sprite_before(object_entry, le->entry))
                 {
                     prev->next = entry;
                     entry->next = le;
@@ -103,10 +119,18 @@ void ppu_mode_oam(void)
     if (PPU->line_ticks == 1)
     {
         // read oam on the first tick only...
+        dma_sync();
+
+        if (render_active)
+        {
+            render_scan();
+            return;
+        }
+
         PPU->line_sprites = 0;
         PPU->line_sprite_count = 0;
 
-        load_line_sprites();
+        ppu_load_line_sprites();
     }
 }
 
@@ -116,20 +140,66 @@ void ppu_mode_xfer(void)
 
     if (PFC->pushed_x >= XRES)
     {
+        if (render_active)
+            render_line();
+
         pipeline_fifo_reset();
         LCDS_MODE_SET(MODE_HBLANK);
         if (LCDS_STAT_INT(SS_HBLANK))
             cpu_request_interrupt(IT_LCD_STAT);
+
+        if (EMU->cgb)
+            hdma_hblank();
     }
 }
 
-void ppu_mode_hblank(void)
+// Hidden frames are thrown away: the game still gets its input and the
+// APU keeps its buffer bounded, nothing else reaches the host.
+static void ppu_frame_end(void)
 {
-    static u32 target_frame_time = 1000 / 60;
-    static u32 prev_frame_time = 0;
     static u32 start_timer = 0;
     static u32 frame_count = 0;
+    static u64 frame_start = 0;
+
+    if (EMU->hidden)
+    {
+        gamepad_latch(PPU->current_frame);
+        apu_end_frame();
+        return;
+    }
+
+    TRACE_COMPLETE(TRACK_FRAME, "frame", frame_start, PPU->current_frame);
+    frame_start = TRACE_NOW();
+
+    gamepad_latch(PPU->current_frame);
+    prof_frame();
+    apu_end_frame();
+
+    pacer_frame();
 
+    // calc FPS...
+    u32 end = get_ticks();
+
+    if (end - start_timer >= 1000)
+    {
+        u32 fps = frame_count;
+        start_timer = end;
+        frame_count = 0;
+
+        printf("FPS: %d\n", fps);
+
+        if (prof_active)
+            prof_print();
+
+        if (cart_need_save())
+            cart_battery_save();
+    }
+
+    frame_count++;
+}
+
+void ppu_mode_hblank(void)
+{
     if (PPU->line_ticks >= TICKS_PER_LINE)
     {
         increment_ly();
@@ -143,27 +213,14 @@ void ppu_mode_hblank(void)
 
             PPU->current_frame++;
 
-            // calc FPS...
-            u32 end = get_ticks();
-            u32 frame_time = end - prev_frame_time;
-
-            if (frame_time < target_frame_time)
-                delay((target_frame_time - frame_time));
+            if (render_active)
+                render_frame();
 
-            if (end - start_timer >= 1000)
-            {
-                u32 fps = frame_count;
-                start_timer = end;
-                frame_count = 0;
-
-                printf("FPS: %d\n", fps);
-
-                if (cart_need_save())
-                    cart_battery_save();
-            }
+            // frames only timed here are drawn and captured elsewhere
+            if (recorder_active && !PFC->timing_only)
+                recorder_frame(&VIDEO_BUFFER);
 
-            frame_count++;
-            prev_frame_time = get_ticks();
+            ppu_frame_end();
         }
         else
         {
@@ -0,0 +1,226 @@
+#include <prof.h>
+#include <emu.h>
+#include <emu_cycle.h>
+
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROF_TSC 1
+#endif
+
+// Host time is accounted per slot by reading a cycle counter (rdtsc, or
+// CLOCK_MONOTONIC elsewhere) whenever a thread switches to another slot, so
+// every counter is exclusive of the slots nested in it: the pacer sleeping
+// inside ppu_tick() is charged to the pacer, not to the PPU.
+//
+// Timer, PPU and DMA are ticked millions of times per second, two counter
+// reads per tick would cost more than the ticks. Their calls are timed
+// individually on one emu_cycles() call out of PROF_SAMPLE only; the other
+// calls are timed as a whole (PROF_SYSTEM) and split with the sampled ratios.
+
+#define PROF_SAMPLE 16
+
+typedef struct
+{
+    prof_slot current;
+    u64 last;
+} prof_thread;
+
+typedef struct
+{
+    u64 ticks[PROF_COUNT]; // counter units
+    u64 calls[PROF_COUNT];
+
+    u64 sample;
+    u64 frames;
+
+    u64 start_counter;
+    u64 start_ns;
+
+    prof_stats last_print;
+} prof_context;
+
+bool prof_active = false;
+
+static prof_context ctx;
+static _Thread_local prof_thread thread;
+
+// clang-format off
+static const char *slot_names[PROF_COUNT] = {
+    [PROF_NONE]  = "none",
+    [PROF_CPU]   = "cpu",
+    [PROF_PPU]   = "ppu",
+    [PROF_TIMER] = "timer",
+    [PROF_DMA]   = "dma",
+    [PROF_APU]   = "apu",
+    [PROF_PACER] = "pacer",
+    [PROF_UI]    = "ui",
+    [PROF_SYSTEM] = "system",
+};
+// clang-format on
+
+static u64 prof_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline u64 prof_counter(void)
+{
+#ifdef PROF_TSC
+    return __rdtsc();
+#else
+    return prof_ns();
+#endif
+}
+
+void prof_init(void)
+{
+    memset(&ctx, 0, sizeof(ctx));
+
+    ctx.start_counter = prof_counter();
+    ctx.start_ns = prof_ns();
+    prof_active = true;
+}
+
+prof_slot prof_switch(prof_slot slot)
+{
+    u64 now = prof_counter();
+    prof_slot previous = thread.current;
+
+    if (previous != PROF_NONE)
+        ctx.ticks[previous] += now - thread.last;
+
+    ctx.calls[slot]++;
+    thread.current = slot;
+    thread.last = now;
+
+    return previous;
+}
+
+void prof_cycles(u64 cpu_cycles)
+{
+    emu_context *emu = emu_get_context();
+
+    if (emu->double_speed)
+    {
+        // CGB double speed is not sampled, it all goes to SYSTEM
+        prof_slot previous = prof_switch(PROF_SYSTEM);
+        emu_cycles_double(cpu_cycles);
+        prof_switch(previous);
+        return;
+    }
+
+    if (++ctx.sample % PROF_SAMPLE != 0)
+    {
+        prof_slot previous = prof_switch(PROF_SYSTEM);
+
+        for (u64 i = 0; i < cpu_cycles; i++)
+            emu_cycle(emu, false);
+
+        prof_switch(previous);
+        return;
+    }
+
+    prof_slot previous = thread.current;
+
+    for (u64 i = 0; i < cpu_cycles; i++)
+        emu_cycle(emu, true);
+
+    prof_switch(previous);
+}
+
+void prof_frame(void)
+{
+    ctx.frames++;
+}
+
+prof_stats prof_get_stats(void)
+{
+    prof_stats stats = {0};
+
+    u64 elapsed = prof_counter() - ctx.start_counter;
+    stats.wall_ns = prof_ns() - ctx.start_ns;
+    stats.frames = ctx.frames;
+
+    double scale = elapsed ? (double)stats.wall_ns / elapsed : 0;
+
+    // split the unsampled time with the sampled ratios
+    u64 sampled = ctx.ticks[PROF_TIMER] + ctx.ticks[PROF_PPU] + ctx.ticks[PROF_DMA];
+
+    for (u32 i = 0; i < PROF_SYSTEM; i++)
+    {
+        double ticks = ctx.ticks[i];
+        u64 calls = ctx.calls[i];
+
+        if (i == PROF_TIMER || i == PROF_PPU || i == PROF_DMA)
+        {
+            if (sampled)
+                ticks += (double)ctx.ticks[PROF_SYSTEM] * ctx.ticks[i] / sampled;
+
+            calls *= PROF_SAMPLE;
+        }
+
+        stats.ns[i] = ticks * scale;
+        stats.calls[i] = calls;
+    }
+
+    return stats;
+}
+
+const char *prof_slot_name(prof_slot slot)
+{
+    return slot_names[slot];
+}
+
+// share of host time per slot since the previous line.
+void prof_print(void)
+{
+    prof_stats stats = prof_get_stats();
+    prof_stats *last = &ctx.last_print;
+
+    u64 wall = stats.wall_ns - last->wall_ns;
+    if (wall == 0)
+        return;
+
+    printf("STATS: %llu frames", (unsigned long long)(stats.frames - last->frames));
+
+    for (u32 i = PROF_CPU; i < PROF_SYSTEM; i++)
+        printf(" %s %.1f%%", slot_names[i], 100.0 * (stats.ns[i] - last->ns[i]) / wall);
+
+    printf("\n");
+
+    *last = stats;
+}
+
+bool prof_dump_json(const char *path)
+{
+    FILE *fp = path ? fopen(path, "w") : stdout;
+
+    if (!fp)
+    {
+        fprintf(stderr, "FAILED TO OPEN: %s\n", path);
+        return false;
+    }
+
+    prof_stats stats = prof_get_stats();
+
+    fprintf(fp, "{\n  \"wall_ns\": %llu,\n  \"frames\": %llu,\n  \"ticks\": %llu,\n  \"slots\": {\n",
+            (unsigned long long)stats.wall_ns, (unsigned long long)stats.frames,
+            (unsigned long long)emu_get_context()->ticks);
+
+    for (u32 i = PROF_CPU; i < PROF_SYSTEM; i++)
+        fprintf(fp, "    \"%s\": {\"ns\": %llu, \"calls\": %llu}%s\n", slot_names[i],
+                (unsigned long long)stats.ns[i], (unsigned long long)stats.calls[i],
+                i + 1 < PROF_SYSTEM ? "," : "");
+
+    fprintf(fp, "  }\n}\n");
+
+    if (path)
+        fclose(fp);
+
+    return true;
+}
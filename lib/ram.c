@@ -1,24 +1,67 @@
 #include <ram.h>
+#include <cpu.h>
+#include <jit.h>
+#include <bus.h>
 
-#define WRAM_SIZE (1 << 13)
+#define WRAM_BANK_SIZE (1 << 12)
+#define WRAM_BANKS 8 // bank 0 at C000, 1 (7 on CGB) switchable at D000
 #define HRAM_SIZE (1 << 7)
 
 typedef struct
 {
-    u8 wram[WRAM_SIZE]; // 8KB
-    u8 hram[HRAM_SIZE]; // 128B
+    u8 wram[WRAM_BANKS][WRAM_BANK_SIZE]; // 32KB
+    u8 wram_bank;                        // bank mapped at D000
+    u8 hram[HRAM_SIZE];                  // 128B
 } ram_context;
 
 static ram_context ctx;
 
+void ram_init(void)
+{
+    ctx.wram_bank = 1;
+    bus_map(0xC000, 0xCFFF, ctx.wram[0]);
+    bus_map(0xD000, 0xDFFF, ctx.wram[1]);
+}
+
 u8 wram_read(u16 address)
 {
-    return ctx.wram[address & (WRAM_SIZE - 1)];
+    u8 bank = address & WRAM_BANK_SIZE ? ctx.wram_bank : 0;
+    return ctx.wram[bank][address & (WRAM_BANK_SIZE - 1)];
 }
 
 void wram_write(u16 address, u8 value)
 {
-    ctx.wram[address & (WRAM_SIZE - 1)] = value;
+    u8 bank = address & WRAM_BANK_SIZE ? ctx.wram_bank : 0;
+    ctx.wram[bank][address & (WRAM_BANK_SIZE - 1)] = value;
+    cpu_cache_write(address);
+    jit_write(address);
+}
+
+u8 wram_bank_read(void)
+{
+    return 0xF8 | ctx.wram_bank;
+}
+
+void wram_bank_write(u8 value)
+{
+    u8 bank = value & 0x7 ? value & 0x7 : 1;
+
+    if (bank == ctx.wram_bank)
+        return;
+
+    ctx.wram_bank = bank;
+    bus_map(0xD000, 0xDFFF, ctx.wram[bank]);
+
+    // code decoded from D000-DFFF belongs to the previous bank
+    for (u32 address = 0xD000; address < 0xE000; address++)
+    {
+        if ((address & 0xFF) == 0)
+            cpu_cache_write(address);
+
+        jit_write(address);
+    }
+
+    cpu_cache_invalidate();
 }
 
 u8 hram_read(u16 address)
@@ -29,4 +72,40 @@ u8 hram_read(u16 address)
 void hram_write(u16 address, u8 value)
 {
     ctx.hram[address & (HRAM_SIZE - 1)] = value;
+    cpu_cache_write(address);
+    jit_write(address);
+}
+
+void ram_state_save(state_stream *stream)
+{
+    STATE_PUT(stream, ctx);
+}
+
+// code decoded from a page is dropped when the snapshot holds other bytes.
+static void ram_invalidate(u16 address, const u8 *live, const u8 *saved, u32 size)
+{
+    for (u32 offset = 0; offset < size; offset += 0x100)
+    {
+        u32 length = size - offset < 0x100 ? size - offset : 0x100;
+
+        if (memcmp(live + offset, saved + offset, length) == 0)
+            continue;
+
+        cpu_cache_write(address + offset);
+
+        for (u32 i = 0; i < length; i++)
+            jit_write(address + offset + i);
+    }
+}
+
+void ram_state_load(state_stream *stream)
+{
+    const ram_context *saved = state_next(stream, sizeof(ctx));
+
+    ram_invalidate(0xC000, ctx.wram[0], saved->wram[0], WRAM_BANK_SIZE);
+    ram_invalidate(0xD000, ctx.wram[ctx.wram_bank], saved->wram[saved->wram_bank], WRAM_BANK_SIZE);
+    ram_invalidate(0xFF80, ctx.hram, saved->hram, HRAM_SIZE - 1);
+
+    memcpy(&ctx, saved, sizeof(ctx));
+    bus_map(0xD000, 0xDFFF, ctx.wram[ctx.wram_bank]);
 }
@@ -0,0 +1,256 @@
+#include <recorder.h>
+#include <ppu.h>
+#include <trace.h>
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+// Video capture without slowing the emulation down. At the end of a frame the
+// drawing thread swaps its video buffer for a free one and queues the full one,
+// a writer thread converts and writes it, then puts the buffer back on the
+// free list. Nothing is copied on the drawing side: when the writer is so far
+// behind that no buffer is free, the frame is dropped and counted instead.
+
+#define RECORDER_BUFFERS 8 // frames in flight, ~130 ms
+#define RECORDER_FILE_BUFFER (256 * 1024)
+
+// single-producer/single-consumer queue of frame buffers
+typedef struct
+{
+    u32 *frames[RECORDER_BUFFERS];
+    _Atomic u32 head; // written by the producer
+    _Atomic u32 tail; // written by the consumer
+} recorder_queue;
+
+typedef struct
+{
+    recorder_format format;
+    FILE *file;
+    bool failed;
+
+    pthread_t thread;
+    atomic_bool stop;
+
+    recorder_queue full; // drawing thread -> writer
+    recorder_queue free; // writer -> drawing thread
+    u32 *shown;
+
+    u8 out[XRES * YRES * 3];
+    u32 written;
+    u32 dropped;
+} recorder_context;
+
+static recorder_context *ctx;
+
+bool recorder_active = false;
+
+static bool queue_push(recorder_queue *queue, u32 *frame)
+{
+    u32 head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+
+    if (head - atomic_load_explicit(&queue->tail, memory_order_acquire) >= RECORDER_BUFFERS)
+        return false;
+
+    queue->frames[head % RECORDER_BUFFERS] = frame;
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+
+    return true;
+}
+
+static u32 *queue_pop(recorder_queue *queue)
+{
+    u32 tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+
+    if (tail == atomic_load_explicit(&queue->head, memory_order_acquire))
+        return NULL;
+
+    u32 *frame = queue->frames[tail % RECORDER_BUFFERS];
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+
+    return frame;
+}
+
+// BT.601 studio range, what Y4M readers assume
+static void recorder_yuv(const u32 *frame)
+{
+    u8 *y = ctx->out;
+    u8 *u = y + XRES * YRES;
+    u8 *v = u + XRES * YRES;
+
+    for (u32 i = 0; i < XRES * YRES; i++)
+    {
+        int r = (frame[i] >> 16) & 0xFF;
+        int g = (frame[i] >> 8) & 0xFF;
+        int b = frame[i] & 0xFF;
+
+        y[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+        u[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+        v[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+    }
+}
+
+static void recorder_rgb(const u32 *frame)
+{
+    u8 *p = ctx->out;
+
+    for (u32 i = 0; i < XRES * YRES; i++)
+    {
+        *p++ = (frame[i] >> 16) & 0xFF;
+        *p++ = (frame[i] >> 8) & 0xFF;
+        *p++ = frame[i] & 0xFF;
+    }
+}
+
+static void recorder_write(const u32 *frame)
+{
+    u64 start = TRACE_NOW();
+
+    if (ctx->format == RECORDER_Y4M)
+    {
+        recorder_yuv(frame);
+        fputs("FRAME\n", ctx->file);
+    }
+    else
+        recorder_rgb(frame);
+
+    // a closed pipe ends the capture, not the emulation
+    if (fwrite(ctx->out, sizeof(ctx->out), 1, ctx->file) != 1)
+    {
+        fprintf(stderr, "VIDEO: write failed, capture stopped\n");
+        ctx->failed = true;
+        return;
+    }
+
+    ctx->written++;
+
+    TRACE_COMPLETE(TRACK_THREAD, "encode", start, ctx->written);
+}
+
+static void *recorder_run(void *data)
+{
+    ((void)data);
+
+    trace_set_thread_name("recorder");
+
+    while (true)
+    {
+        u32 *frame = queue_pop(&ctx->full);
+
+        if (!frame)
+        {
+            if (atomic_load(&ctx->stop))
+                break;
+
+            usleep(1000);
+            continue;
+        }
+
+        if (!ctx->failed)
+            recorder_write(frame);
+
+        queue_push(&ctx->free, frame);
+    }
+
+    return NULL;
+}
+
+// the buffer being drawn stays with its owner, the others are all free
+static void recorder_free(void)
+{
+    u32 *frame;
+    while ((frame = queue_pop(&ctx->free)))
+        free(frame);
+
+    fclose(ctx->file);
+    free(ctx);
+    ctx = NULL;
+}
+
+bool recorder_init(const char *spec)
+{
+    recorder_format format;
+
+    if (strncmp(spec, "y4m:", 4) == 0)
+        format = RECORDER_Y4M;
+    else if (strncmp(spec, "raw:", 4) == 0)
+        format = RECORDER_RAW;
+    else
+        return false;
+
+    FILE *file = fopen(spec + 4, "wb");
+
+    if (!file)
+    {
+        fprintf(stderr, "FAILED TO OPEN: %s\n", spec + 4);
+        return false;
+    }
+
+    ctx = calloc(1, sizeof(recorder_context));
+    assert(ctx != NULL);
+
+    ctx->format = format;
+    ctx->file = file;
+    setvbuf(file, NULL, _IOFBF, RECORDER_FILE_BUFFER);
+
+    // 4194304 / 70224, about 59.73 frames per second
+    if (format == RECORDER_Y4M)
+        fprintf(file, "YUV4MPEG2 W%d H%d F4194304:70224 Ip A1:1 C444\n", XRES, YRES);
+
+    for (u32 i = 0; i < RECORDER_BUFFERS; i++)
+    {
+        u32 *frame = calloc(XRES * YRES, sizeof(u32));
+        assert(frame != NULL);
+        queue_push(&ctx->free, frame);
+    }
+
+    if (pthread_create(&ctx->thread, NULL, recorder_run, NULL))
+    {
+        fprintf(stderr, "Failed to create recorder thread\n");
+        recorder_free();
+        return false;
+    }
+
+    recorder_active = true;
+    return true;
+}
+
+void recorder_stop(void)
+{
+    if (!recorder_active)
+        return;
+
+    recorder_active = false;
+
+    // the writer drains the queued frames first
+    atomic_store(&ctx->stop, true);
+    pthread_join(ctx->thread, NULL);
+
+    printf("VIDEO: %u frames written, %u dropped\n", ctx->written, ctx->dropped);
+    recorder_free();
+}
+
+void recorder_frame(u32 **buffer)
+{
+    u32 *next = queue_pop(&ctx->free);
+    ctx->shown = *buffer;
+
+    if (!next)
+    {
+        ctx->dropped++;
+        return;
+    }
+
+    queue_push(&ctx->full, *buffer);
+    *buffer = next;
+}
+
+const u32 *recorder_shown(void)
+{
+    return ctx->shown ? ctx->shown : VIDEO_BUFFER;
+}
+
+u32 recorder_dropped(void)
+{
+    return ctx ? ctx->dropped : 0;
+}
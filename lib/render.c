@@ -0,0 +1,284 @@
+#include <render.h>
+#include <ppu.h>
+#include <ppu_sm.h>
+#include <ppu_pipeline.h>
+#include <lcd.h>
+#include <trace.h>
+#include <recorder.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+// Pixels are drawn on a thread of their own. The emulation thread keeps the
+// PPU timing (modes, STAT, VBlank) and only counts pixels through the fifo,
+// every VRAM, OAM and LCD register write goes into a lock-free log stamped
+// with the dot it happened on. The render thread replays the log on a copy
+// of the PPU and LCD state and runs the real pixel pipeline on it: writes
+// made during mode 3 are applied at their dot, the others between lines.
+// The frame is presented once its VBlank marker is reached, one frame
+// behind the emulation at most.
+
+#define RENDER_LOG_SIZE (1 << 17)
+#define RENDER_MAX_PENDING 4096
+
+typedef enum
+{
+    RC_WRITE,      // outside of mode 3, applied in order
+    RC_XFER_WRITE, // during mode 3, applied when the line reaches `dot`
+    RC_SCAN,       // OAM scan of line `address`
+    RC_LINE,       // mode 3 of line `address` ended on `dot`, window line in `value`
+    RC_FRAME,      // VBlank, present the frame
+} render_cmd_kind;
+
+typedef struct
+{
+    u16 address;
+    u16 dot;
+    u8 value;
+    u8 kind;
+    u8 bank;
+} render_cmd;
+
+typedef struct
+{
+    render_cmd log[RENDER_LOG_SIZE];
+    _Atomic u32 head; // written by the emulation thread
+    _Atomic u32 tail; // written by the render thread
+
+    pthread_t thread;
+    atomic_bool stop;
+    _Atomic u32 frames;
+
+    // the render thread state
+    ppu_context ppu;
+    lcd_context lcd;
+    u32 *present; // video buffer shown by the UI
+    render_cmd pending[RENDER_MAX_PENDING];
+    u32 pending_count;
+} render_context;
+
+static render_context *ctx;
+
+bool render_active = false;
+
+static void render_push(render_cmd cmd)
+{
+    u32 head = atomic_load_explicit(&ctx->head, memory_order_relaxed);
+
+    // the render thread is a whole log behind, wait for it
+    while (head - atomic_load_explicit(&ctx->tail, memory_order_acquire) >= RENDER_LOG_SIZE)
+        sched_yield();
+
+    ctx->log[head & (RENDER_LOG_SIZE - 1)] = cmd;
+    atomic_store_explicit(&ctx->head, head + 1, memory_order_release);
+}
+
+void render_write(u16 address, u8 value)
+{
+    render_cmd cmd = {
+        .address = address,
+        .dot = PPU->line_ticks,
+        .value = value,
+        .kind = LCDS_MODE == MODE_XFER ? RC_XFER_WRITE : RC_WRITE,
+        .bank = PPU->vram_bank,
+    };
+
+    render_push(cmd);
+}
+
+void render_scan(void)
+{
+    render_push((render_cmd){.address = LCD->ly, .kind = RC_SCAN});
+}
+
+void render_line(void)
+{
+    render_cmd cmd = {
+        .address = LCD->ly,
+        .dot = PPU->line_ticks,
+        .value = PPU->window_line,
+        .kind = RC_LINE,
+    };
+
+    render_push(cmd);
+}
+
+void render_frame(void)
+{
+    render_push((render_cmd){.kind = RC_FRAME});
+}
+
+u32 render_get_frame(void)
+{
+    return ctx ? atomic_load_explicit(&ctx->frames, memory_order_acquire) : 0;
+}
+
+static void render_apply(const render_cmd *cmd)
+{
+    u16 address = cmd->address;
+
+    if (BETWEEN(address, ADDR_VRAM_START, ADDR_VRAM_END))
+        VRAM_AT(cmd->bank, address) = cmd->value;
+    else if (BETWEEN(address, ADDR_OAM_START, ADDR_OAM_END))
+        ((u8 *)PPU->oam_ram)[address - ADDR_OAM_START] = cmd->value;
+    else if (BETWEEN(address, ADDR_CRAM_START, ADDR_CRAM_END))
+        lcd_cram_store(LCD, address, cmd->value);
+    else if (address != 0xFF44) // LY is set by the line marker
+        lcd_store(LCD, address, cmd->value);
+}
+
+static void render_load_sprites(u8 ly)
+{
+    LCD->ly = ly;
+    PPU->line_sprites = NULL;
+    PPU->line_sprite_count = 0;
+    ppu_load_line_sprites();
+}
+
+static void render_scanline(u8 ly, u8 window_line, u16 end)
+{
+    LCD->ly = ly;
+    PPU->window_line = window_line;
+
+    PFC->cur_fetch_state = FS_TILE;
+    PFC->line_x = 0;
+    PFC->fetch_x = 0;
+    PFC->pushed_x = 0;
+    PFC->fifo_x = 0;
+
+    // same dots as ppu_mode_xfer, mode 3 starts on the 81st
+    u32 next = 0;
+
+    for (u32 dot = 81; PFC->pushed_x < XRES && dot <= end; dot++)
+    {
+        // a write made after dot n is seen from dot n + 1
+        while (next < ctx->pending_count && ctx->pending[next].dot < dot)
+            render_apply(&ctx->pending[next++]);
+
+        PPU->line_ticks = dot;
+        pipeline_process();
+    }
+
+    while (next < ctx->pending_count)
+        render_apply(&ctx->pending[next++]);
+
+    ctx->pending_count = 0;
+
+    // a line cut short by a STAT write keeps its pixels for the next one
+    if (PFC->pushed_x >= XRES)
+        pipeline_fifo_reset();
+}
+
+static void render_present(void)
+{
+    memcpy(ctx->present, PPU->video_buffer, YRES * XRES * sizeof(u32));
+
+    if (recorder_active)
+        recorder_frame(&PPU->video_buffer);
+
+    atomic_fetch_add_explicit(&ctx->frames, 1, memory_order_release);
+}
+
+static void render_execute(const render_cmd *cmd)
+{
+    switch (cmd->kind)
+    {
+    case RC_WRITE:
+        render_apply(cmd);
+        break;
+
+    case RC_XFER_WRITE:
+        if (ctx->pending_count < RENDER_MAX_PENDING)
+            ctx->pending[ctx->pending_count++] = *cmd;
+        else
+            render_apply(cmd);
+        break;
+
+    case RC_SCAN:
+        render_load_sprites(cmd->address);
+        break;
+
+    case RC_LINE:
+        render_scanline(cmd->address, cmd->value, cmd->dot);
+        break;
+
+    case RC_FRAME:
+        render_present();
+        break;
+    }
+}
+
+static void *render_run(void *data)
+{
+    ((void)data);
+
+    trace_set_thread_name("render");
+    ppu_set_context(&ctx->ppu);
+    lcd_set_context(&ctx->lcd);
+
+    while (true)
+    {
+        u32 tail = atomic_load_explicit(&ctx->tail, memory_order_relaxed);
+        u32 head = atomic_load_explicit(&ctx->head, memory_order_acquire);
+
+        if (tail == head)
+        {
+            if (atomic_load(&ctx->stop))
+                break;
+
+            usleep(100);
+            continue;
+        }
+
+        for (; tail != head; tail++)
+            render_execute(&ctx->log[tail & (RENDER_LOG_SIZE - 1)]);
+
+        atomic_store_explicit(&ctx->tail, tail, memory_order_release);
+    }
+
+    return NULL;
+}
+
+void render_init(void)
+{
+    ctx = calloc(1, sizeof(render_context));
+    assert(ctx != NULL);
+
+    // start from the state left by emu_init, the fifo is empty on a line start
+    ctx->ppu = *PPU;
+    ctx->lcd = *LCD;
+    ctx->present = PPU->video_buffer;
+    ctx->ppu.video_buffer = calloc(YRES * XRES, sizeof(u32));
+    assert(ctx->ppu.video_buffer != NULL);
+
+    PFC->timing_only = true;
+
+    if (pthread_create(&ctx->thread, NULL, render_run, NULL))
+    {
+        fprintf(stderr, "Failed to create render thread\n");
+        PFC->timing_only = false;
+        free(ctx->ppu.video_buffer);
+        free(ctx);
+        ctx = NULL;
+        return;
+    }
+
+    render_active = true;
+}
+
+void render_stop(void)
+{
+    if (!render_active)
+        return;
+
+    render_active = false;
+    atomic_store(&ctx->stop, true);
+    pthread_join(ctx->thread, NULL);
+
+    PFC->timing_only = false;
+    free(ctx->ppu.video_buffer);
+    free(ctx);
+    ctx = NULL;
+}
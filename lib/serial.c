@@ -0,0 +1,122 @@
+#include <serial.h>
+#include <interrupts.h>
+#include <cpu.h>
+#include <emu.h>
+#include <link.h>
+#include <dbg.h>
+
+// A serial transfer shifts SB out one bit per clock while the other side
+// shifts its own SB in. Like OAM DMA it is a timed event: nothing happens bit
+// by bit, the bytes are swapped when the last bit is clocked. The internal
+// clock runs at 8192 Hz (262144 Hz with the CGB fast clock), the external one
+// belongs to the machine on the other end of the cable (see link.c) and never
+// ticks without one.
+
+#define SERIAL_BITS 8
+#define SERIAL_PERIOD 512     // ticks per bit at 8192 Hz
+#define SERIAL_FAST_PERIOD 16 // ticks per bit at 262144 Hz
+
+static serial_context ctx = {0};
+
+serial_context *serial_get_context(void)
+{
+    return &ctx;
+}
+
+void serial_init(void)
+{
+    ctx.sb = 0x00;
+    ctx.sc = 0x00;
+    ctx.active = false;
+}
+
+static void serial_complete(void)
+{
+    u8 out = ctx.sb;
+
+    // test ROMs print on the internal clock, nothing on the line reads as ones
+    if (BIT(ctx.sc, 0))
+    {
+        dbg_serial(out);
+        ctx.in = link_active ? link_transfer(out) : 0xFF;
+    }
+
+    ctx.sb = ctx.in;
+    ctx.sc &= 0x7F;
+    ctx.active = false;
+
+    cpu_request_interrupt(IT_SERIAL);
+}
+
+void serial_tick(void)
+{
+    if (!ctx.active || EMU->ticks < ctx.end)
+        return;
+
+    serial_complete();
+}
+
+u32 serial_idle_ticks(void)
+{
+    if (!ctx.active)
+        return UINT32_MAX;
+
+    // stop short of the end, serial_tick runs on cycle boundaries
+    return ctx.end > EMU->ticks ? ctx.end - EMU->ticks - 1 : 0;
+}
+
+bool serial_clock_in(u8 value, u64 tick)
+{
+    // a side not waiting on the external clock misses the byte
+    if (!BIT(ctx.sc, 7) || BIT(ctx.sc, 0))
+        return false;
+
+    ctx.active = true;
+    ctx.in = value;
+    ctx.end = tick > EMU->ticks ? tick : EMU->ticks;
+
+    return true;
+}
+
+u8 serial_read(u16 address)
+{
+    if (address == SERIAL_TRANSFER_DATA)
+        return ctx.sb;
+
+    // only the CGB has the clock speed bit
+    return ctx.sc | (EMU->cgb ? 0x7C : 0x7E);
+}
+
+void serial_write(u16 address, u8 value)
+{
+    if (address == SERIAL_TRANSFER_DATA)
+    {
+        ctx.sb = value;
+        return;
+    }
+
+    ctx.sc = value & (EMU->cgb ? 0x83 : 0x81);
+    ctx.active = false;
+
+    if (!BIT(ctx.sc, 7) || !BIT(ctx.sc, 0))
+        return;
+
+    u32 period = BIT(ctx.sc, 1) ? SERIAL_FAST_PERIOD : SERIAL_PERIOD;
+
+    // the serial clock follows the CPU in double speed
+    if (EMU->double_speed)
+        period /= 2;
+
+    ctx.active = true;
+    ctx.end = EMU->ticks + period * SERIAL_BITS;
+}
+
+void serial_state_save(state_stream *stream)
+{
+    STATE_PUT(stream, ctx);
+}
+
+void serial_state_load(state_stream *stream)
+{
+    STATE_GET(stream, ctx);
+}
@@ -0,0 +1,117 @@
+#include <state.h>
+#include <emu.h>
+#include <cpu.h>
+#include <timer.h>
+#include <cart.h>
+#include <ram.h>
+#include <ppu.h>
+#include <lcd.h>
+#include <dma.h>
+#include <hdma.h>
+#include <apu.h>
+#include <gamepad.h>
+#include <serial.h>
+
+// Machine snapshots for run-ahead and rewind. Every module copies its own
+// context in and out of a flat buffer, the bus mappings and decoded code are
+// derived from it and rebuilt on load. Nothing is allocated on save/load, a
+// snapshot costs a few memcpy, mostly VRAM, WRAM and the cartridge RAM.
+
+typedef struct
+{
+    void (*save)(state_stream *stream);
+    void (*load)(state_stream *stream);
+} state_section;
+
+// clang-format off
+static const state_section sections[] = {
+    {emu_state_save,      emu_state_load},
+    {cpu_state_save,      cpu_state_load},
+    {cpu_idle_state_save, cpu_idle_state_load},
+    {timer_state_save,    timer_state_load},
+    {cart_state_save,     cart_state_load},
+    {ram_state_save,      ram_state_load},
+    {ppu_state_save,      ppu_state_load},
+    {lcd_state_save,      lcd_state_load},
+    {dma_state_save,      dma_state_load},
+    {hdma_state_save,     hdma_state_load},
+    {apu_state_save,      apu_state_load},
+    {gamepad_state_save,  gamepad_state_load},
+    {serial_state_save,   serial_state_load},
+};
+// clang-format on
+
+#define SECTION_COUNT (sizeof(sections) / sizeof(sections[0]))
+
+struct state_snapshot
+{
+    u32 size;
+    u8 data[];
+};
+
+void *state_next(state_stream *stream, u32 size)
+{
+    u8 *p = stream->data ? stream->data + stream->size : NULL;
+    stream->size += size;
+    return p;
+}
+
+void state_put(state_stream *stream, const void *data, u32 size)
+{
+    u8 *p = state_next(stream, size);
+
+    if (p)
+        memcpy(p, data, size);
+}
+
+void state_get(state_stream *stream, void *data, u32 size)
+{
+    u8 *p = state_next(stream, size);
+    assert(p != NULL);
+
+    memcpy(data, p, size);
+}
+
+state_snapshot *state_create(void)
+{
+    state_stream stream = {0};
+
+    for (u32 i = 0; i < SECTION_COUNT; i++)
+        sections[i].save(&stream);
+
+    state_snapshot *snapshot = malloc(sizeof(state_snapshot) + stream.size);
+    assert(snapshot != NULL);
+
+    snapshot->size = stream.size;
+    return snapshot;
+}
+
+void state_destroy(state_snapshot *snapshot)
+{
+    free(snapshot);
+}
+
+u32 state_size(const state_snapshot *snapshot)
+{
+    return snapshot->size;
+}
+
+void state_save(state_snapshot *snapshot)
+{
+    state_stream stream = {.data = snapshot->data};
+
+    for (u32 i = 0; i < SECTION_COUNT; i++)
+        sections[i].save(&stream);
+
+    assert(stream.size == snapshot->size);
+}
+
+void state_load(const state_snapshot *snapshot)
+{
+    state_stream stream = {.data = (u8 *)snapshot->data};
+
+    for (u32 i = 0; i < SECTION_COUNT; i++)
+        sections[i].load(&stream);
+
+    assert(stream.size == snapshot->size);
+}
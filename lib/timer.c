@@ -16,28 +16,20 @@ void timer_init(void)
     ctx.tac = 0x00;
 }
 
+// TIMA is clocked on the falling edge of this DIV bit.
+static u8 timer_bit(void)
+{
+    static const u8 bits[4] = {9, 3, 5, 7};
+    return bits[ctx.tac & 0x3];
+}
+
 void timer_tick(void)
 {
     u16 prev_div = ctx.div;
     ctx.div++;
 
-    bool timer_update = false;
-
-    switch (ctx.tac & 0x3)
-    {
-    case 0x0:
-        timer_update = BIT(prev_div, 9) && !BIT(ctx.div, 9);
-        break;
-    case 0x1:
-        timer_update = BIT(prev_div, 3) && !BIT(ctx.div, 3);
-        break;
-    case 0x2:
-        timer_update = BIT(prev_div, 5) && !BIT(ctx.div, 5);
-        break;
-    case 0x3:
-        timer_update = BIT(prev_div, 7) && !BIT(ctx.div, 7);
-        break;
-    }
+    u8 bit = timer_bit();
+    bool timer_update = BIT(prev_div, bit) && !BIT(ctx.div, bit);
 
     if (timer_update && BIT(ctx.tac, 2))
     {
@@ -51,6 +43,52 @@ void timer_tick(void)
     }
 }
 
+u32 timer_idle_ticks(void)
+{
+    if (!BIT(ctx.tac, 2))
+        return UINT32_MAX;
+
+    u32 period = 1 << (timer_bit() + 1);
+    u32 first_edge = period - (ctx.div & (period - 1));
+
+    // number of edges until TIMA reaches 0xFF and raises the interrupt.
+    u32 edges = (u8)(0xFF - ctx.tima);
+    if (edges == 0)
+        edges = 0x100;
+
+    return first_edge + (edges - 1) * period - 1;
+}
+
+void timer_skip(u32 ticks)
+{
+    u32 period = 1 << (timer_bit() + 1);
+    u32 edges = ((ctx.div + ticks) / period) - (ctx.div / period);
+
+    if (BIT(ctx.tac, 2))
+        ctx.tima += edges;
+
+    ctx.div += ticks;
+}
+
+// `ticks` of timer alone, skipping to each increment that overflows
+void timer_run(u32 ticks)
+{
+    while (ticks > 0)
+    {
+        u32 idle = timer_idle_ticks();
+
+        if (idle >= ticks)
+        {
+            timer_skip(ticks);
+            return;
+        }
+
+        timer_skip(idle);
+        timer_tick();
+        ticks -= idle + 1;
+    }
+}
+
 void timer_write(u16 addr, u8 value)
 {
     switch (addr)
@@ -90,3 +128,13 @@ u8 timer_read(u16 addr)
     assert(false);
     return 0;
 }
+
+void timer_state_save(state_stream *stream)
+{
+    STATE_PUT(stream, ctx);
+}
+
+void timer_state_load(state_stream *stream)
+{
+    STATE_GET(stream, ctx);
+}
@@ -0,0 +1,191 @@
+#include <trace.h>
+
+#include <pthread.h>
+#include <time.h>
+
+// Each thread records into its own ring, allocated on its first event, so
+// recording never takes a lock. When a ring is full the oldest events are
+// overwritten: a dump holds the last TRACE_RING_SIZE events of each thread.
+// Rings are only read by trace_dump(), once the other threads are done.
+
+#define TRACE_RING_SIZE (1 << 18)
+#define TRACE_TRACK_TID 1000u
+
+typedef struct
+{
+    u64 ts; // ns since trace_init
+    u64 dur;
+    const char *name;
+    u32 arg;
+    u8 track;
+    char phase;
+} trace_event;
+
+typedef struct trace_ring
+{
+    char name[32];
+    u32 tid;
+    u64 head;
+    trace_event *events;
+    struct trace_ring *next;
+} trace_ring;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    trace_ring *rings;
+    u32 ring_count;
+    u64 start;
+} trace_context;
+
+bool trace_active = false;
+
+static trace_context ctx = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static _Thread_local trace_ring *ring;
+
+// clang-format off
+static const char *track_names[TRACK_COUNT] = {
+    [TRACK_FRAME] = "frames",
+    [TRACK_PPU]   = "ppu modes",
+    [TRACK_DMA]   = "oam dma",
+};
+// clang-format on
+
+static u64 trace_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+u64 trace_now(void)
+{
+    return trace_clock() - ctx.start;
+}
+
+void trace_init(void)
+{
+    ctx.start = trace_clock();
+    trace_active = true;
+}
+
+static trace_ring *trace_get_ring(void)
+{
+    if (ring)
+        return ring;
+
+    ring = calloc(1, sizeof(trace_ring));
+    assert(ring != NULL);
+    ring->events = calloc(TRACE_RING_SIZE, sizeof(trace_event));
+    assert(ring->events != NULL);
+
+    pthread_mutex_lock(&ctx.lock);
+    ring->tid = ++ctx.ring_count;
+    ring->next = ctx.rings;
+    ctx.rings = ring;
+    pthread_mutex_unlock(&ctx.lock);
+
+    snprintf(ring->name, sizeof(ring->name), "thread %u", ring->tid);
+
+    return ring;
+}
+
+void trace_set_thread_name(const char *name)
+{
+    if (!trace_active)
+        return;
+
+    snprintf(trace_get_ring()->name, sizeof(ring->name), "%s", name);
+}
+
+static void trace_push(trace_event event)
+{
+    trace_ring *r = trace_get_ring();
+
+    r->events[r->head++ & (TRACE_RING_SIZE - 1)] = event;
+}
+
+void trace_complete(trace_track track, const char *name, u64 start, u32 arg)
+{
+    u64 now = trace_now();
+
+    trace_push((trace_event){
+        .ts = start,
+        .dur = now - start,
+        .name = name,
+        .arg = arg,
+        .track = track,
+        .phase = 'X',
+    });
+}
+
+void trace_instant(trace_track track, const char *name, u32 arg)
+{
+    trace_push((trace_event){
+        .ts = trace_now(),
+        .name = name,
+        .arg = arg,
+        .track = track,
+        .phase = 'i',
+    });
+}
+
+static void trace_write_name(FILE *fp, u32 tid, const char *name, bool *first)
+{
+    fprintf(fp, "%s\n{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":\"%s\"}}",
+            *first ? "" : ",", tid, name);
+    *first = false;
+}
+
+bool trace_dump(const char *path)
+{
+    FILE *fp = fopen(path, "w");
+
+    if (!fp)
+    {
+        fprintf(stderr, "FAILED TO OPEN: %s\n", path);
+        return false;
+    }
+
+    bool first = true;
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    for (u32 i = TRACK_THREAD + 1; i < TRACK_COUNT; i++)
+        trace_write_name(fp, TRACE_TRACK_TID + i, track_names[i], &first);
+
+    pthread_mutex_lock(&ctx.lock);
+
+    for (trace_ring *r = ctx.rings; r; r = r->next)
+    {
+        trace_write_name(fp, r->tid, r->name, &first);
+
+        u64 begin = r->head > TRACE_RING_SIZE ? r->head - TRACE_RING_SIZE : 0;
+
+        for (u64 n = begin; n < r->head; n++)
+        {
+            trace_event *e = &r->events[n & (TRACE_RING_SIZE - 1)];
+            u32 tid = e->track == TRACK_THREAD ? r->tid : TRACE_TRACK_TID + e->track;
+
+            fprintf(fp, ",\n{\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"name\":\"%s\",\"ts\":%.3f", e->phase, tid, e->name,
+                    e->ts / 1000.0);
+
+            if (e->phase == 'X')
+                fprintf(fp, ",\"dur\":%.3f", e->dur / 1000.0);
+            else
+                fprintf(fp, ",\"s\":\"t\"");
+
+            fprintf(fp, ",\"args\":{\"value\":%u}}", e->arg);
+        }
+    }
+
+    pthread_mutex_unlock(&ctx.lock);
+
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+
+    return true;
+}
@@ -3,6 +3,8 @@
 #include <bus.h>
 #include <ppu.h>
 #include <gamepad.h>
+#include <audio.h>
+#include <recorder.h>
 
 #include <stdio.h>
 
@@ -42,8 +44,8 @@ void display_tile(SDL_Surface *surface, u16 startLocation, u16 tileNum, int x, i
 
     for (int tileY = 0; tileY < 16; tileY += 2)
     {
-        u8 b1 = bus_read(startLocation + (tileNum * 16) + tileY + 0);
-        u8 b2 = bus_read(startLocation + (tileNum * 16) + tileY + 1);
+        u8 b1 = bus_peek(startLocation + (tileNum * 16) + tileY + 0);
+        u8 b2 = bus_peek(startLocation + (tileNum * 16) + tileY + 1);
 
         for (int bit = 7; bit >= 0; bit--)
         {
@@ -110,9 +112,12 @@ void ui_update(void)
     rc.x = rc.y = 0;
     rc.h = rc.w = DEBUG_SCALE;
 
+    // the recorder took the video buffer away with the frame
+    const u32 *frame = recorder_active ? recorder_shown() : VIDEO_BUFFER;
+
     for (int y = 0; y < YRES; y++, rc.y += DEBUG_SCALE, rc.x = 0)
         for (int x = 0; x < XRES; x++, rc.x += DEBUG_SCALE)
-            SDL_FillRect(screen, &rc, VIDEO_BUFFER_GET(x, y));
+            SDL_FillRect(screen, &rc, frame[x + y * XRES]);
 
     status = SDL_UpdateTexture(sdlTexture, NULL, screen->pixels, screen->pitch);
     assert(status == 0);
@@ -181,6 +186,43 @@ void ui_init(void)
     SDL_SetWindowPosition(sdlDebugWindow, x + SCREEN_WIDTH + 10, y);
 }
 
+static SDL_AudioDeviceID audioDevice = 0;
+
+static void ui_audio_callback(void *user, Uint8 *stream, int len)
+{
+    ((void)user);
+    audio_pull((int16_t *)stream, len / (2 * sizeof(int16_t)));
+}
+
+bool ui_audio_open(u32 rate)
+{
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0)
+        return false;
+
+    SDL_AudioSpec want = {0};
+    want.freq = rate;
+    want.format = AUDIO_S16SYS;
+    want.channels = 2;
+    want.samples = 1024;
+    want.callback = ui_audio_callback;
+
+    audioDevice = SDL_OpenAudioDevice(NULL, 0, &want, NULL, 0);
+    if (audioDevice == 0)
+        return false;
+
+    SDL_PauseAudioDevice(audioDevice, 0);
+    return true;
+}
+
+void ui_audio_close(void)
+{
+    if (audioDevice == 0)
+        return;
+
+    SDL_CloseAudioDevice(audioDevice);
+    audioDevice = 0;
+}
+
 void ui_on_key(bool down, u32 key_code)
 {
     // clang-format off
@@ -0,0 +1,79 @@
+#include <apu.h>
+#include <bus.h>
+#include <emu.h>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <vector>
+
+using namespace testing;
+
+namespace gaboem::testing
+{
+    class ApuTest : public Test
+    {
+    public:
+        void SetUp() override
+        {
+            emu_init();
+            apu_set_sink(ApuTest::collect, &m_samples);
+        }
+
+        void TearDown() override
+        {
+            apu_set_sink(NULL, NULL);
+        }
+
+    protected:
+        static void collect(const int16_t *samples, u32 frames, void *user)
+        {
+            auto *out = static_cast<std::vector<int16_t> *>(user);
+            out->insert(out->end(), samples, samples + frames * 2);
+        }
+
+        std::vector<int16_t> m_samples;
+        emu_context *m_emu = emu_get_context();
+    };
+
+    TEST_F(ApuTest, registers_read_back_masked)
+    {
+        bus_write(NR21, 0x80);
+        bus_write(NR22, 0xF0);
+        bus_write(NR24, 0x87);
+
+        ASSERT_THAT(bus_read(NR21), Eq(0xBF));
+        ASSERT_THAT(bus_read(NR24), Eq(0xBF));
+        ASSERT_THAT(bus_read(NR52) & 0x0F, Eq(0x03));
+
+        bus_write(NR52, 0x00);
+        ASSERT_THAT(bus_read(NR52), Eq(0x70));
+        ASSERT_THAT(bus_read(NR22), Eq(0x00));
+    }
+
+    TEST_F(ApuTest, square_wave_is_synthesized_per_frame)
+    {
+        bus_write(NR51, 0x22);
+        bus_write(NR50, 0x77);
+
+        // 50% duty at 131072 / (2048 - 0x77D) = 1 kHz
+        bus_write(NR21, 0x80);
+        bus_write(NR22, 0xF0);
+        bus_write(NR23, 0x7D);
+        bus_write(NR24, 0x87);
+
+        m_emu->ticks += APU_CLOCK / 2;
+        apu_end_frame();
+
+        ASSERT_THAT(m_samples.size(), Eq(APU_SAMPLE_RATE));
+
+        u32 crossings = 0;
+        for (size_t i = 2; i < m_samples.size(); i += 2)
+        {
+            EXPECT_THAT(m_samples[i], Eq(m_samples[i + 1]));
+            crossings += (m_samples[i - 2] < 0) != (m_samples[i] < 0);
+        }
+
+        ASSERT_THAT(crossings, AllOf(Ge(990u), Le(1010u)));
+    }
+}
@@ -0,0 +1,183 @@
+#include <archive.h>
+#include <cart.h>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <zlib.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace testing;
+
+namespace gaboem::testing
+{
+    class ArchiveTest : public Test
+    {
+    public:
+        void SetUp() override
+        {
+            // 64 KB, odd sized so the padding shows
+            m_rom.resize(0x10000 - 0x123);
+            for (size_t i = 0; i < m_rom.size(); i++)
+                m_rom[i] = (u8)(i * 7 + (i >> 8));
+
+            // 16 bytes of title, the last one is the CGB flag
+            std::string title = "ARCHIVE";
+            std::fill(m_rom.begin() + 0x134, m_rom.begin() + 0x144, 0);
+            std::copy(title.begin(), title.end(), m_rom.begin() + 0x134);
+            m_rom[0x147] = 0x00; // ROM only
+            m_rom[0x149] = 0x00; // no RAM
+        }
+
+        void TearDown() override
+        {
+            for (auto &path : m_paths)
+                std::filesystem::remove(path);
+        }
+
+    protected:
+        std::string Path(const std::string &name)
+        {
+            m_paths.push_back(std::filesystem::temp_directory_path() / ("gaboem_archive_test" + name));
+            return m_paths.back().string();
+        }
+
+        void Write(const std::string &path, const std::vector<u8> &data)
+        {
+            std::ofstream file(path, std::ios::binary);
+            file.write((const char *)data.data(), data.size());
+        }
+
+        std::vector<u8> Deflate(const std::vector<u8> &data)
+        {
+            z_stream stream = {};
+            deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+
+            std::vector<u8> out(deflateBound(&stream, data.size()));
+            stream.next_in = (Bytef *)data.data();
+            stream.avail_in = data.size();
+            stream.next_out = out.data();
+            stream.avail_out = out.size();
+            deflate(&stream, Z_FINISH);
+            out.resize(stream.total_out);
+            deflateEnd(&stream);
+
+            return out;
+        }
+
+        // a local file header and its data, the central directory is not read
+        void ZipEntry(std::vector<u8> &zip, const std::string &name, const std::vector<u8> &data, bool deflated)
+        {
+            std::vector<u8> packed = deflated ? Deflate(data) : data;
+            u32 crc = crc32(0, data.data(), data.size());
+
+            auto le = [&zip](u32 value, int bytes) {
+                for (int i = 0; i < bytes; i++)
+                    zip.push_back(value >> (i * 8));
+            };
+
+            le(0x04034B50, 4);
+            le(20, 2);
+            le(0, 2);
+            le(deflated ? 8 : 0, 2);
+            le(0, 4);
+            le(crc, 4);
+            le(packed.size(), 4);
+            le(data.size(), 4);
+            le(name.size(), 2);
+            le(0, 2);
+            zip.insert(zip.end(), name.begin(), name.end());
+            zip.insert(zip.end(), packed.begin(), packed.end());
+        }
+
+        void AssertLoaded(const std::string &path)
+        {
+            ASSERT_TRUE(cart_load(path.c_str()));
+            ASSERT_THAT(std::string(cart_header()->title), Eq("ARCHIVE"));
+
+            // bank 0, then bank 1 in the switchable slot
+            for (u32 i = 0; i < 0x8000; i++)
+                ASSERT_THAT(cart_read(i), Eq(m_rom[i])) << std::hex << i;
+        }
+
+        std::vector<u8> m_rom;
+        std::vector<std::filesystem::path> m_paths;
+    };
+
+    TEST_F(ArchiveTest, plain_gzip_and_zip_read_the_same_rom)
+    {
+        std::string plain = Path(".gb");
+        Write(plain, m_rom);
+        AssertLoaded(plain);
+
+        std::string gz = Path(".gb.gz");
+        gzFile file = gzopen(gz.c_str(), "wb9");
+        gzwrite(file, m_rom.data(), m_rom.size());
+        gzclose(file);
+        AssertLoaded(gz);
+
+        // the readme is skipped, the rom is inflated
+        std::vector<u8> zip;
+        ZipEntry(zip, "readme.txt", std::vector<u8>(100, 'x'), false);
+        ZipEntry(zip, "game.GBC", m_rom, true);
+        std::string path = Path(".zip");
+        Write(path, zip);
+        AssertLoaded(path);
+
+        zip.clear();
+        ZipEntry(zip, "game.gb", m_rom, false);
+        Write(path, zip);
+        AssertLoaded(path);
+
+        // a lone entry, whatever its name
+        zip.clear();
+        ZipEntry(zip, "-", m_rom, true);
+        Write(path, zip);
+        AssertLoaded(path);
+    }
+
+    TEST_F(ArchiveTest, buffer_is_sized_for_the_cartridge)
+    {
+        std::string gz = Path(".gb.gz");
+        gzFile file = gzopen(gz.c_str(), "wb");
+        gzwrite(file, m_rom.data(), m_rom.size());
+        gzclose(file);
+
+        u32 size = 0;
+        u8 *rom = archive_read(gz.c_str(), &size);
+
+        ASSERT_THAT(rom, NotNull());
+        ASSERT_THAT(size, Eq(m_rom.size()));
+        ASSERT_THAT(archive_capacity(size), Eq(0x10000u));
+        ASSERT_THAT(archive_capacity(0), Eq(0x8000u));
+        free(rom);
+    }
+
+    TEST_F(ArchiveTest, damaged_archives_are_rejected)
+    {
+        std::vector<u8> zip;
+        ZipEntry(zip, "game.gb", m_rom, true);
+        zip[zip.size() / 2] ^= 0xFF;
+
+        std::string path = Path(".zip");
+        Write(path, zip);
+        ASSERT_FALSE(cart_load(path.c_str()));
+
+        zip.clear();
+        ZipEntry(zip, "readme.txt", std::vector<u8>(100, 'x'), false);
+        ZipEntry(zip, "notes.txt", std::vector<u8>(100, 'y'), false);
+        Write(path, zip);
+        ASSERT_FALSE(cart_load(path.c_str()));
+
+        std::string gz = Path(".gb.gz");
+        gzFile file = gzopen(gz.c_str(), "wb");
+        gzwrite(file, m_rom.data(), m_rom.size());
+        gzclose(file);
+        std::filesystem::resize_file(gz, std::filesystem::file_size(gz) / 2);
+        ASSERT_FALSE(cart_load(gz.c_str()));
+    }
+}
@@ -0,0 +1,66 @@
+#include <audio.h>
+#include <apu.h>
+#include <bus.h>
+#include <emu.h>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+using namespace testing;
+
+namespace gaboem::testing
+{
+    TEST(AudioRingTest, wraps_around_and_reports_fill)
+    {
+        audio_ring *ring = audio_ring_create(6);
+        std::vector<int16_t> in(16), out(16);
+
+        for (size_t i = 0; i < in.size(); i++)
+            in[i] = i;
+
+        // capacity is rounded up to 8 frames
+        ASSERT_THAT(audio_ring_write(ring, in.data(), 5), Eq(5u));
+        ASSERT_THAT(audio_ring_read(ring, out.data(), 3), Eq(3u));
+        ASSERT_THAT(audio_ring_write(ring, in.data(), 8), Eq(6u));
+        ASSERT_THAT(audio_ring_fill(ring), Eq(8u));
+
+        ASSERT_THAT(audio_ring_read(ring, out.data(), 8), Eq(8u));
+        ASSERT_THAT(out[0], Eq(6));
+        ASSERT_THAT(out[4], Eq(0));
+        ASSERT_THAT(out[15], Eq(11));
+        ASSERT_THAT(audio_ring_read(ring, out.data(), 1), Eq(0u));
+
+        audio_ring_destroy(ring);
+    }
+
+    TEST(AudioWavTest, captures_every_sample)
+    {
+        std::filesystem::path path = std::filesystem::temp_directory_path() / "gaboem_audio_test.wav";
+
+        emu_init();
+        ASSERT_TRUE(audio_init(("wav:" + path.string()).c_str()));
+        ASSERT_THAT(audio_sink_get(), Eq(AUDIO_WAV));
+
+        bus_write(NR21, 0x80);
+        bus_write(NR22, 0xF0);
+        bus_write(NR24, 0x87);
+
+        emu_get_context()->ticks += APU_CLOCK / 8;
+        apu_end_frame();
+        audio_close();
+
+        std::ifstream file(path, std::ios::binary);
+        std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        ASSERT_THAT(data.size(), Eq(44u + APU_SAMPLE_RATE / 8 * 4));
+        ASSERT_THAT(std::string(data.begin(), data.begin() + 4), Eq("RIFF"));
+        ASSERT_THAT(data[40] | data[41] << 8 | data[42] << 16, Eq(APU_SAMPLE_RATE / 8 * 4));
+
+        std::filesystem::remove(path);
+    }
+}
@@ -0,0 +1,100 @@
+#include <bus.h>
+#include <cpu.h>
+#include <emu.h>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <vector>
+
+extern cpu_context ctx;
+
+using namespace testing;
+
+namespace gaboem::testing
+{
+    class BusWatchTest : public Test
+    {
+    public:
+        void SetUp() override
+        {
+            emu_init();
+        }
+
+    protected:
+        static void collect(const bus_access *access, void *user)
+        {
+            static_cast<std::vector<bus_access> *>(user)->push_back(*access);
+        }
+
+        std::vector<bus_access> m_hits;
+    };
+
+    TEST_F(BusWatchTest, reports_accesses_to_the_watched_range)
+    {
+        int id = bus_watch(0xC010, 0xC01F, BUS_WATCH_READ | BUS_WATCH_WRITE, BusWatchTest::collect, &m_hits);
+        ASSERT_THAT(id, Ge(0));
+
+        bus_write(0xC010, 0x42);
+        ASSERT_THAT(bus_read(0xC010), Eq(0x42));
+
+        ASSERT_THAT(m_hits.size(), Eq(2u));
+        ASSERT_THAT(m_hits[0].address, Eq(0xC010));
+        ASSERT_THAT(m_hits[0].value, Eq(0x42));
+        ASSERT_TRUE(m_hits[0].write);
+        ASSERT_FALSE(m_hits[1].write);
+        ASSERT_THAT(m_hits[1].pc, Eq(cpu_inst_pc()));
+
+        // same page, outside of the range
+        bus_write(0xC020, 0x01);
+        ASSERT_THAT(bus_peek(0xC010), Eq(0x42));
+        ASSERT_THAT(m_hits.size(), Eq(2u));
+
+        bus_unwatch(id);
+        bus_write(0xC010, 0x43);
+        ASSERT_THAT(bus_read(0xC010), Eq(0x43));
+        ASSERT_THAT(m_hits.size(), Eq(2u));
+    }
+
+    TEST_F(BusWatchTest, write_watch_keeps_reads_direct)
+    {
+        int id = bus_watch(0xFF80, 0xFF80, BUS_WATCH_WRITE, BusWatchTest::collect, &m_hits);
+
+        bus_write(0xFF80, 0x12);
+        ASSERT_THAT(bus_read(0xFF80), Eq(0x12));
+        ASSERT_THAT(bus_read(0xC000), Eq(bus_peek(0xC000)));
+
+        ASSERT_THAT(m_hits.size(), Eq(1u));
+        ASSERT_THAT(m_hits[0].value, Eq(0x12));
+
+        bus_unwatch(id);
+    }
+
+    TEST_F(BusWatchTest, idle_skip_only_reports_real_reads) // LDH A,(LY) / CP $90 / JR NZ
+    {
+        const u8 code[] = {0xF0, 0x44, 0xFE, 0x90, 0x20, 0xFA};
+
+        for (u16 i = 0; i < sizeof(code); i++)
+            bus_write(0xC000 + i, code[i]);
+
+        emu_get_context()->idle_skip = true;
+        ctx.regs.pc = 0xC000;
+
+        int id = bus_watch(0xFF44, 0xFF44, BUS_WATCH_READ, BusWatchTest::collect, &m_hits);
+        u32 loads = 0;
+
+        while (ctx.regs.pc != 0xC000 + sizeof(code))
+        {
+            loads += ctx.regs.pc == 0xC000;
+            cpu_step();
+        }
+
+        bus_unwatch(id);
+        emu_get_context()->idle_skip = false;
+
+        // the detector checks the loop with peeks, the skipped polls are not reported
+        ASSERT_THAT(m_hits.size(), Eq(loads));
+        for (const bus_access &hit : m_hits)
+            ASSERT_THAT(hit.pc, Eq(0xC000));
+    }
+}
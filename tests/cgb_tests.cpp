@@ -0,0 +1,146 @@
+#include <bus.h>
+#include <dma.h>
+#include <emu.h>
+#include <hdma.h>
+#include <lcd.h>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+using namespace testing;
+
+namespace gaboem::testing
+{
+    class CgbTest : public Test
+    {
+    public:
+        void SetUp() override
+        {
+            emu_init();
+            m_emu->cgb = true;
+        }
+
+        void TearDown() override
+        {
+            m_emu->cgb = false;
+            m_emu->double_speed = false;
+            m_emu->stall = 0;
+        }
+
+    protected:
+        emu_context *m_emu = emu_get_context();
+    };
+
+    TEST_F(CgbTest, vram_and_wram_are_banked)
+    {
+        bus_write(0x8000, 0x11);
+        bus_write(VRAM_BANK, 0x01);
+        bus_write(0x8000, 0xAA);
+        ASSERT_THAT(bus_read(VRAM_BANK), Eq(0xFF));
+
+        bus_write(VRAM_BANK, 0x00);
+        ASSERT_THAT(bus_read(0x8000), Eq(0x11));
+
+        bus_write(WRAM_BANK, 0x02);
+        bus_write(0xD000, 0x22);
+        bus_write(WRAM_BANK, 0x03);
+        bus_write(0xD000, 0x33);
+        bus_write(0xC000, 0x44);
+
+        bus_write(WRAM_BANK, 0x02);
+        ASSERT_THAT(bus_read(0xD000), Eq(0x22));
+        ASSERT_THAT(bus_read(0xC000), Eq(0x44));
+
+        // bank 0 selects bank 1
+        bus_write(WRAM_BANK, 0x00);
+        ASSERT_THAT(bus_read(WRAM_BANK), Eq(0xF9));
+    }
+
+    TEST_F(CgbTest, palette_writes_auto_increment)
+    {
+        // palette 1, color 0, pure red
+        bus_write(0xFF68, 0x88);
+        bus_write(0xFF69, 0x1F);
+        bus_write(0xFF69, 0x00);
+
+        ASSERT_THAT(bus_read(0xFF68), Eq(0xCA));
+        ASSERT_THAT(lcd_get_context()->cgb_bg_colors[1][0], Eq(0xFFFF0000u));
+    }
+
+    TEST_F(CgbTest, general_purpose_hdma_copies_at_once)
+    {
+        for (u16 i = 0; i < 0x20; i++)
+            bus_write(0xC100 + i, i);
+
+        bus_write(0xFF51, 0xC1);
+        bus_write(0xFF52, 0x00);
+        bus_write(0xFF53, 0x01);
+        bus_write(0xFF54, 0x00);
+
+        u64 start = m_emu->ticks;
+        bus_write(0xFF55, 0x01);
+
+        ASSERT_THAT(m_emu->ticks - start, Eq(2u * 8 * 4));
+        ASSERT_THAT(bus_read(0x8100), Eq(0x00));
+        ASSERT_THAT(bus_read(0x811F), Eq(0x1F));
+        ASSERT_THAT(bus_read(0xFF55), Eq(0xFF));
+    }
+
+    TEST_F(CgbTest, hblank_hdma_copies_a_block_per_line)
+    {
+        bus_write(0xFF51, 0xC2);
+        bus_write(0xFF52, 0x00);
+        bus_write(0xFF53, 0x02);
+        bus_write(0xFF54, 0x00);
+        bus_write(0xFF55, 0x81);
+
+        ASSERT_THAT(bus_read(0xFF55), Eq(0x01));
+
+        hdma_hblank();
+        ASSERT_THAT(bus_read(0xFF55), Eq(0x00));
+
+        hdma_hblank();
+        ASSERT_THAT(bus_read(0xFF55), Eq(0xFF));
+        ASSERT_THAT(m_emu->stall, Eq(16u));
+    }
+
+    TEST_F(CgbTest, stop_switches_speed_when_armed)
+    {
+        ASSERT_FALSE(emu_speed_switch());
+
+        bus_write(SPEED_SWITCH, 0x01);
+        ASSERT_TRUE(emu_speed_switch());
+        ASSERT_THAT(bus_read(SPEED_SWITCH), Eq(0xFE));
+
+        u64 start = m_emu->ticks;
+        emu_cycles(4);
+        ASSERT_THAT(m_emu->ticks - start, Eq(8u));
+    }
+
+    TEST_F(CgbTest, oam_dma_follows_double_speed)
+    {
+        for (u16 i = 0; i < 0xA0; i++)
+            bus_write(0xC100 + i, i ^ 0x5A);
+
+        for (int fast = 0; fast < 2; fast++)
+        {
+            m_emu->double_speed = fast;
+
+            u64 start = m_emu->ticks;
+            bus_write(DMA_TRANSFER, 0xC1);
+
+            u32 cycles = 0;
+            while (dma_transfering())
+            {
+                emu_cycles(1);
+                cycles++;
+            }
+
+            // 2 cycles of delay then a byte per cycle, at either speed
+            ASSERT_THAT(cycles, Eq(162u));
+            ASSERT_THAT(m_emu->ticks - start, Eq(162u * (fast ? 2 : 4)));
+            ASSERT_THAT(bus_read(0xFE00), Eq(0x5A));
+            ASSERT_THAT(bus_read(0xFE9F), Eq(0x9F ^ 0x5A));
+        }
+    }
+}
@@ -2,6 +2,9 @@
 #include <cpu.h>
 #include <bus.h>
 #include <emu.h>
+#include <lcd.h>
+#include <interrupts.h>
+#include <jit.h>
 
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
@@ -9,6 +12,7 @@
 #include <iostream>
 #include <string>
 #include <filesystem>
+#include <array>
 
 extern cpu_context ctx;
 
@@ -74,4 +78,291 @@ namespace gaboem::testing
         ASSERT_THAT(cpu_read_reg(RT_SP), Eq(sp));
         ASSERT_THAT(m_emu->ticks, Eq(12));
     }
+
+    TEST_F(CpuTest, illegal_opcode_locks_the_cpu) // NOP / $DD
+    {
+        bus_write(0xC000, 0x00);
+        bus_write(0xC001, 0xDD);
+
+        ASSERT_TRUE(cpu_step());
+        ASSERT_FALSE(cpu_step());
+        ASSERT_TRUE(m_cpu->locked);
+
+        u64 ticks = m_emu->ticks;
+        ASSERT_FALSE(cpu_step());
+        ASSERT_THAT(m_emu->ticks, Eq(ticks));
+
+        emu_init();
+        ASSERT_FALSE(m_cpu->locked);
+    }
+
+    TEST_F(CpuTest, inc_keeps_carry_of_lazy_sub) // LD A,$10 / SUB $20 / INC B
+    {
+        u16 pc = m_cpu->regs.pc;
+        bus_write(pc++, 0x3E);
+        bus_write(pc++, 0x10);
+        bus_write(pc++, 0xD6);
+        bus_write(pc++, 0x20);
+        bus_write(pc++, 0x04);
+
+        m_cpu->regs.b = 0x00;
+
+        cpu_step();
+        cpu_step();
+        ASSERT_THAT(cpu_read_reg(RT_AF), Eq(0xF050));
+
+        cpu_step();
+        ASSERT_THAT(cpu_read_reg(RT_F), Eq(0x10));
+        ASSERT_THAT(m_cpu->regs.b, Eq(0x01));
+    }
+
+    TEST_F(CpuTest, execute_0x76_wakes_on_vblank) // HALT
+    {
+        u16 pc = m_cpu->regs.pc;
+        bus_write(pc++, 0x76);
+
+        u32 steps = 0;
+        cpu_step();
+        while (m_cpu->halted)
+        {
+            cpu_step();
+            steps++;
+        }
+
+        ASSERT_THAT(m_cpu->int_flags & IT_VBLANK, Ne(0));
+        ASSERT_THAT(LCD->ly, Eq(YRES));
+        ASSERT_THAT(m_emu->ticks, Eq(YRES * TICKS_PER_LINE));
+        ASSERT_THAT(steps, Lt(YRES * TICKS_PER_LINE / 4 / 10));
+    }
+
+    TEST_F(CpuTest, idle_loop_skip_is_cycle_exact) // LDH A,(LY) / CP $90 / JR NZ
+    {
+        const u8 code[] = {0xF0, 0x44, 0xFE, 0x90, 0x20, 0xFA};
+
+        // in double speed a cycle is 2 ticks
+        for (int speed = 0; speed < 2; speed++)
+        {
+            u64 ticks[2];
+            u32 steps[2];
+
+            for (int skip = 0; skip < 2; skip++)
+            {
+                emu_init();
+                m_emu->double_speed = speed;
+                m_emu->idle_skip = skip;
+                m_cpu->regs.pc = 0xC000;
+
+                for (u16 i = 0; i < sizeof(code); i++)
+                    bus_write(0xC000 + i, code[i]);
+
+                steps[skip] = 0;
+                while (m_cpu->regs.pc != 0xC000 + sizeof(code))
+                {
+                    cpu_step();
+                    steps[skip]++;
+                }
+                ticks[skip] = m_emu->ticks;
+            }
+
+            m_emu->double_speed = false;
+            m_emu->idle_skip = false;
+
+            ASSERT_THAT(LCD->ly, Eq(0x90)) << "speed " << speed;
+            ASSERT_THAT(ticks[1], Eq(ticks[0])) << "speed " << speed;
+            ASSERT_THAT(steps[1], Lt(steps[0] / 2)) << "speed " << speed;
+        }
+    }
+
+    TEST_F(CpuTest, fast_timing_reads_io_on_the_same_cycle) // NOP * n / LDH A,(LY) / INC B / CP $90 / JR NZ
+    {
+        const u8 code[] = {0xF0, 0x44, 0x04, 0xFE, 0x90, 0x20, 0xF9};
+
+        // the loop polls every 36 ticks, the NOPs move the polls across a line
+        for (u16 nops = 0; nops < 9; nops++)
+        {
+            u64 ticks[2];
+            u8 polls[2];
+
+            for (int fast = 0; fast < 2; fast++)
+            {
+                emu_init();
+                m_emu->timing = fast ? TIMING_FAST : TIMING_ACCURATE;
+                m_cpu->regs.pc = 0xC000;
+
+                for (u16 i = 0; i < nops; i++)
+                    bus_write(0xC000 + i, 0x00);
+
+                for (u16 i = 0; i < sizeof(code); i++)
+                    bus_write(0xC000 + nops + i, code[i]);
+
+                while (m_cpu->regs.pc != 0xC000 + nops + sizeof(code))
+                    cpu_step();
+
+                ticks[fast] = m_emu->ticks;
+                polls[fast] = m_cpu->regs.b;
+            }
+
+            m_emu->timing = TIMING_ACCURATE;
+
+            ASSERT_THAT(ticks[1], Eq(ticks[0])) << nops << " NOPs";
+            ASSERT_THAT(polls[1], Eq(polls[0])) << nops << " NOPs";
+        }
+    }
+
+    TEST_F(CpuTest, block_cache_sees_code_writes) // INC B / JR -3, then patched to INC C
+    {
+        bus_write(0xC000, 0x04);
+        bus_write(0xC001, 0x18);
+        bus_write(0xC002, 0xFD);
+
+        u8 b = m_cpu->regs.b;
+        u8 c = m_cpu->regs.c;
+
+        for (int i = 0; i < 4; i++)
+            cpu_step();
+
+        bus_write(0xC000, 0x0C);
+
+        for (int i = 0; i < 4; i++)
+            cpu_step();
+
+        ASSERT_THAT(m_cpu->regs.b, Eq((u8)(b + 2)));
+        ASSERT_THAT(m_cpu->regs.c, Eq((u8)(c + 2)));
+        ASSERT_THAT(m_cpu->regs.pc, Eq(0xC000));
+    }
+
+    TEST_F(CpuTest, jit_matches_interpreter) // summing loop, then patches its own code
+    {
+        if (!jit_available())
+            GTEST_SKIP() << "built without USE_JIT";
+
+        const u8 code[] = {
+            0x21, 0x00, 0xC1, // LD HL, $C100
+            0x06, 0x10,       // LD B, $10
+            0x78,             // LD A, B
+            0x81,             // ADD A, C
+            0x4F,             // LD C, A
+            0x22,             // LD (HL+), A
+            0x05,             // DEC B
+            0x20, 0xF9,       // JR NZ, -7
+            0x3E, 0x0C,       // LD A, $0C
+            0xEA, 0x11, 0xC0, // LD ($C011), A
+            0x04,             // INC B, becomes INC C
+            0xF3,             // DI, ends the block
+        };
+
+        u64 ticks[2];
+        u16 regs[2][4];
+
+        for (int jit = 0; jit < 2; jit++)
+        {
+            emu_init();
+            m_emu->jit = jit;
+            m_cpu->regs.pc = 0xC000;
+
+            for (u16 i = 0; i < sizeof(code); i++)
+                bus_write(0xC000 + i, code[i]);
+
+            while (m_cpu->regs.pc != 0xC000 + sizeof(code))
+                cpu_step();
+
+            ticks[jit] = m_emu->ticks;
+            regs[jit][0] = cpu_read_reg(RT_AF);
+            regs[jit][1] = cpu_read_reg(RT_BC);
+            regs[jit][2] = cpu_read_reg(RT_DE);
+            regs[jit][3] = cpu_read_reg(RT_HL);
+        }
+
+        m_emu->jit = false;
+
+        ASSERT_THAT(regs[1][1], Eq(regs[0][1]));
+        ASSERT_THAT(regs[0][1] & 0xFF, Eq(0x9C));
+        ASSERT_THAT(regs[1][0], Eq(regs[0][0]));
+        ASSERT_THAT(regs[1][2], Eq(regs[0][2]));
+        ASSERT_THAT(regs[1][3], Eq(regs[0][3]));
+        ASSERT_THAT(ticks[1], Eq(ticks[0]));
+    }
+
+    class FlatCpuTest : public Test
+    {
+    public:
+        void SetUp() override
+        {
+            emu_init();
+            bus_flat(m_memory.data(), m_log, 16);
+
+            m_cpu->regs.pc = 0x4000;
+            m_cpu->regs.sp = 0x8000;
+        }
+
+        void TearDown() override
+        {
+            bus_flat_end();
+        }
+
+    protected:
+        std::array<u8, 0x10000> m_memory = {};
+        bus_access m_log[16];
+
+        cpu_context *m_cpu = &ctx;
+        emu_context *m_emu = emu_get_context();
+    };
+
+    TEST_F(FlatCpuTest, call_logs_each_access_with_its_cycle) // CALL $1234
+    {
+        m_memory[0x4000] = 0xCD;
+        m_memory[0x4001] = 0x34;
+        m_memory[0x4002] = 0x12;
+
+        u64 start = m_emu->ticks;
+        cpu_step();
+
+        ASSERT_THAT(m_cpu->regs.pc, Eq(0x1234));
+        ASSERT_THAT(m_cpu->regs.sp, Eq(0x7FFE));
+        ASSERT_THAT(m_memory[0x7FFF], Eq(0x40));
+        ASSERT_THAT(m_memory[0x7FFE], Eq(0x03));
+        ASSERT_THAT(m_emu->ticks - start, Eq(24u));
+
+        // opcode, both immediate bytes, then the return address high byte first
+        ASSERT_THAT(bus_flat_count(), Eq(5u));
+        ASSERT_THAT(m_log[0].address, Eq(0x4000));
+        ASSERT_THAT(m_log[2].address, Eq(0x4002));
+        ASSERT_THAT(m_log[3].address, Eq(0x7FFF));
+        ASSERT_TRUE(m_log[3].write);
+        ASSERT_THAT(m_log[4].address, Eq(0x7FFE));
+        ASSERT_THAT(m_log[4].value, Eq(0x03));
+
+        // one M-cycle per read
+        ASSERT_THAT(m_log[1].ticks - m_log[0].ticks, Eq(4u));
+        ASSERT_THAT(m_log[2].ticks - m_log[1].ticks, Eq(4u));
+        ASSERT_THAT(m_log[3].ticks, Gt(m_log[2].ticks));
+        ASSERT_THAT(m_log[4].ticks, Ge(m_log[3].ticks));
+    }
+
+    TEST_F(FlatCpuTest, io_addresses_are_plain_memory) // LDH ($44),A / LD A,($FF44)
+    {
+        m_memory[0x4000] = 0xE0;
+        m_memory[0x4001] = 0x44;
+        m_memory[0x4002] = 0xFA;
+        m_memory[0x4003] = 0x44;
+        m_memory[0x4004] = 0xFF;
+        m_cpu->regs.a = 0x5A;
+
+        cpu_step();
+        m_cpu->regs.a = 0;
+        cpu_step();
+
+        ASSERT_THAT(m_memory[0xFF44], Eq(0x5A));
+        ASSERT_THAT(m_cpu->regs.a, Eq(0x5A));
+    }
+
+    TEST_F(FlatCpuTest, end_puts_the_machine_back)
+    {
+        bus_flat_end();
+
+        bus_write(0xC000, 0x42);
+        ASSERT_THAT(bus_read(0xC000), Eq(0x42));
+        ASSERT_THAT(m_memory[0xC000], Eq(0));
+        ASSERT_FALSE(bus_flat_active);
+    }
 }
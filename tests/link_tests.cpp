@@ -0,0 +1,105 @@
+#include <link.h>
+#include <serial.h>
+#include <cpu.h>
+#include <bus.h>
+#include <emu.h>
+#include <interrupts.h>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+extern cpu_context ctx;
+
+using namespace testing;
+
+namespace gaboem::testing
+{
+    class LinkTest : public Test
+    {
+    public:
+        void SetUp() override
+        {
+            emu_init();
+            m_cpu->regs.pc = 0xC000;
+
+            // JR -2
+            bus_write(0xC000, 0x18);
+            bus_write(0xC001, 0xFE);
+        }
+
+        void TearDown() override
+        {
+            link_stop();
+        }
+
+    protected:
+        // runs whichever machine has the CPU until `done` holds on the local
+        // machine or on the peer
+        template <typename F>
+        void RunUntil(bool peer, F done)
+        {
+            for (u32 i = 0; i < 100000; i++)
+            {
+                if (link_peer() == peer && done())
+                    return;
+
+                cpu_step();
+
+                if (link_active)
+                    link_update();
+            }
+
+            FAIL() << "timed out";
+        }
+
+        cpu_context *m_cpu = &ctx;
+        emu_context *m_emu = emu_get_context();
+    };
+
+    TEST_F(LinkTest, internal_clock_shifts_ones_without_a_cable)
+    {
+        bus_write(SERIAL_TRANSFER_DATA, 0x5A);
+        bus_write(SERIAL_TRANSFER_CONTROL, 0x81);
+
+        u64 start = m_emu->ticks;
+        RunUntil(false, [] { return !BIT(bus_read(SERIAL_TRANSFER_CONTROL), 7); });
+
+        // 8 bits at 8192 Hz
+        ASSERT_THAT(m_emu->ticks - start, AllOf(Ge(4096u), Lt(4096u + 16)));
+        ASSERT_THAT(bus_read(SERIAL_TRANSFER_DATA), Eq(0xFF));
+        ASSERT_THAT(cpu_get_int_flags() & IT_SERIAL, Ne(0));
+    }
+
+    TEST_F(LinkTest, external_clock_waits_without_a_cable)
+    {
+        bus_write(SERIAL_TRANSFER_DATA, 0x5A);
+        bus_write(SERIAL_TRANSFER_CONTROL, 0x80);
+
+        for (u32 i = 0; i < 5000; i++)
+            cpu_step();
+
+        ASSERT_THAT(bus_read(SERIAL_TRANSFER_CONTROL), Eq(0xFE));
+        ASSERT_THAT(bus_read(SERIAL_TRANSFER_DATA), Eq(0x5A));
+    }
+
+    TEST_F(LinkTest, linked_machines_swap_bytes)
+    {
+        // both machines wait on the external clock, the local one then drives
+        bus_write(SERIAL_TRANSFER_DATA, 0x42);
+        bus_write(SERIAL_TRANSFER_CONTROL, 0x80);
+        link_init(LINK_QUANTUM);
+
+        bus_write(SERIAL_TRANSFER_DATA, 0x17);
+        bus_write(SERIAL_TRANSFER_CONTROL, 0x81);
+
+        RunUntil(false, [] { return !BIT(bus_read(SERIAL_TRANSFER_CONTROL), 7); });
+        ASSERT_THAT(bus_read(SERIAL_TRANSFER_DATA), Eq(0x42));
+
+        RunUntil(true, [] { return !BIT(bus_read(SERIAL_TRANSFER_CONTROL), 7); });
+        ASSERT_THAT(bus_read(SERIAL_TRANSFER_DATA), Eq(0x17));
+        ASSERT_THAT(cpu_get_int_flags() & IT_SERIAL, Ne(0));
+
+        link_stop();
+        ASSERT_THAT(bus_read(SERIAL_TRANSFER_DATA), Eq(0x42));
+    }
+}
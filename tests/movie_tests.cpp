@@ -0,0 +1,124 @@
+#include <movie.h>
+#include <gamepad.h>
+#include <emu.h>
+#include <bus.h>
+#include <cpu.h>
+#include <ppu.h>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <filesystem>
+
+extern cpu_context ctx;
+
+using namespace testing;
+
+namespace gaboem::testing
+{
+    class MovieTest : public Test
+    {
+    public:
+        void SetUp() override
+        {
+            emu_init();
+            gamepad_write(0x20); // select the directions
+        }
+
+        void TearDown() override
+        {
+            movie_stop();
+            std::filesystem::remove(m_path);
+        }
+
+    protected:
+        std::filesystem::path m_path = std::filesystem::temp_directory_path() / "gaboem_movie_test.gbm";
+    };
+
+    TEST_F(MovieTest, input_is_latched_per_frame)
+    {
+        GAMEPAD->left = true;
+        ASSERT_THAT(gamepad_read() & 0x0F, Eq(0x0F));
+
+        gamepad_latch(1);
+        ASSERT_THAT(gamepad_read() & 0x0F, Eq(0x0D));
+    }
+
+    TEST_F(MovieTest, replay_matches_recording)
+    {
+        ASSERT_TRUE(movie_start_record(m_path.c_str()));
+
+        for (u32 frame = 1; frame <= 400; frame++)
+        {
+            GAMEPAD->up = frame >= 10 && frame < 300;
+            GAMEPAD->down = frame == 350;
+            gamepad_latch(frame);
+        }
+
+        movie_stop();
+
+        // the host input must be ignored during the replay
+        emu_init();
+        gamepad_write(0x20);
+        GAMEPAD->right = true;
+
+        ASSERT_TRUE(movie_start_replay(m_path.c_str()));
+        ASSERT_THAT(movie_length(), Eq(400u));
+        ASSERT_THAT(std::filesystem::file_size(m_path), Lt(24u));
+
+        for (u32 frame = 1; frame <= 400; frame++)
+        {
+            u8 expected = 0x0F;
+
+            if (frame >= 10 && frame < 300)
+                expected &= ~0x04;
+            if (frame == 350)
+                expected &= ~0x08;
+
+            gamepad_latch(frame);
+            ASSERT_THAT(gamepad_read() & 0x0F, Eq(expected)) << "frame " << frame;
+        }
+    }
+
+    TEST_F(MovieTest, replay_survives_run_ahead)
+    {
+        ASSERT_TRUE(movie_start_record(m_path.c_str()));
+
+        for (u32 frame = 1; frame <= 30; frame++)
+        {
+            GAMEPAD->up = frame % 4 == 0;
+            gamepad_latch(frame);
+        }
+
+        movie_stop();
+
+        ASSERT_TRUE(movie_start_replay(m_path.c_str()));
+
+        // JR -2
+        bus_write(0xC000, 0x18);
+        bus_write(0xC001, 0xFE);
+        ctx.regs.pc = 0xC000;
+
+        emu_context *emu = emu_get_context();
+        emu->run_ahead = 2;
+
+        u32 frame = PPU->current_frame;
+
+        while (PPU->current_frame < 20)
+        {
+            cpu_step();
+
+            if (PPU->current_frame == frame)
+                continue;
+
+            frame = PPU->current_frame;
+            emu_run_ahead();
+
+            // the frame the machine is on, not the one run ahead to
+            u8 expected = frame % 4 == 0 ? 0x0B : 0x0F;
+            ASSERT_THAT(gamepad_read() & 0x0F, Eq(expected)) << "frame " << frame;
+        }
+
+        emu->run_ahead = 0;
+    }
+}
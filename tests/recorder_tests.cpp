@@ -0,0 +1,101 @@
+#include <recorder.h>
+#include <ppu.h>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+using namespace testing;
+
+namespace gaboem::testing
+{
+    class RecorderTest : public Test
+    {
+    public:
+        void TearDown() override
+        {
+            recorder_stop();
+            std::filesystem::remove(m_path);
+        }
+
+    protected:
+        std::vector<unsigned char> Captured(void)
+        {
+            std::ifstream file(m_path, std::ios::binary);
+            return std::vector<unsigned char>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        }
+
+        // the recorder frees the buffers it has when it stops, the one
+        // handed back stays with the caller
+        u32 *Frame(u32 color)
+        {
+            u32 *frame = (u32 *)malloc(XRES * YRES * sizeof(u32));
+            std::fill(frame, frame + XRES * YRES, color);
+            return frame;
+        }
+
+        std::filesystem::path m_path = std::filesystem::temp_directory_path() / "gaboem_recorder_test";
+    };
+
+    TEST_F(RecorderTest, frames_are_swapped_not_copied)
+    {
+        ASSERT_TRUE(recorder_init(("raw:" + m_path.string()).c_str()));
+
+        u32 *frame = Frame(0xFFFF8000);
+        u32 *buffer = frame;
+        recorder_frame(&buffer);
+
+        ASSERT_THAT(buffer, Ne(frame));
+        ASSERT_THAT(recorder_shown(), Eq(frame));
+        ASSERT_THAT(recorder_dropped(), Eq(0u));
+
+        recorder_stop();
+        free(buffer);
+
+        std::vector<unsigned char> data = Captured();
+        ASSERT_THAT(data.size(), Eq(XRES * YRES * 3u));
+        ASSERT_THAT(data[0], Eq(0xFF));
+        ASSERT_THAT(data[1], Eq(0x80));
+        ASSERT_THAT(data[2], Eq(0x00));
+    }
+
+    TEST_F(RecorderTest, y4m_has_a_header_and_framed_planes)
+    {
+        ASSERT_TRUE(recorder_init(("y4m:" + m_path.string()).c_str()));
+
+        u32 *buffer = Frame(0xFFFF8000);
+        recorder_frame(&buffer);
+        recorder_frame(&buffer);
+        recorder_stop();
+        free(buffer);
+
+        std::vector<unsigned char> data = Captured();
+        std::string text(data.begin(), data.end());
+        std::string header = "YUV4MPEG2 W160 H144 F4194304:70224 Ip A1:1 C444\n";
+        size_t frame = 6 + XRES * YRES * 3;
+
+        ASSERT_THAT(text.substr(0, header.size()), Eq(header));
+        ASSERT_THAT(data.size(), Eq(header.size() + frame * 2));
+        ASSERT_THAT(text.substr(header.size(), 6), Eq("FRAME\n"));
+
+        // white in studio range
+        ASSERT_TRUE(recorder_init(("y4m:" + m_path.string()).c_str()));
+        buffer = Frame(0xFFFFFFFF);
+        recorder_frame(&buffer);
+        recorder_stop();
+        free(buffer);
+
+        data = Captured();
+        ASSERT_THAT(data[header.size() + 6], Eq(235));
+        ASSERT_THAT(data[header.size() + 6 + XRES * YRES], Eq(128));
+    }
+
+    TEST_F(RecorderTest, rejects_unknown_formats)
+    {
+        ASSERT_FALSE(recorder_init(("mp4:" + m_path.string()).c_str()));
+        ASSERT_FALSE(recorder_active);
+    }
+}
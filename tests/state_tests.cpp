@@ -0,0 +1,88 @@
+#include <state.h>
+#include <cpu.h>
+#include <bus.h>
+#include <emu.h>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+extern cpu_context ctx;
+
+using namespace testing;
+
+namespace gaboem::testing
+{
+    class StateTest : public Test
+    {
+    public:
+        void SetUp() override
+        {
+            emu_init();
+            m_cpu->regs.pc = 0xC000;
+
+            // INC A; LD (HL+), A; JR -4
+            const u8 program[] = {0x3C, 0x22, 0x18, 0xFC};
+            for (u16 i = 0; i < sizeof(program); i++)
+                bus_write(0xC000 + i, program[i]);
+
+            m_cpu->regs.h = 0xC1;
+            m_cpu->regs.l = 0x00;
+
+            m_snapshot = state_create();
+        }
+
+        void TearDown() override
+        {
+            state_destroy(m_snapshot);
+        }
+
+    protected:
+        void Run(u32 steps)
+        {
+            for (u32 i = 0; i < steps; i++)
+                cpu_step();
+        }
+
+        cpu_context *m_cpu = &ctx;
+        emu_context *m_emu = emu_get_context();
+        state_snapshot *m_snapshot = nullptr;
+    };
+
+    TEST_F(StateTest, load_replays_the_same_steps)
+    {
+        Run(30);
+        state_save(m_snapshot);
+
+        Run(300);
+        u64 ticks = m_emu->ticks;
+        u16 hl = cpu_read_reg(RT_HL);
+        u8 a = m_cpu->regs.a;
+        u8 last = bus_read(hl - 1);
+
+        state_load(m_snapshot);
+        ASSERT_THAT(m_emu->ticks, Lt(ticks));
+
+        Run(300);
+        ASSERT_THAT(m_emu->ticks, Eq(ticks));
+        ASSERT_THAT(cpu_read_reg(RT_HL), Eq(hl));
+        ASSERT_THAT(m_cpu->regs.a, Eq(a));
+        ASSERT_THAT(bus_read(hl - 1), Eq(last));
+    }
+
+    TEST_F(StateTest, load_restores_code_written_after_save)
+    {
+        state_save(m_snapshot);
+        u8 a = m_cpu->regs.a;
+
+        // DEC A instead of INC A, the decoded block must not survive the load
+        Run(6);
+        bus_write(0xC000, 0x3D);
+        Run(6);
+
+        state_load(m_snapshot);
+        ASSERT_THAT(bus_read(0xC000), Eq(0x3C));
+
+        Run(3);
+        ASSERT_THAT(m_cpu->regs.a, Eq(u8(a + 1)));
+    }
+}